@@ -0,0 +1,192 @@
+/*
+ * GStreamer dreamsource read path benchmark
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+/* Runs dreamvideosource and dreamaudiosource side by side against the
+ * simulated encoder for a range of video bitrates and prints the read path
+ * counters the elements collect in their "stats" property. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gst/gst.h>
+
+#define DEFAULT_SECONDS   10
+#define DEFAULT_BITRATES  "2048,8000,20000,50000,100000,200000"   /* kbit/s, up to bitrate_max */
+
+static const gchar *elements[] = { "dreamvideosource0", "dreamaudiosource0" };
+
+static gint64
+process_cpu_time (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static guint64
+stats_get (const GstStructure *stats, const gchar *field)
+{
+	guint64 value = 0;
+	gst_structure_get_uint64 (stats, field, &value);
+	return value;
+}
+
+static gdouble
+stats_usec (const GstStructure *stats, const gchar *field)
+{
+	guint64 value = stats_get (stats, field);
+	return value == GST_CLOCK_TIME_NONE ? -1.0 : (gdouble) value / GST_USECOND;
+}
+
+static gboolean
+run_bitrate (gint bitrate, gint seconds)
+{
+	GstElement *pipeline;
+	GstBus *bus;
+	GstMessage *msg;
+	GError *error = NULL;
+	gchar *desc;
+	gint64 cpu_start, cpu_used;
+	guint64 pushed = 0;
+	gboolean ok = TRUE;
+	guint i;
+
+	desc = g_strdup_printf ("dreamvideosource name=%s bitrate=%d ! fakesink sync=false "
+		"dreamaudiosource name=%s ! fakesink sync=false", elements[0], bitrate, elements[1]);
+	pipeline = gst_parse_launch (desc, &error);
+	g_free (desc);
+	if (!pipeline)
+	{
+		g_printerr ("can't build pipeline: %s\n", error->message);
+		g_clear_error (&error);
+		return FALSE;
+	}
+
+	bus = gst_element_get_bus (pipeline);
+	if (gst_element_set_state (pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+	{
+		g_printerr ("can't start pipeline at %d kbit/s\n", bitrate);
+		ok = FALSE;
+		goto done;
+	}
+
+	cpu_start = process_cpu_time ();
+	msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	cpu_used = process_cpu_time () - cpu_start;
+	if (msg)
+	{
+		if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+		{
+			gst_message_parse_error (msg, &error, NULL);
+			g_printerr ("%s: %s\n", GST_OBJECT_NAME (GST_MESSAGE_SRC (msg)), error->message);
+			g_clear_error (&error);
+		}
+		gst_message_unref (msg);
+		ok = FALSE;
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (elements); i++)
+	{
+		GstElement *element = gst_bin_get_by_name (GST_BIN (pipeline), elements[i]);
+		GstStructure *stats = NULL;
+		gdouble elapsed, stc_rate = 0;
+
+		g_object_get (element, "stats", &stats, NULL);
+		elapsed = (gdouble) stats_get (stats, "elapsed") / GST_SECOND;
+		if (elapsed <= 0)
+			elapsed = 1;
+		pushed += stats_get (stats, "pushed");
+		gst_structure_get_double (stats, "clock-stc-reads-per-second", &stc_rate);
+
+		g_print ("%-18s %7d %9.1f %9.1f %8.2f %9.0f %9.0f %9.0f %10.2f %8" G_GUINT64_FORMAT " %7.1f\n",
+			elements[i], bitrate,
+			stats_get (stats, "descriptors") / elapsed,
+			stats_get (stats, "frames") / elapsed,
+			stats_get (stats, "bytes") / elapsed / (1024 * 1024),
+			stats_usec (stats, "latency-p50"), stats_usec (stats, "latency-p99"), stats_usec (stats, "latency-p999"),
+			(gdouble) stats_get (stats, "mutex-wait") / GST_MSECOND,
+			stats_get (stats, "dropped"), stc_rate);
+
+		gst_structure_free (stats);
+		gst_object_unref (element);
+	}
+	/* both elements share the process, so CPU time is accounted per run */
+	g_print ("%-18s %7d cpu %.1f%%, %.1f us/frame\n\n", "total", bitrate,
+		100.0 * cpu_used / (seconds * G_USEC_PER_SEC),
+		pushed ? (gdouble) cpu_used / pushed : 0.0);
+
+done:
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (bus);
+	gst_object_unref (pipeline);
+	return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+	gint seconds = DEFAULT_SECONDS;
+	gchar *bitrates = NULL;
+	gchar **list;
+	GError *error = NULL;
+	GOptionContext *ctx;
+	gboolean ok = TRUE;
+	guint i;
+
+	GOptionEntry options[] = {
+		{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Duration of each run (default " G_STRINGIFY (DEFAULT_SECONDS) ")", "S" },
+		{ "bitrates", 'b', 0, G_OPTION_ARG_STRING, &bitrates, "Comma separated video bitrates in kbit/s (default " DEFAULT_BITRATES ")", "LIST" },
+		{ NULL }
+	};
+
+	ctx = g_option_context_new ("- dreamsource read path benchmark");
+	g_option_context_add_main_entries (ctx, options, NULL);
+	g_option_context_add_group (ctx, gst_init_get_option_group ());
+	if (!g_option_context_parse (ctx, &argc, &argv, &error))
+	{
+		g_printerr ("%s\n", error->message);
+		return 2;
+	}
+	g_option_context_free (ctx);
+
+	/* never touch real hardware */
+	g_setenv ("GST_DREAMSOURCE_BACKEND", "simulator", TRUE);
+
+	if (!gst_registry_check_feature_version (gst_registry_get (), "dreamvideosource", 1, 0, 0))
+	{
+		g_printerr ("dreamsource plugin not found, set GST_PLUGIN_PATH\n");
+		return 2;
+	}
+
+	g_print ("%-18s %7s %9s %9s %8s %9s %9s %9s %10s %8s %7s\n", "element", "kbit/s", "desc/s", "frames/s", "MiB/s",
+		"p50 us", "p99 us", "p999 us", "mutex ms", "dropped", "stc/s");
+
+	list = g_strsplit (bitrates ? bitrates : DEFAULT_BITRATES, ",", -1);
+	for (i = 0; list[i]; i++)
+		ok &= run_bitrate (atoi (list[i]), seconds);
+	g_strfreev (list);
+	g_free (bitrates);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/*
+ * GStreamer dreamsource adaptive bitrate controller
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstdreamabr.h"
+
+void
+gst_dreamsource_abr_init (AbrController *abr, guint min_bitrate, guint max_bitrate)
+{
+	abr->min_bitrate = min_bitrate;
+	abr->max_bitrate = MAX (min_bitrate, max_bitrate);
+	g_atomic_int_set (&abr->qos, 0);
+	abr->fill = 0;
+	abr->last_change = g_get_monotonic_time ();
+	abr->calm_since = -1;
+}
+
+void
+gst_dreamsource_abr_set_estimate (AbrController *abr, guint estimate)
+{
+	g_atomic_int_set (&abr->estimate, estimate);
+}
+
+/* keeps the worst proportion reported until the next update */
+void
+gst_dreamsource_abr_add_qos (AbrController *abr, gdouble proportion)
+{
+	gint qos = CLAMP (proportion * 1000, 1, G_MAXINT / 2);
+	gint old;
+
+	do {
+		old = g_atomic_int_get (&abr->qos);
+		if (old >= qos)
+			return;
+	} while (!g_atomic_int_compare_and_exchange (&abr->qos, old, qos));
+}
+
+/* called by the read loop after each encoder read with the bitrate currently
+ * configured, returns the bitrate to switch to or 0 to keep it */
+guint
+gst_dreamsource_abr_update (AbrController *abr, guint bitrate, guint queued, guint limit, gint64 now)
+{
+	gint qos = g_atomic_int_get (&abr->qos);
+	guint estimate = g_atomic_int_get (&abr->estimate) * ABR_ESTIMATE_SHARE / 100;
+	guint target;
+
+	if (qos)
+		g_atomic_int_compare_and_exchange (&abr->qos, qos, 0);
+	if (limit)
+		abr->fill += ((gdouble) MIN (queued, limit) / limit - abr->fill) / 4;
+
+	if (abr->fill > ABR_FILL_HIGH || qos > ABR_QOS_LATE || (estimate && bitrate > estimate))
+	{
+		abr->calm_since = -1;
+		if (now - abr->last_change < ABR_DOWN_HOLD)
+			return 0;
+		target = bitrate * 3 / 4;
+		if (estimate && target > estimate)
+			target = estimate;
+	}
+	else if (abr->fill < ABR_FILL_LOW && qos <= 1000)
+	{
+		if (abr->calm_since < 0)
+			abr->calm_since = now;
+		if (now - abr->calm_since < ABR_UP_HOLD || now - abr->last_change < ABR_UP_HOLD)
+			return 0;
+		target = bitrate + MAX (bitrate / 10, 1);
+		if (estimate && target > estimate)
+			target = MAX (bitrate, estimate);
+	}
+	else
+	{
+		/* between the watermarks: hold, but don't count it as calm */
+		abr->calm_since = -1;
+		return 0;
+	}
+
+	target = CLAMP (target, abr->min_bitrate, abr->max_bitrate);
+	if (target == bitrate)
+		return 0;
+	abr->last_change = now;
+	abr->calm_since = -1;
+	return target;
+}
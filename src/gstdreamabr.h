@@ -0,0 +1,61 @@
+/*
+ * GStreamer dreamsource adaptive bitrate controller
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMABR_H__
+#define __GST_DREAMABR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _AbrController AbrController;
+
+/* smoothed queue fill above which the bitrate is lowered, and below which
+ * it may be raised again */
+#define ABR_FILL_HIGH       0.5
+#define ABR_FILL_LOW        0.15
+/* downstream QoS proportion (in 1/1000) that counts as late */
+#define ABR_QOS_LATE        1100
+/* minimum time between two steps down, and the calm period before a step up */
+#define ABR_DOWN_HOLD       (1 * G_USEC_PER_SEC)
+#define ABR_UP_HOLD         (5 * G_USEC_PER_SEC)
+/* throughput estimates are only used up to this share, in percent */
+#define ABR_ESTIMATE_SHARE  90
+
+/* multiplicative decrease, additive increase: a congested link is backed off
+ * within a second, the way back up takes a sustained calm period per 10% step.
+ * qos and estimate are set from other threads, everything else belongs to the
+ * read loop */
+struct _AbrController {
+	guint min_bitrate;         /* kbit/s */
+	guint max_bitrate;         /* kbit/s */
+	gint estimate;             /* application's throughput estimate in kbit/s, 0 for none */
+	gint qos;                  /* worst QoS proportion since the last update in 1/1000, 0 for none */
+	gdouble fill;              /* smoothed queue fill, 0..1 */
+	gint64 last_change;        /* monotonic time of the last step */
+	gint64 calm_since;         /* start of the current calm period, -1 if none */
+};
+
+void gst_dreamsource_abr_init (AbrController *abr, guint min_bitrate, guint max_bitrate);
+void gst_dreamsource_abr_set_estimate (AbrController *abr, guint estimate);
+void gst_dreamsource_abr_add_qos (AbrController *abr, gdouble proportion);
+guint gst_dreamsource_abr_update (AbrController *abr, guint bitrate, guint queued, guint limit, gint64 now);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMABR_H__ */
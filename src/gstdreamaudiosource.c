@@ -46,6 +46,9 @@ GType gst_dreamaudiosource_input_mode_get_type (void)
 enum
 {
 	SIGNAL_GET_DTS_OFFSET,
+	SIGNAL_GET_GOP_CACHE,
+	SIGNAL_TIMESHIFT_SEEK,
+	SIGNAL_TIMESHIFT_READ,
 	SIGNAL_LOST,
 	LAST_SIGNAL
 };
@@ -53,7 +56,16 @@ enum
 {
 	ARG_0,
 	ARG_BITRATE,
-	ARG_INPUT_MODE
+	ARG_INPUT_MODE,
+	ARG_BATCH,
+	ARG_STATS,
+	ARG_CLOCK_MODE,
+	ARG_DEVICE_INDEX,
+	ARG_SHARED_REACTOR,
+	ARG_GOP_CACHE_SIZE,
+	ARG_TIMESHIFT_LOCATION,
+	ARG_TIMESHIFT_SIZE,
+	ARG_TIMESHIFT_WINDOW
 };
 
 static guint gst_dreamaudiosource_signals[LAST_SIGNAL] = { 0 };
@@ -62,6 +74,14 @@ static guint gst_dreamaudiosource_signals[LAST_SIGNAL] = { 0 };
 #define DEFAULT_SAMPLERATE  48000
 #define DEFAULT_INPUT_MODE  GST_DREAMAUDIOSOURCE_INPUT_MODE_LIVE
 #define DEFAULT_BUFFER_SIZE 26
+#define DEFAULT_BATCH       FALSE
+#define DEFAULT_CLOCK_MODE  GST_DREAMSOURCE_CLOCK_MODE_DIRECT
+#define DEFAULT_DEVICE_INDEX GST_DREAMSOURCE_DEVICE_INDEX_AUTO
+#define DEFAULT_SHARED_REACTOR FALSE
+#define DEFAULT_GOP_CACHE_SIZE 0
+#define DEFAULT_TIMESHIFT_LOCATION NULL
+#define DEFAULT_TIMESHIFT_SIZE (G_GUINT64_CONSTANT (512) * 1024 * 1024)
+#define DEFAULT_TIMESHIFT_READ_FRAMES 64
 
 static GstStaticPadTemplate srctemplate =
     GST_STATIC_PAD_TEMPLATE ("src",
@@ -89,9 +109,13 @@ static void gst_dreamaudiosource_get_property (GObject * object, guint prop_id,
 
 static GstStateChangeReturn gst_dreamaudiosource_change_state (GstElement * element, GstStateChange transition);
 static gint64 gst_dreamaudiosource_get_dts_offset (GstDreamAudioSource *self);
+static GstBufferList *gst_dreamaudiosource_get_gop_cache (GstDreamAudioSource *self, guint64 since);
+static guint64 gst_dreamaudiosource_timeshift_seek (GstDreamAudioSource *self, guint64 time);
+static GstBufferList *gst_dreamaudiosource_timeshift_read (GstDreamAudioSource *self, guint64 sequence, guint max_frames);
 
 static gboolean gst_dreamaudiosource_encoder_init (GstDreamAudioSource * self);
 static void gst_dreamaudiosource_encoder_release (GstDreamAudioSource * self);
+static gboolean gst_dreamaudiosource_defer (GstDreamAudioSource * self, DreamSourceCommandType type, guint32 value);
 
 static void gst_dreamaudiosource_read_thread_func (GstDreamAudioSource * self);
 
@@ -152,6 +176,56 @@ gst_dreamaudiosource_class_init (GstDreamAudioSourceClass * klass)
 	    GST_TYPE_DREAMAUDIOSOURCE_INPUT_MODE, DEFAULT_INPUT_MODE,
 	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+	g_object_class_install_property (gobject_class, ARG_BATCH,
+	  g_param_spec_boolean ("batch", "Batch descriptors",
+	    "Turn all descriptors of one encoder read into buffers before waking up the streaming thread",
+	    DEFAULT_BATCH, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_STATS,
+	  g_param_spec_boxed ("stats", "Statistics",
+	    "Read path counters, read-to-push latency percentiles and the encoder's capture-to-read latency since the last READY to PAUSED transition",
+	    GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_CLOCK_MODE,
+	  g_param_spec_enum ("clock-mode", "Clock mode",
+	    "Read the encoder STC on every clock query or interpolate between periodic reads",
+	    GST_TYPE_DREAMSOURCE_CLOCK_MODE, DEFAULT_CLOCK_MODE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_DEVICE_INDEX,
+	  g_param_spec_int ("device-index", "Device index",
+	    "Encoder device to use, -1 picks the one paired with the video source of this pipeline or the first free one (takes effect in NULL state)",
+	    GST_DREAMSOURCE_DEVICE_INDEX_AUTO, GST_DREAMSOURCE_MAX_DEVICES - 1, DEFAULT_DEVICE_INDEX,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_SHARED_REACTOR,
+	  g_param_spec_boolean ("shared-reactor", "Shared reactor",
+	    "Read from the encoder on the one epoll thread shared by all dreamsource elements instead of a thread of its own (takes effect in READY state)",
+	    DEFAULT_SHARED_REACTOR, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_GOP_CACHE_SIZE,
+	  g_param_spec_uint ("gop-cache-size", "GOP cache size",
+	    "Bytes of audio kept for consumers attaching later, see get-gop-cache, 0 disables it (takes effect in READY state)",
+	    0, G_MAXINT, DEFAULT_GOP_CACHE_SIZE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_TIMESHIFT_LOCATION,
+	  g_param_spec_string ("timeshift-location", "Time-shift location",
+	    "File the encoded stream is also written to as a ring for seeking back with timeshift-seek and timeshift-read, NULL disables it (takes effect in READY state)",
+	    DEFAULT_TIMESHIFT_LOCATION,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_TIMESHIFT_SIZE,
+	  g_param_spec_uint64 ("timeshift-size", "Time-shift size",
+	    "Bytes preallocated for timeshift-location, the oldest frames are overwritten once it is full (takes effect in READY state)",
+	    1024 * 1024, G_MAXUINT64, DEFAULT_TIMESHIFT_SIZE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_TIMESHIFT_WINDOW,
+	  g_param_spec_boxed ("timeshift-window", "Time-shift window",
+	    "Time and sequence range currently held in timeshift-location",
+	    GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
 	gst_dreamaudiosource_signals[SIGNAL_GET_DTS_OFFSET] =
 		g_signal_new ("get-dts-offset",
 		G_TYPE_FROM_CLASS (klass),
@@ -159,6 +233,27 @@ gst_dreamaudiosource_class_init (GstDreamAudioSourceClass * klass)
 		G_STRUCT_OFFSET (GstDreamAudioSourceClass, get_dts_offset),
 		NULL, NULL, gst_dreamsource_marshal_INT64__VOID, G_TYPE_INT64, 0);
 
+	gst_dreamaudiosource_signals[SIGNAL_GET_GOP_CACHE] =
+		g_signal_new ("get-gop-cache",
+		G_TYPE_FROM_CLASS (klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET (GstDreamAudioSourceClass, get_gop_cache),
+		NULL, NULL, gst_dreamsource_marshal_BOXED__UINT64, GST_TYPE_BUFFER_LIST, 1, G_TYPE_UINT64);
+
+	gst_dreamaudiosource_signals[SIGNAL_TIMESHIFT_SEEK] =
+		g_signal_new ("timeshift-seek",
+		G_TYPE_FROM_CLASS (klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET (GstDreamAudioSourceClass, timeshift_seek),
+		NULL, NULL, gst_dreamsource_marshal_UINT64__UINT64, G_TYPE_UINT64, 1, G_TYPE_UINT64);
+
+	gst_dreamaudiosource_signals[SIGNAL_TIMESHIFT_READ] =
+		g_signal_new ("timeshift-read",
+		G_TYPE_FROM_CLASS (klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET (GstDreamAudioSourceClass, timeshift_read),
+		NULL, NULL, gst_dreamsource_marshal_BOXED__UINT64_UINT, GST_TYPE_BUFFER_LIST, 2, G_TYPE_UINT64, G_TYPE_UINT);
+
 	gst_dreamaudiosource_signals[SIGNAL_LOST] =
 		g_signal_new("signal-lost", G_TYPE_FROM_CLASS(klass),
 			G_SIGNAL_RUN_LAST, G_STRUCT_OFFSET(GstDreamAudioSourceClass, signal_lost),
@@ -166,6 +261,9 @@ gst_dreamaudiosource_class_init (GstDreamAudioSourceClass * klass)
 			G_TYPE_NONE, 0);
 
 	klass->get_dts_offset = gst_dreamaudiosource_get_dts_offset;
+	klass->get_gop_cache = gst_dreamaudiosource_get_gop_cache;
+	klass->timeshift_seek = gst_dreamaudiosource_timeshift_seek;
+	klass->timeshift_read = gst_dreamaudiosource_timeshift_read;
 }
 
 static gint64
@@ -175,6 +273,91 @@ gst_dreamaudiosource_get_dts_offset (GstDreamAudioSource *self)
 	return self->dts_offset;
 }
 
+static GstBufferList *
+gst_dreamaudiosource_get_gop_cache (GstDreamAudioSource *self, guint64 since)
+{
+	GstBufferList *list = gst_dreamsource_gop_cache_get (&self->gop_cache, since);
+	GST_DEBUG_OBJECT (self, "gst_dreamaudiosource_get_gop_cache since %" GST_TIME_FORMAT ": %u buffers", GST_TIME_ARGS (since), gst_buffer_list_length (list));
+	return list;
+}
+
+/* the time-shift file outlives the read loop only as long as a caller
+ * still holds on to it */
+static Timeshift *
+gst_dreamaudiosource_get_timeshift (GstDreamAudioSource *self)
+{
+	Timeshift *ts = NULL;
+
+	GST_OBJECT_LOCK (self);
+	if (self->timeshift)
+		ts = gst_dreamsource_timeshift_ref (self->timeshift);
+	GST_OBJECT_UNLOCK (self);
+	return ts;
+}
+
+static guint64
+gst_dreamaudiosource_timeshift_seek (GstDreamAudioSource *self, guint64 time)
+{
+	Timeshift *ts = gst_dreamaudiosource_get_timeshift (self);
+	guint64 sequence = TIMESHIFT_SEQUENCE_NONE;
+
+	if (ts)
+	{
+		sequence = gst_dreamsource_timeshift_seek (ts, time);
+		gst_dreamsource_timeshift_unref (ts);
+	}
+	GST_DEBUG_OBJECT (self, "gst_dreamaudiosource_timeshift_seek %" GST_TIME_FORMAT ": sequence %" G_GUINT64_FORMAT, GST_TIME_ARGS (time), sequence);
+	return sequence;
+}
+
+static GstBufferList *
+gst_dreamaudiosource_timeshift_read (GstDreamAudioSource *self, guint64 sequence, guint max_frames)
+{
+	Timeshift *ts = gst_dreamaudiosource_get_timeshift (self);
+	GstBufferList *list;
+
+	if (!ts)
+		return gst_buffer_list_new ();
+	list = gst_dreamsource_timeshift_read (ts, sequence, max_frames ? max_frames : DEFAULT_TIMESHIFT_READ_FRAMES);
+	gst_dreamsource_timeshift_unref (ts);
+	GST_DEBUG_OBJECT (self, "gst_dreamaudiosource_timeshift_read from %" G_GUINT64_FORMAT ": %u buffers", sequence, gst_buffer_list_length (list));
+	return list;
+}
+
+static void
+gst_dreamaudiosource_timeshift_start (GstDreamAudioSource *self, guint max_queued, gboolean copy)
+{
+	Timeshift *ts;
+
+	if (!self->timeshift_location)
+		return;
+	ts = gst_dreamsource_timeshift_new (self->timeshift_location, self->timeshift_size, max_queued, copy);
+	if (!ts)
+	{
+		GST_ELEMENT_WARNING (self, RESOURCE, OPEN_WRITE, ("Can't set up time-shift file %s", self->timeshift_location), ("%s", strerror (errno)));
+		return;
+	}
+	GST_OBJECT_LOCK (self);
+	self->timeshift = ts;
+	GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_dreamaudiosource_timeshift_stop (GstDreamAudioSource *self)
+{
+	Timeshift *ts;
+
+	GST_OBJECT_LOCK (self);
+	ts = self->timeshift;
+	self->timeshift = NULL;
+	GST_OBJECT_UNLOCK (self);
+	if (ts)
+	{
+		gst_dreamsource_timeshift_stop (ts);
+		gst_dreamsource_timeshift_unref (ts);
+	}
+}
+
 static void _gst_dreamaudiosource_emit_signal_lost (GstDreamAudioSource *self)
 {
 	if (!GST_IS_DREAMAUDIOSOURCE (self))
@@ -194,7 +377,7 @@ static void gst_dreamaudiosource_set_bitrate (GstDreamAudioSource * self, uint32
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, AENC_SET_BITRATE, &abr);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, AENC_SET_BITRATE, &abr);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set audio bitrate to %i bytes/s!", abr);
@@ -224,7 +407,7 @@ void gst_dreamaudiosource_set_input_mode (GstDreamAudioSource *self, GstDreamAud
 		goto out;
 	}
 	int int_mode = mode;
-	int ret = ioctl(self->encoder->fd, AENC_SET_SOURCE, &int_mode);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, AENC_SET_SOURCE, &int_mode);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set input mode to %s (%i) error: %s", value_nick, mode, strerror(errno));
@@ -262,13 +445,26 @@ gst_dreamaudiosource_init (GstDreamAudioSource * self)
 	self->input_mode = DEFAULT_INPUT_MODE;
 
 	self->buffer_size = DEFAULT_BUFFER_SIZE;
-	g_queue_init (&self->current_frames);
+	self->batch = DEFAULT_BATCH;
+	self->clock_mode = DEFAULT_CLOCK_MODE;
+	self->device_index = DEFAULT_DEVICE_INDEX;
+	self->shared_reactor = DEFAULT_SHARED_REACTOR;
+	self->gop_cache_size = DEFAULT_GOP_CACHE_SIZE;
+	self->sync = NULL;
+	self->timeshift_location = NULL;
+	self->timeshift_size = DEFAULT_TIMESHIFT_SIZE;
+	self->timeshift = NULL;
+	gst_dreamsource_gop_cache_init (&self->gop_cache, TRUE);
+	self->reactor = NULL;
+	self->reactor_source = NULL;
+	gst_dreamsource_stats_reset (&self->stats);
+	gst_dreamsource_latency_reset (&self->latency);
+	gst_dreamsource_timestamp_init (&self->pts_unit, MPEG_TIMESTAMP_BITS, MPEG_TIMESTAMP_RATE);
+	self->frames = gst_dreamsource_frame_queue_new (self->buffer_size);
 	self->readthread = NULL;
 
 	g_mutex_init (&self->mutex);
-	g_cond_init (&self->cond);
-	READ_SOCKET (self) = -1;
-	WRITE_SOCKET (self) = -1;
+	self->commands = gst_dreamsource_command_queue_new ();
 
 	gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
 	gst_base_src_set_live (GST_BASE_SRC (self), TRUE);
@@ -283,86 +479,74 @@ gst_dreamaudiosource_init (GstDreamAudioSource * self)
 #endif
 }
 
+/* called by the tracker when downstream freed enough buffers */
+static void gst_dreamaudiosource_wakeup (GstDreamAudioSource * self)
+{
+	gst_dreamsource_command_queue_push (self->commands, COMMAND_WAKEUP, 0);
+}
+
 static gboolean gst_dreamaudiosource_encoder_init (GstDreamAudioSource * self)
 {
 	GST_LOG_OBJECT (self, "initializating encoder...");
-	self->encoder = malloc(sizeof(EncoderInfo));
-
+	self->encoder = gst_dreamsource_device_acquire (ENCODER_KIND_AUDIO, self->device_index, GST_ELEMENT (self));
 	if (!self->encoder) {
-		GST_ERROR_OBJECT (self,"out of space");
-		return FALSE;
-	}
-
-	char fn_buf[32];
-	sprintf(fn_buf, "/dev/aenc%d", 0);
-	self->encoder->fd = open(fn_buf, O_RDWR | O_SYNC);
-	if (self->encoder->fd <= 0) {
-		GST_ERROR_OBJECT (self,"cannot open device %s (%s)", fn_buf, strerror(errno));
-		free(self->encoder);
-		self->encoder = NULL;
+		GST_ERROR_OBJECT (self,"cannot acquire audio encoder %i (%s)", self->device_index, strerror(errno));
 		return FALSE;
 	}
 
+	self->encoder->tracker = NULL;
 	self->encoder->buffer = malloc(ABUFSIZE);
 	if (!self->encoder->buffer) {
 		GST_ERROR_OBJECT(self,"cannot alloc buffer");
 		return FALSE;
 	}
 
-	self->encoder->cdb = (unsigned char *)mmap (0, AMMAPSIZE, PROT_READ, MAP_PRIVATE, self->encoder->fd, 0);
-
-	if (!self->encoder->cdb || self->encoder->cdb == MAP_FAILED) {
+	if (!gst_dreamsource_encoder_mmap (self->encoder, AMMAPSIZE)) {
 		GST_ERROR_OBJECT(self, "cannot alloc buffer: %s (%i)", strerror(errno), errno);
-		self->encoder->cdb = NULL;
 		return FALSE;
 	}
 
-	int control_sock[2];
-	if (socketpair (PF_UNIX, SOCK_STREAM, 0, control_sock) < 0)
-	{
-		GST_ERROR_OBJECT(self, "cannot create control sockets: %s (%i)", strerror(errno), errno);
-		return FALSE;
-	}
-	READ_SOCKET (self) = control_sock[0];
-	WRITE_SOCKET (self) = control_sock[1];
-	fcntl (READ_SOCKET (self), F_SETFL, O_NONBLOCK);
-	fcntl (WRITE_SOCKET (self), F_SETFL, O_NONBLOCK);
-
-	self->memtrack_list = NULL;
-	self->encoder->used_range_min = UINT32_MAX;
-	self->encoder->used_range_max = 0;
+	/* descriptors are given back to the driver right away, the tracker only
+	 * keeps the window of the ring that is still referenced downstream */
+	self->encoder->tracker = gst_dreamsource_tracker_new (ATRACKSLOTS, AMMAPSIZE, NULL);
+	gst_dreamsource_tracker_set_notify (self->encoder->tracker, ATRACKSLOTS, (DescriptorTrackerNotify) gst_dreamaudiosource_wakeup, self);
 
 	self->audio_info.samplerate = DEFAULT_SAMPLERATE;
 	gst_dreamaudiosource_set_bitrate (self, self->audio_info.bitrate);
 	gst_dreamaudiosource_set_input_mode (self, self->input_mode);
 
 #ifdef PROVIDE_CLOCK
-	self->encoder_clock = gst_dreamsource_clock_new ("GstDreamAudioSourceClock", self->encoder->fd);
+	self->encoder_clock = gst_dreamsource_clock_new ("GstDreamAudioSourceClock", self->encoder);
+	g_object_set (self->encoder_clock, "mode", self->clock_mode, NULL);
 	GST_DEBUG_OBJECT (self, "self->encoder_clock = %" GST_PTR_FORMAT, self->encoder_clock);
 	GST_OBJECT_FLAG_SET (self, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
 #endif
 
-	GST_LOG_OBJECT (self, "encoder %s successfully initialized", fn_buf);
+	GST_LOG_OBJECT (self, "encoder /dev/aenc%i successfully initialized", self->encoder->device_index);
 	return TRUE;
 }
 
 static void gst_dreamaudiosource_encoder_release (GstDreamAudioSource * self)
 {
 	GST_LOG_OBJECT (self, "releasing encoder...");
+	if (self->sync) {
+		gst_dreamsource_sync_leave (self->sync, ENCODER_KIND_AUDIO);
+		gst_dreamsource_sync_unref (self->sync);
+		self->sync = NULL;
+	}
 	if (self->encoder) {
+		if (self->encoder->tracker)
+		{
+			gst_dreamsource_tracker_detach (self->encoder->tracker);
+			gst_dreamsource_tracker_unref (self->encoder->tracker);
+		}
 		if (self->encoder->buffer)
 			free(self->encoder->buffer);
-		if (self->encoder->cdb)
-			munmap(self->encoder->cdb, AMMAPSIZE);
-		if (self->encoder->fd)
-			close(self->encoder->fd);
-		free(self->encoder);
+		if (self->encoder_clock)
+			gst_dreamsource_clock_detach (self->encoder_clock, self->encoder);
+		gst_dreamsource_device_release (self->encoder);
 	}
 	self->encoder = NULL;
-	close (READ_SOCKET (self));
-	close (WRITE_SOCKET (self));
-	READ_SOCKET (self) = -1;
-	WRITE_SOCKET (self) = -1;
 	if (self->encoder_clock) {
 		gst_object_unref (self->encoder_clock);
 		self->encoder_clock = NULL;
@@ -376,10 +560,38 @@ gst_dreamaudiosource_set_property (GObject * object, guint prop_id, const GValue
 
 	switch (prop_id) {
 		case ARG_BITRATE:
-			gst_dreamaudiosource_set_bitrate(self, g_value_get_int (value));
+			if (!gst_dreamaudiosource_defer (self, COMMAND_SET_BITRATE, g_value_get_int (value)))
+				gst_dreamaudiosource_set_bitrate (self, g_value_get_int (value));
 			break;
 		case ARG_INPUT_MODE:
-			     gst_dreamaudiosource_set_input_mode (self, g_value_get_enum (value));
+			if (gst_dreamaudiosource_defer (self, COMMAND_SET_INPUT_MODE, g_value_get_enum (value)))
+				gst_dreamaudiosource_defer (self, COMMAND_FLUSH, 0);
+			else
+				gst_dreamaudiosource_set_input_mode (self, g_value_get_enum (value));
+			break;
+		case ARG_BATCH:
+			self->batch = g_value_get_boolean (value);
+			break;
+		case ARG_CLOCK_MODE:
+			self->clock_mode = g_value_get_enum (value);
+			if (self->encoder_clock)
+				g_object_set (self->encoder_clock, "mode", self->clock_mode, NULL);
+			break;
+		case ARG_DEVICE_INDEX:
+			self->device_index = g_value_get_int (value);
+			break;
+		case ARG_SHARED_REACTOR:
+			self->shared_reactor = g_value_get_boolean (value);
+			break;
+		case ARG_GOP_CACHE_SIZE:
+			self->gop_cache_size = g_value_get_uint (value);
+			break;
+		case ARG_TIMESHIFT_LOCATION:
+			g_free (self->timeshift_location);
+			self->timeshift_location = g_value_dup_string (value);
+			break;
+		case ARG_TIMESHIFT_SIZE:
+			self->timeshift_size = g_value_get_uint64 (value);
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -399,6 +611,50 @@ gst_dreamaudiosource_get_property (GObject * object, guint prop_id, GValue * val
 		case ARG_INPUT_MODE:
 			g_value_set_enum (value, gst_dreamaudiosource_get_input_mode (self));
 			break;
+		case ARG_BATCH:
+			g_value_set_boolean (value, self->batch);
+			break;
+		case ARG_STATS:
+		{
+			GstStructure *stats = gst_dreamsource_stats_to_structure (&self->stats, "GstDreamAudioSourceStats");
+			gst_dreamsource_clock_add_stats (self->encoder_clock, stats);
+			g_mutex_lock (&self->mutex);
+			gst_structure_set (stats, "encoder-latency", G_TYPE_UINT64, self->latency.measured,
+				"encoder-latency-updates", G_TYPE_UINT64, self->latency.updates, NULL);
+			g_mutex_unlock (&self->mutex);
+			g_value_take_boxed (value, stats);
+			break;
+		}
+		case ARG_CLOCK_MODE:
+			g_value_set_enum (value, self->clock_mode);
+			break;
+		case ARG_DEVICE_INDEX:
+			g_value_set_int (value, self->device_index);
+			break;
+		case ARG_SHARED_REACTOR:
+			g_value_set_boolean (value, self->shared_reactor);
+			break;
+		case ARG_GOP_CACHE_SIZE:
+			g_value_set_uint (value, self->gop_cache_size);
+			break;
+		case ARG_TIMESHIFT_LOCATION:
+			g_value_set_string (value, self->timeshift_location);
+			break;
+		case ARG_TIMESHIFT_SIZE:
+			g_value_set_uint64 (value, self->timeshift_size);
+			break;
+		case ARG_TIMESHIFT_WINDOW:
+		{
+			Timeshift *ts = gst_dreamaudiosource_get_timeshift (self);
+			if (ts)
+			{
+				g_value_take_boxed (value, gst_dreamsource_timeshift_get_window (ts));
+				gst_dreamsource_timeshift_unref (ts);
+			}
+			else
+				g_value_set_boxed (value, NULL);
+			break;
+		}
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -437,11 +693,15 @@ static gboolean gst_dreamaudiosource_query (GstBaseSrc * bsrc, GstQuery * query)
 			if (self->audio_info.samplerate) {
 				GstClockTime min, max;
 
+				GstClockTime frame;
+
 				g_mutex_lock (&self->mutex);
-				min = gst_util_uint64_scale_ceil (GST_SECOND, 1000, self->audio_info.samplerate);
+				frame = gst_util_uint64_scale_ceil (GST_SECOND, 1000, self->audio_info.samplerate);
+				/* what the encoder measurably takes, never less than a frame */
+				min = self->latency.measured != GST_CLOCK_TIME_NONE ? MAX (self->latency.measured, frame) : frame;
 				g_mutex_unlock (&self->mutex);
 
-				max = self->buffer_size * min;
+				max = min + self->buffer_size * frame;
 
 				gst_query_set_latency (query, TRUE, min, max);
 				GST_DEBUG_OBJECT (bsrc, "set LATENCY QUERY %" GST_PTR_FORMAT, query);
@@ -462,11 +722,8 @@ static gboolean gst_dreamaudiosource_unlock (GstBaseSrc * bsrc)
 {
 	GstDreamAudioSource *self = GST_DREAMAUDIOSOURCE (bsrc);
 	GST_DEBUG_OBJECT (self, "stop creating buffers");
-	g_mutex_lock (&self->mutex);
-	self->flushing = TRUE;
+	gst_dreamsource_frame_queue_set_flushing (self->frames, TRUE);
 	GST_DEBUG_OBJECT (self, "set flushing TRUE");
-	g_cond_signal (&self->cond);
-	g_mutex_unlock (&self->mutex);
 	return TRUE;
 }
 
@@ -474,431 +731,440 @@ static gboolean gst_dreamaudiosource_unlock_stop (GstBaseSrc * bsrc)
 {
 	GstDreamAudioSource *self = GST_DREAMAUDIOSOURCE (bsrc);
 	GST_DEBUG_OBJECT (self, "stop flushing...");
-	g_mutex_lock (&self->mutex);
-	self->flushing = FALSE;
-	g_queue_foreach (&self->current_frames, (GFunc) gst_buffer_unref, NULL);
-	g_queue_clear (&self->current_frames);
-	g_mutex_unlock (&self->mutex);
+	/* still flushing while it's emptied, the read loop doesn't queue anything then */
+	gst_dreamsource_frame_queue_clear (self->frames);
+	gst_dreamsource_frame_queue_set_flushing (self->frames, FALSE);
 	return TRUE;
 }
 
-static void gst_dreamaudiosource_free_buffer (struct _buffer_memorytracker * memtrack)
+/* queues readbuf, the streaming thread only sees it after the next
+ * gst_dreamsource_frame_queue_publish () */
+static void gst_dreamaudiosource_enqueue (GstDreamAudioSource * self, GstBuffer * readbuf, gboolean * discont)
 {
-	GstDreamAudioSource * self = memtrack->self;
-	GST_OBJECT_LOCK(self);
-	GST_TRACE_OBJECT (self, "freeing %" GST_PTR_FORMAT " uiOffset=%i uiLength=%i ", memtrack->buffer, memtrack->uiOffset, memtrack->uiLength);
-	GList *list = g_list_first (self->memtrack_list);
-	guint abs_minimum = UINT32_MAX;
-	guint abs_maximum = 0;
-	struct _buffer_memorytracker * mt;
-	int count = 0;
-	self->memtrack_list = g_list_remove(list, memtrack);
-	free(memtrack);
-	if (self->encoder)
+	if (!gst_dreamsource_frame_queue_is_flushing (self->frames))
 	{
-		list = g_list_first (self->memtrack_list);
-		while (list) {
-			mt = list->data;
-			if (abs_minimum > 0 && mt->uiOffset < abs_minimum)
-				abs_minimum = mt->uiOffset;
-			if (mt->uiOffset+mt->uiLength > abs_maximum)
-				abs_maximum = mt->uiOffset+mt->uiLength;
-			count++;
-			list = g_list_next (list);
+		if (gst_buffer_get_size (readbuf) == 0)
+		{
+			/* empty buffers stand in for a read timeout */
+			GstClockTime duration = READTHREAD_TIMEOUT * GST_MSECOND;
+#if 1 // generate silence adts frames
+#define ADTS_HEADER_LEN       0x07
+#define AAC_PAYLOAD_LEN       0x06
+#define ADTS_DUMMY_FRAME_LEN  ADTS_HEADER_LEN + AAC_PAYLOAD_LEN
+			gst_buffer_unref(readbuf);
+			readbuf = gst_buffer_new_and_alloc (ADTS_DUMMY_FRAME_LEN);
+			GST_BUFFER_PTS (readbuf) = self->last_ts;
+			GST_BUFFER_DTS (readbuf) = self->last_ts;
+			GST_BUFFER_DURATION (readbuf) = duration;
+			GstMapInfo map;
+			gst_buffer_map (readbuf, &map, GST_MAP_WRITE);
+			guint8 *adts_header = map.data;
+			adts_header[0] = 0xff;
+			adts_header[1] = 0xf1;
+			adts_header[2] = 0x4c;
+			adts_header[3] = 0xb0;
+			adts_header[4] = 0x01;
+			adts_header[5] = 0xA0;
+			adts_header[6] = 0x00;
+			guint8 *payload = map.data+ADTS_HEADER_LEN;
+			payload[0] = 0x21;
+			payload[1] = 0x10;
+			payload[2] = 0x04;
+			payload[3] = 0x60;
+			payload[4] = 0x8c;
+			payload[5] = 0x1c;
+			gst_buffer_unmap (readbuf, &map);
+			GST_DEBUG_OBJECT (self, "Generated silence ADTS frame %" GST_PTR_FORMAT "" , readbuf);
+#else // produce gap events (mpegtsmux doesn't handle gap yet)
+			GstEvent *event = NULL;
+			event = gst_event_new_gap (self->last_ts, duration);
+			GST_DEBUG_OBJECT (self, "Sending %" GST_PTR_FORMAT" (from %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT ")" , event, GST_TIME_ARGS (self->last_ts), GST_TIME_ARGS (self->last_ts+duration));
+			gst_pad_push_event (GST_BASE_SRC_PAD (self), event);
+#endif
+			self->last_ts += duration;
 		}
-		GST_TRACE_OBJECT (self, "previous used_range_min=%i new abs_minimum=%i, abs_maximum=%i", self->encoder->used_range_min, abs_minimum, abs_maximum);
-		self->encoder->used_range_min = abs_minimum;
-		self->encoder->used_range_max = abs_maximum;
+		else
+			self->last_ts = GST_BUFFER_PTS(readbuf);
+		GstBuffer * oldbuf;
+		while (gst_dreamsource_frame_queue_is_full (self->frames) && (oldbuf = gst_dreamsource_frame_queue_drop_oldest (self->frames)))
+		{
+			GST_WARNING_OBJECT (self, "dropping %" GST_PTR_FORMAT " because of queue overflow! buffers count=%i", oldbuf, gst_dreamsource_frame_queue_get_length (self->frames));
+			self->stats.dropped++;
+			gst_buffer_unref(oldbuf);
+		}
+		if (*discont)
+		{
+			GST_BUFFER_FLAG_SET (readbuf, GST_BUFFER_FLAG_DISCONT);
+			*discont = FALSE;
+		}
+		self->stats.frames++;
+		self->stats.bytes += gst_buffer_get_size (readbuf);
+		if (self->gop_cache.limit)
+			gst_dreamsource_gop_cache_push (&self->gop_cache, readbuf);
+		if (self->timeshift)
+			gst_dreamsource_timeshift_push (self->timeshift, readbuf);
+		gst_dreamsource_frame_queue_stage (self->frames, readbuf);
+		GST_INFO_OBJECT (self, "read %" GST_PTR_FORMAT " to queue... buffers count=%i", readbuf, gst_dreamsource_frame_queue_get_length (self->frames));
+	}
+	else
+	{
+		GST_INFO_OBJECT (self, "dropping %" GST_PTR_FORMAT " because we're flushing", readbuf);
+		gst_buffer_unref(readbuf);
 	}
-	GST_OBJECT_UNLOCK(self);
 }
 
-static void gst_dreamaudiosource_read_thread_func (GstDreamAudioSource * self)
+/* tells the pipeline to query the latency again once the measured one
+ * moved away from what was reported */
+static void gst_dreamaudiosource_add_latency (GstDreamAudioSource * self, CompressedBufferDescriptor * desc)
 {
-	EncoderInfo *enc = self->encoder;
-	GstDreamSourceReadthreadState state = READTHREADSTATE_NONE;
-	GstBuffer *readbuf = NULL;
+	GstClockTime latency = gst_dreamsource_latency_add (&self->latency, gst_dreamsource_latency_measure (desc, self->read_stc));
 
-	if (!enc) {
-		GST_WARNING_OBJECT (self, "encoder device not opened!");
+	if (G_LIKELY (latency == GST_CLOCK_TIME_NONE))
 		return;
-	}
+	gst_dreamsource_stats_lock (&self->stats, &self->mutex);
+	self->latency.measured = latency;
+	g_mutex_unlock (&self->mutex);
+	GST_INFO_OBJECT (self, "measured encoder latency %" GST_TIME_FORMAT, GST_TIME_ARGS (latency));
+	gst_element_post_message (GST_ELEMENT (self), gst_message_new_latency (GST_OBJECT (self)));
+}
 
-	GST_DEBUG_OBJECT (self, "enter read thread");
+/* while the read loop runs, encoder settings are handed to it instead of
+ * calling into the driver from the application thread */
+static gboolean gst_dreamaudiosource_defer (GstDreamAudioSource * self, DreamSourceCommandType type, guint32 value)
+{
+	/* the queue refuses it once the loop stopped, the caller then applies it */
+	if (!g_atomic_int_get (&self->loop_running))
+		return FALSE;
+	return gst_dreamsource_command_queue_push (self->commands, type, value);
+}
 
-	GstMessage *message;
-	GValue val = { 0 };
+/* runs a deferred command on the read loop, or on the thread stopping it
+ * for the ones it didn't get to anymore */
+static void gst_dreamaudiosource_execute (GstDreamAudioSource * self, DreamSourceCommand * command)
+{
+	switch (command->type) {
+		case COMMAND_SET_BITRATE:
+			gst_dreamaudiosource_set_bitrate (self, command->value);
+			break;
+		case COMMAND_SET_INPUT_MODE:
+			gst_dreamaudiosource_set_input_mode (self, command->value);
+			break;
+		case COMMAND_FLUSH:
+			gst_dreamsource_gop_cache_flush (&self->gop_cache);
+			gst_dreamsource_frame_queue_clear (self->frames);
+			self->discont = TRUE;
+			break;
+		default:
+			break;
+	}
+}
 
-	message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_ENTER, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
-	g_value_init (&val, GST_TYPE_G_THREAD);
-	g_value_set_boxed (&val, self->readthread);
-	gst_message_set_stream_status_object (message, &val);
-	g_value_unset (&val);
-	GST_DEBUG_OBJECT (self, "posting ENTER stream status");
-	gst_element_post_message (GST_ELEMENT_CAST (self), message);
-	GstClockTime clock_time, base_time;
-	gboolean discont = TRUE;
-	int timeout;
+static void gst_dreamaudiosource_drain_commands (GstDreamAudioSource * self)
+{
+	DreamSourceCommand command;
+	while (gst_dreamsource_command_queue_pop (self->commands, &command))
+		gst_dreamaudiosource_execute (self, &command);
+}
 
-	while (TRUE) {
-		{
-			if (state == READTHREADSTATE_STOP)
-				goto stop_running;
-
-			struct pollfd rfd[2];
-			int nfds;
-
-			rfd[0].fd = READ_SOCKET (self);
-			rfd[0].events = POLLIN | POLLERR | POLLHUP | POLLPRI;
-			rfd[1].revents = 0;
-			rfd[1].events = POLLIN;
-			nfds = 1;
-			timeout = 0;
-
-			if (state <= READTRREADSTATE_PAUSED)
-				timeout = 200;
-			else if (state == READTRREADSTATE_RUNNING && self->descriptors_available == 0)
-			{
-				rfd[1].fd = enc->fd;
-				self->descriptors_count = 0;
-				timeout = 200;
-				nfds = 2;
-			}
+/* sets up the next wait of the read loop, returns the encoder fd to wait
+ * for or -1 and the timeout in ms */
+static int gst_dreamaudiosource_read_wait (GstDreamAudioSource * self, int *timeout)
+{
+	*timeout = 0;
+	if (self->read_state <= READTRREADSTATE_PAUSED)
+		*timeout = -1;
+	else if (self->read_state == READTRREADSTATE_RUNNING && self->descriptors_available == 0)
+	{
+		self->descriptors_count = 0;
+		*timeout = READTHREAD_TIMEOUT;
+		return self->encoder->fd;
+	}
+	else if (self->read_state == READTRREADSTATE_RUNNING && self->tracker_full)
+	{
+		/* woken by the tracker's notify once downstream freed some */
+		self->tracker_full = FALSE;
+		*timeout = READTHREAD_TIMEOUT;
+	}
+	return -1;
+}
 
-			int ret = poll(rfd, nfds, timeout);
+/* one iteration of the read loop, called from the read thread or from the
+ * shared reactor with the GST_DREAMSOURCE_REACTOR_* events that fired */
+static gboolean gst_dreamaudiosource_read_handle (GstDreamAudioSource * self, guint events, int *fd, int *timeout)
+{
+	EncoderInfo *enc = self->encoder;
+	GstClockTime clock_time = self->read_clock_time;
+	GstClockTime base_time = self->read_base_time;
+	GstBuffer *readbuf = NULL;
 
-			if (G_UNLIKELY (ret == -1))
-			{
-				GST_ERROR_OBJECT (self, "SELECT ERROR!");
-				goto stop_running;
-			}
-			else if ( ret == 0 && self->descriptors_available == 0 )
-			{
-				g_mutex_lock (&self->mutex);
-				gst_clock_get_internal_time(self->encoder_clock);
-				if (self->flushing)
-				{
-					GST_DEBUG_OBJECT (self, "FLUSHING!");
-					g_cond_signal (&self->cond);
-					g_mutex_unlock (&self->mutex);
-					continue;
-				}
-				g_mutex_unlock (&self->mutex);
-				GST_DEBUG_OBJECT (self, "SELECT TIMEOUT");
-				//!!! TODO generate valid dummy payload
-				discont = TRUE;
-				if (self->dts_offset != GST_CLOCK_TIME_NONE)
-					readbuf = gst_buffer_new();
-			}
-			else if ( rfd[0].revents )
-			{
-				char command;
-				READ_COMMAND (self, command, ret);
-				switch (command) {
-					case CONTROL_STOP:
-						GST_DEBUG_OBJECT (self, "CONTROL_STOP!");
-						state = READTHREADSTATE_STOP;
-						break;
-					case CONTROL_PAUSE:
-						GST_DEBUG_OBJECT (self, "CONTROL_PAUSE!");
-						state = READTRREADSTATE_PAUSED;
-						break;
-					case CONTROL_RUN:
-						GST_DEBUG_OBJECT (self, "CONTROL_RUN");
-						state = READTRREADSTATE_RUNNING;
-						break;
-					default:
-						GST_ERROR_OBJECT (self, "illegal control socket command %c received!", command);
-				}
-				continue;
-			}
-			else if ( G_LIKELY(rfd[1].revents & POLLIN) )
-			{
-				clock_time = gst_clock_get_internal_time (self->encoder_clock);
-				base_time = gst_element_get_base_time(GST_ELEMENT(self));
-				int rlen = read(enc->fd, enc->buffer, ABUFSIZE);
-				if (rlen <= 0 || rlen % ABDSIZE ) {
-					if ( errno == 512 )
-						goto stop_running;
-					GST_WARNING_OBJECT (self, "read error %s (%i)", strerror(errno), errno);
-					goto stop_running;
-				}
-				self->descriptors_available = rlen / ABDSIZE;
-				GST_LOG_OBJECT (self, "encoder buffer was empty, %d descriptors available", self->descriptors_available);
-			}
+	if ( events == 0 && self->descriptors_available == 0 )
+	{
+		gst_clock_get_internal_time(self->encoder_clock);
+		if (gst_dreamsource_frame_queue_is_flushing (self->frames))
+		{
+			GST_DEBUG_OBJECT (self, "FLUSHING!");
+			goto done;
 		}
-
-		while (self->descriptors_count < self->descriptors_available)
+		GST_DEBUG_OBJECT (self, "SELECT TIMEOUT");
+		//!!! TODO generate valid dummy payload
+		self->discont = TRUE;
+		if (self->dts_offset != GST_CLOCK_TIME_NONE)
+		{
+			readbuf = gst_buffer_new();
+			gst_dreamsource_frame_queue_set_read_time (self->frames, g_get_monotonic_time ());
+		}
+	}
+	else if ( events & GST_DREAMSOURCE_REACTOR_CONTROL )
+	{
+		DreamSourceCommand command;
+		while (self->read_state != READTHREADSTATE_STOP && gst_dreamsource_command_queue_pop (self->commands, &command))
 		{
-			GstClockTime encoder_pts = GST_CLOCK_TIME_NONE;
-			GstClockTime result_pts = GST_CLOCK_TIME_NONE;
+			switch (command.type) {
+				case COMMAND_STOP:
+					GST_DEBUG_OBJECT (self, "COMMAND_STOP!");
+					self->read_state = READTHREADSTATE_STOP;
+					break;
+				case COMMAND_PAUSE:
+					GST_DEBUG_OBJECT (self, "COMMAND_PAUSE!");
+					self->read_state = READTRREADSTATE_PAUSED;
+					break;
+				case COMMAND_RUN:
+					GST_DEBUG_OBJECT (self, "COMMAND_RUN");
+					self->read_state = READTRREADSTATE_RUNNING;
+					break;
+				default:
+					gst_dreamaudiosource_execute (self, &command);
+			}
+		}
+		goto done;
+	}
+	else if ( G_LIKELY(events & GST_DREAMSOURCE_REACTOR_ENCODER) )
+	{
+		clock_time = self->read_clock_time = gst_clock_get_internal_time (self->encoder_clock);
+		base_time = self->read_base_time = gst_element_get_base_time(GST_ELEMENT(self));
+		gst_dreamsource_calibration_update (&self->calibration, self->encoder_clock);
+		int rlen = gst_dreamsource_encoder_read (enc, enc->buffer, ABUFSIZE);
+		if (rlen <= 0 || rlen % ABDSIZE ) {
+			if ( errno == 512 )
+				return FALSE;
+			GST_WARNING_OBJECT (self, "read error %s (%i)", strerror(errno), errno);
+			return FALSE;
+		}
+		self->descriptors_available = rlen / ABDSIZE;
+		/* from the clock sample just taken, no extra STC read per read */
+		self->read_stc_valid = gst_dreamsource_clock_time_to_stc (self->encoder_clock, clock_time, &self->read_stc);
+		self->stats.descriptors += self->descriptors_available;
+		gst_dreamsource_frame_queue_set_read_time (self->frames, g_get_monotonic_time ());
+		GST_LOG_OBJECT (self, "encoder buffer was empty, %d descriptors available", self->descriptors_available);
+	}
 
-			off_t offset = self->descriptors_count * ABDSIZE;
-			AudioBufferDescriptor *desc = (AudioBufferDescriptor*)(&enc->buffer[offset]);
+	while (self->descriptors_count < self->descriptors_available)
+	{
+		GstClockTime encoder_pts = GST_CLOCK_TIME_NONE;
+		GstClockTime result_pts = GST_CLOCK_TIME_NONE;
 
-			uint32_t f = desc->stCommon.uiFlags;
+		off_t offset = self->descriptors_count * ABDSIZE;
+		AudioBufferDescriptor *desc = (AudioBufferDescriptor*)(&enc->buffer[offset]);
 
-			if (G_UNLIKELY (f & CDB_FLAG_METADATA))
-			{
-				GST_LOG_OBJECT (self, "CDB_FLAG_METADATA... skip outdated packet");
-				self->descriptors_count = self->descriptors_available;
-				continue;
-			}
+		uint32_t f = desc->stCommon.uiFlags;
 
-			GST_LOG_OBJECT (self, "descriptors_count=%d, descriptors_available=%d\tuiOffset=%d, uiLength=%d", self->descriptors_count, self->descriptors_available, desc->stCommon.uiOffset, desc->stCommon.uiLength);
+		/* an untracked buffer would escape the overlap check, wait for downstream */
+		if (G_UNLIKELY (!gst_dreamsource_tracker_get_free (enc->tracker)))
+		{
+			GST_LOG_OBJECT (self, "descriptor tracker is full, leaving %d descriptors in the encoder ring", self->descriptors_available - self->descriptors_count);
+			self->tracker_full = TRUE;
+			break;
+		}
 
-			if (self->encoder->used_range_min == UINT32_MAX)
-				self->encoder->used_range_min = desc->stCommon.uiOffset;
+		if (G_UNLIKELY (f & CDB_FLAG_METADATA))
+		{
+			GST_LOG_OBJECT (self, "CDB_FLAG_METADATA... skip outdated packet");
+			self->descriptors_count = self->descriptors_available;
+			continue;
+		}
 
-			if (self->encoder->used_range_max == 0)
-				self->encoder->used_range_max = desc->stCommon.uiOffset+desc->stCommon.uiLength;
+		GST_LOG_OBJECT (self, "descriptors_count=%d, descriptors_available=%d\tuiOffset=%d, uiLength=%d", self->descriptors_count, self->descriptors_available, desc->stCommon.uiOffset, desc->stCommon.uiLength);
 
-// 			if (desc->stCommon.uiOffset < self->encoder->used_range_max && desc->stCommon.uiOffset+desc->stCommon.uiLength > self->encoder->used_range_min)
-// 			{
-// 				GST_WARNING_OBJECT (self, "encoder overwrites buffer memory that is still in use! uiOffset=%i uiLength=%i used_range_min=%i used_range_max=%i", desc->stCommon.uiOffset, desc->stCommon.uiLength, self->encoder->used_range_min, self->encoder->used_range_max);
-// 				self->descriptors_count++;
-// 				readbuf = gst_buffer_new();
-// 				continue;
-// 			}
+		if (self->read_stc_valid)
+			gst_dreamaudiosource_add_latency (self, &desc->stCommon);
 
-			// uiDTS since kernel driver booted
-			if (f & CDB_FLAG_PTS_VALID)
-			{
-				encoder_pts = MPEGTIME_TO_GSTTIME(desc->stCommon.uiPTS);
-				GST_LOG_OBJECT (self, "f & CDB_FLAG_PTS_VALID && encoder's uiPTS=%" GST_TIME_FORMAT"", GST_TIME_ARGS(encoder_pts));
+		if (G_UNLIKELY (gst_dreamsource_tracker_overlaps (enc->tracker, desc->stCommon.uiOffset, desc->stCommon.uiLength)))
+		{
+			GST_WARNING_OBJECT (self, "encoder overwrites buffer memory that is still in use! uiOffset=%i uiLength=%i occupancy=%i", desc->stCommon.uiOffset, desc->stCommon.uiLength, gst_dreamsource_tracker_get_occupancy (enc->tracker));
+			self->descriptors_count++;
+			self->discont = TRUE;
+			continue;
+		}
 
-				g_mutex_lock (&self->mutex);
-				if (G_UNLIKELY (self->dts_offset == GST_CLOCK_TIME_NONE))
-				{
-#if 0 // set to 0 to always wait for audio to become valid, don't rely on video pts
-					if (self->dreamvideosrc)
-					{
-						guint64 videosource_dts_offset;
-						g_signal_emit_by_name(self->dreamvideosrc, "get-dts-offset", &videosource_dts_offset);
-						if (videosource_dts_offset != GST_CLOCK_TIME_NONE)
-						{
-							GST_DEBUG_OBJECT (self, "use DREAMVIDEOSOURCE's dts_offset=%" GST_TIME_FORMAT "", GST_TIME_ARGS (videosource_dts_offset) );
-							self->dts_offset = videosource_dts_offset;
-						}
-					}
-#endif
-					if (self->dts_offset == GST_CLOCK_TIME_NONE)
-					{
-						self->dts_offset = encoder_pts;
-						GST_DEBUG_OBJECT (self, "use mpeg stream pts as dts_offset=%" GST_TIME_FORMAT" (%lld)", GST_TIME_ARGS (self->dts_offset), desc->stCommon.uiPTS);
-					}
-				}
-				g_mutex_unlock (&self->mutex);
-			}
+		// uiDTS since kernel driver booted
+		if (f & CDB_FLAG_PTS_VALID)
+		{
+			encoder_pts = gst_dreamsource_timestamp_to_time (&self->pts_unit, gst_dreamsource_timestamp_unwrap (&self->pts_unit, desc->stCommon.uiPTS));
+			GST_LOG_OBJECT (self, "f & CDB_FLAG_PTS_VALID && encoder's uiPTS=%" GST_TIME_FORMAT"", GST_TIME_ARGS(encoder_pts));
 
+			/* dts_offset is only written by this thread, lock just for publishing it */
 			if (G_UNLIKELY (self->dts_offset == GST_CLOCK_TIME_NONE))
 			{
-				GST_DEBUG_OBJECT (self, "dts_offset is still unknown, skipping frame...");
-				self->descriptors_count++;
-				break;
-			}
-
-			if (encoder_pts != GST_CLOCK_TIME_NONE)
-			{
-				GstClockTime pts_clock_time = encoder_pts - self->dts_offset;
-				GstClockTime internal, external;
-				GstClockTime rate_n, rate_d;
-				GstClockTimeDiff diff;
-
-				gst_clock_get_calibration (self->encoder_clock, &internal, &external, &rate_n, &rate_d);
-
-				if (internal > pts_clock_time) {
-					diff = internal - pts_clock_time;
-					diff = gst_util_uint64_scale (diff, rate_n, rate_d);
-					pts_clock_time = external - diff;
-				} else {
-					diff = pts_clock_time - internal;
-					diff = gst_util_uint64_scale (diff, rate_n, rate_d);
-					pts_clock_time = external + diff;
-				}
-
-				if ( pts_clock_time >= base_time )
-					result_pts = pts_clock_time - base_time;
+				gst_dreamsource_stats_lock (&self->stats, &self->mutex);
+				/* the video source of the same slot waits for this one, unless it
+				 * kept running while this one restarted */
+				self->dts_offset = gst_dreamsource_sync_publish (self->sync, encoder_pts);
+				if (self->dts_offset == encoder_pts)
+					GST_DEBUG_OBJECT (self, "use mpeg stream pts as dts_offset=%" GST_TIME_FORMAT" (%lld)", GST_TIME_ARGS (self->dts_offset), desc->stCommon.uiPTS);
 				else
-					GST_DEBUG_OBJECT (self, "pts_clock_time < base_time, skipping frame...");
-
-#define extra_timestamp_debug
-#ifdef extra_timestamp_debug
-				GstClockTime my_int_time = gst_clock_get_internal_time(self->encoder_clock);
-				GstClockTime pipeline_int_time = GST_CLOCK_TIME_NONE;
-				GstClock *elemclk = gst_element_get_clock (GST_ELEMENT (self));
-				if (elemclk)
 				{
-					pipeline_int_time = gst_clock_get_internal_time(elemclk);
-					gst_object_unref (elemclk);
+					GST_DEBUG_OBJECT (self, "use synchronized dts_offset=%" GST_TIME_FORMAT "", GST_TIME_ARGS (self->dts_offset));
+					encoder_pts = gst_dreamsource_timestamp_align (&self->pts_unit, encoder_pts, &self->dts_offset);
 				}
-
-				GST_LOG_OBJECT (self, "post-calibration\n"
-				"  %" GST_TIME_FORMAT " =base_time       %" GST_TIME_FORMAT " =clock_time\n"
-				"  %" GST_TIME_FORMAT " =encoder_pts     %" GST_TIME_FORMAT " =pts_clock_time     %" GST_TIME_FORMAT " =result_pts\n"
-				"  %" GST_TIME_FORMAT " =internal        %" GST_TIME_FORMAT " =external           %" GST_TIME_FORMAT " =diff                %" PRId64 "/%" PRId64 " =rate\n"
-				"  %" GST_TIME_FORMAT " =my_int_time     %" GST_TIME_FORMAT " =pipeline_int_time"
-				,
-				GST_TIME_ARGS (base_time), GST_TIME_ARGS (clock_time),
-				GST_TIME_ARGS (encoder_pts), GST_TIME_ARGS (pts_clock_time), GST_TIME_ARGS (result_pts),
-				GST_TIME_ARGS (internal), GST_TIME_ARGS (external), GST_TIME_ARGS (diff), rate_n, rate_d,
-				GST_TIME_ARGS (my_int_time), GST_TIME_ARGS (pipeline_int_time)
-				);
-#endif
-			}
-
-			struct _buffer_memorytracker * memtrack = malloc(sizeof(struct _buffer_memorytracker));
-			if (G_UNLIKELY (!memtrack))
-			{
-				GST_ERROR_OBJECT (self, "can't allocate buffer_memorytracker");
-				goto stop_running;
+				g_mutex_unlock (&self->mutex);
 			}
+		}
 
-			if (readbuf)
-			{
-				GST_INFO_OBJECT (self, "LAST BUFFER WAS INCOMPLETE... appending");
-				GstBuffer *append_buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, enc->cdb, AMMAPSIZE, desc->stCommon.uiOffset, desc->stCommon.uiLength, memtrack, (GDestroyNotify) gst_dreamaudiosource_free_buffer);
-				readbuf = gst_buffer_append (readbuf, append_buffer);
-			}
-			else
-			{
-				GST_OBJECT_LOCK (self);
-				readbuf = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, enc->cdb, AMMAPSIZE, desc->stCommon.uiOffset, desc->stCommon.uiLength, memtrack, (GDestroyNotify) gst_dreamaudiosource_free_buffer);
-				if (desc->stCommon.uiLength == 0)
-				{
-					GST_WARNING_OBJECT (self, "ZERO SIZE BUFFER");
-					_gst_dreamaudiosource_emit_signal_lost (self);
-				}
-				memtrack->self = self;
-				memtrack->buffer = readbuf;
-				memtrack->uiOffset = desc->stCommon.uiOffset;
-				memtrack->uiLength = desc->stCommon.uiLength;
-				self->memtrack_list = g_list_append(self->memtrack_list, memtrack);
-				GST_OBJECT_UNLOCK (self);
-			}
-			if (result_pts != GST_CLOCK_TIME_NONE)
-			{
-				GST_BUFFER_PTS(readbuf) = result_pts;
-				GST_BUFFER_DTS(readbuf) = result_pts;
-			}
-#ifdef dump
-			int wret = write(self->dumpfd, (unsigned char*)(enc->cdb + desc->stCommon.uiOffset), desc->stCommon.uiLength);
-			GST_LOG_OBJECT (self, "read=%i dumped=%i gst_buffer_get_size=%" G_GSIZE_FORMAT " ", desc->stCommon.uiLength, wret, gst_buffer_get_size (readbuf) );
-#endif
+		if (G_UNLIKELY (self->dts_offset == GST_CLOCK_TIME_NONE))
+		{
+			GST_DEBUG_OBJECT (self, "dts_offset is still unknown, skipping frame...");
 			self->descriptors_count++;
 			break;
 		}
 
-		if (self->descriptors_count == self->descriptors_available)
+		if (encoder_pts != GST_CLOCK_TIME_NONE)
 		{
-			GST_LOG_OBJECT (self, "self->descriptors_count == self->descriptors_available -> release %i consumed descriptors", self->descriptors_count);
-			if (state == READTHREADSTATE_STOP)
-				GST_DEBUG_OBJECT (self, "readthread stopping, don't write to fd anymore!");
-			/* release consumed descs */
-			else if (write(enc->fd, &self->descriptors_count, sizeof(self->descriptors_count)) != sizeof(self->descriptors_count)) {
-				GST_WARNING_OBJECT (self, "release consumed descs write error!");
-				goto stop_running;
+			GstClockTime pts_clock_time = gst_dreamsource_calibration_apply (&self->calibration, encoder_pts - self->dts_offset);
+
+			if ( pts_clock_time >= base_time )
+				result_pts = pts_clock_time - base_time;
+			else
+				GST_DEBUG_OBJECT (self, "pts_clock_time < base_time, skipping frame...");
+
+			if (GST_DREAMSOURCE_TRACING)
+			{
+				DreamSourceTimestamps ts = { base_time, clock_time, encoder_pts, encoder_pts, encoder_pts - self->dts_offset, pts_clock_time,
+					self->calibration.internal, self->calibration.external, self->calibration.rate_n, self->calibration.rate_d, result_pts, result_pts };
+				gst_dreamsource_tracer_log_timestamps (GST_ELEMENT_CAST (self), &ts);
 			}
-			self->descriptors_available = 0;
 		}
 
+		DescriptorTrackerSlot *slot = gst_dreamsource_tracker_acquire (enc->tracker, desc->stCommon.uiOffset, desc->stCommon.uiLength);
+		GstBuffer *wrapped = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, enc->cdb, AMMAPSIZE, desc->stCommon.uiOffset, desc->stCommon.uiLength, slot, (GDestroyNotify) gst_dreamsource_tracker_release);
+
 		if (readbuf)
 		{
-			g_mutex_lock (&self->mutex);
-			if (!self->flushing)
-			{
-				if (gst_buffer_get_size (readbuf) == 0)
-				{
-					GstClockTime duration = timeout * GST_MSECOND;
-#if 1 // generate silence adts frames
-#define ADTS_HEADER_LEN       0x07
-#define AAC_PAYLOAD_LEN       0x06
-#define ADTS_DUMMY_FRAME_LEN  ADTS_HEADER_LEN + AAC_PAYLOAD_LEN
-					gst_buffer_unref(readbuf);
-					readbuf = gst_buffer_new_and_alloc (ADTS_DUMMY_FRAME_LEN);
-					GST_BUFFER_PTS (readbuf) = self->last_ts;
-					GST_BUFFER_DTS (readbuf) = self->last_ts;
-					GST_BUFFER_DURATION (readbuf) = duration;
-					GstMapInfo map;
-					gst_buffer_map (readbuf, &map, GST_MAP_WRITE);
-					guint8 *adts_header = map.data;
-					adts_header[0] = 0xff;
-					adts_header[1] = 0xf1;
-					adts_header[2] = 0x4c;
-					adts_header[3] = 0xb0;
-					adts_header[4] = 0x01;
-					adts_header[5] = 0xA0;
-					adts_header[6] = 0x00;
-					guint8 *payload = map.data+ADTS_HEADER_LEN;
-					payload[0] = 0x21;
-					payload[1] = 0x10;
-					payload[2] = 0x04;
-					payload[3] = 0x60;
-					payload[4] = 0x8c;
-					payload[5] = 0x1c;
-					gst_buffer_unmap (readbuf, &map);
-					GST_DEBUG_OBJECT (self, "Generated silence ADTS frame %" GST_PTR_FORMAT "" , readbuf);
-#else // produce gap events (mpegtsmux doesn't handle gap yet)
-					GstEvent *event = NULL;
-					event = gst_event_new_gap (self->last_ts, duration);
-					GST_DEBUG_OBJECT (self, "Sending %" GST_PTR_FORMAT" (from %" GST_TIME_FORMAT " to %" GST_TIME_FORMAT ")" , event, GST_TIME_ARGS (self->last_ts), GST_TIME_ARGS (self->last_ts+duration));
-					gst_pad_push_event (GST_BASE_SRC_PAD (self), event);
-#endif
-					self->last_ts += duration;
-				}
-				else
-					self->last_ts = GST_BUFFER_PTS(readbuf);
-				while (g_queue_get_length (&self->current_frames) >= self->buffer_size)
-				{
-					GstBuffer * oldbuf = g_queue_pop_head (&self->current_frames);
-					GST_WARNING_OBJECT (self, "dropping %" GST_PTR_FORMAT " because of queue overflow! buffers count=%i", oldbuf, g_queue_get_length (&self->current_frames));
-					gst_buffer_unref(oldbuf);
-					GST_BUFFER_FLAG_SET ((GstBuffer *) g_queue_peek_head (&self->current_frames), GST_BUFFER_FLAG_DISCONT);
-				}
-				if (discont)
-				{
-					GST_BUFFER_FLAG_SET (readbuf, GST_BUFFER_FLAG_DISCONT);
-					discont = FALSE;
-				}
-				g_queue_push_tail (&self->current_frames, readbuf);
-				GST_INFO_OBJECT (self, "read %" GST_PTR_FORMAT " to queue... buffers count=%i", readbuf, g_queue_get_length (&self->current_frames));
-			}
-			else
+			GST_INFO_OBJECT (self, "LAST BUFFER WAS INCOMPLETE... appending");
+			readbuf = gst_buffer_append (readbuf, wrapped);
+		}
+		else
+		{
+			readbuf = wrapped;
+			if (desc->stCommon.uiLength == 0)
 			{
-				if (self->flushing)
-				{
-					GST_INFO_OBJECT (self, "dropping %" GST_PTR_FORMAT " because we're flushing", readbuf);
-					gst_buffer_unref(readbuf);
-				}
-				else
-				{
-
-				}
-				gst_buffer_unref(readbuf);
+				GST_WARNING_OBJECT (self, "ZERO SIZE BUFFER");
+				_gst_dreamaudiosource_emit_signal_lost (self);
 			}
-			g_cond_signal (&self->cond);
-			g_mutex_unlock (&self->mutex);
+		}
+		if (result_pts != GST_CLOCK_TIME_NONE)
+		{
+			GST_BUFFER_PTS(readbuf) = result_pts;
+			GST_BUFFER_DTS(readbuf) = result_pts;
+		}
+#ifdef dump
+		int wret = write(self->dumpfd, (unsigned char*)(enc->cdb + desc->stCommon.uiOffset), desc->stCommon.uiLength);
+		GST_LOG_OBJECT (self, "read=%i dumped=%i gst_buffer_get_size=%" G_GSIZE_FORMAT " ", desc->stCommon.uiLength, wret, gst_buffer_get_size (readbuf) );
+#endif
+		self->descriptors_count++;
+		if (self->batch)
+		{
+			if (readbuf)
+				gst_dreamaudiosource_enqueue (self, readbuf, &self->discont);
 			readbuf = NULL;
+			continue;
 		}
+		break;
 	}
 
-	g_assert_not_reached ();
-	return;
+	if (self->descriptors_count == self->descriptors_available)
+	{
+		GST_LOG_OBJECT (self, "self->descriptors_count == self->descriptors_available -> release %i consumed descriptors", self->descriptors_count);
+		if (self->read_state == READTHREADSTATE_STOP)
+			GST_DEBUG_OBJECT (self, "readthread stopping, don't write to fd anymore!");
+		/* release consumed descs */
+		else if (gst_dreamsource_encoder_release (enc, self->descriptors_count) != 0) {
+			GST_WARNING_OBJECT (self, "release consumed descs write error!");
+			return FALSE;
+		}
+		self->descriptors_available = 0;
+	}
 
-	stop_running:
+	if (readbuf)
 	{
-//		g_mutex_unlock (&self->mutex);
-		g_cond_signal (&self->cond);
-		GST_DEBUG ("stop running, exit thread");
-		message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_LEAVE, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
-		g_value_init (&val, GST_TYPE_G_THREAD);
-		g_value_set_boxed (&val, self->readthread);
-		gst_message_set_stream_status_object (message, &val);
-		g_value_unset (&val);
-		GST_DEBUG_OBJECT (self, "posting LEAVE stream status");
-		gst_element_post_message (GST_ELEMENT_CAST (self), message);
+		gst_dreamaudiosource_enqueue (self, readbuf, &self->discont);
+		readbuf = NULL;
+	}
+	gst_dreamsource_frame_queue_publish (self->frames);
+
+done:
+	if (self->read_state == READTHREADSTATE_STOP)
+		return FALSE;
+	*fd = gst_dreamaudiosource_read_wait (self, timeout);
+	return TRUE;
+}
+
+static void gst_dreamaudiosource_read_thread_func (GstDreamAudioSource * self)
+{
+	EncoderInfo *enc = self->encoder;
+	int fd, timeout;
+
+	if (!enc) {
+		GST_WARNING_OBJECT (self, "encoder device not opened!");
 		return;
 	}
+
+	GST_DEBUG_OBJECT (self, "enter read thread");
+
+	GstMessage *message;
+	GValue val = { 0 };
+
+	message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_ENTER, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
+	g_value_init (&val, GST_TYPE_G_THREAD);
+	g_value_set_boxed (&val, self->readthread);
+	gst_message_set_stream_status_object (message, &val);
+	g_value_unset (&val);
+	GST_DEBUG_OBJECT (self, "posting ENTER stream status");
+	gst_element_post_message (GST_ELEMENT_CAST (self), message);
+
+	fd = gst_dreamaudiosource_read_wait (self, &timeout);
+	while (TRUE) {
+		struct pollfd rfd[2];
+		guint events = 0;
+
+		rfd[0].fd = self->commands->fd;
+		rfd[0].events = POLLIN | POLLERR | POLLHUP | POLLPRI;
+		rfd[1].fd = fd;
+		rfd[1].events = POLLIN;
+		rfd[1].revents = 0;
+
+		int ret = poll(rfd, fd >= 0 ? 2 : 1, timeout);
+
+		if (G_UNLIKELY (ret == -1))
+		{
+			GST_ERROR_OBJECT (self, "SELECT ERROR!");
+			break;
+		}
+		if (rfd[0].revents)
+			events |= GST_DREAMSOURCE_REACTOR_CONTROL;
+		if (rfd[1].revents & POLLIN)
+			events |= GST_DREAMSOURCE_REACTOR_ENCODER;
+		if (!gst_dreamaudiosource_read_handle (self, events, &fd, &timeout))
+			break;
+	}
+
+	GST_DEBUG ("stop running, exit thread");
+	message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_LEAVE, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
+	g_value_init (&val, GST_TYPE_G_THREAD);
+	g_value_set_boxed (&val, self->readthread);
+	gst_message_set_stream_status_object (message, &val);
+	g_value_unset (&val);
+	GST_DEBUG_OBJECT (self, "posting LEAVE stream status");
+	gst_element_post_message (GST_ELEMENT_CAST (self), message);
 }
 
 static GstFlowReturn
@@ -906,21 +1172,15 @@ gst_dreamaudiosource_create (GstPushSrc * psrc, GstBuffer ** outbuf)
 {
 	GstDreamAudioSource *self = GST_DREAMAUDIOSOURCE (psrc);
 
-	GST_LOG_OBJECT (self, "new buffer requested. queue has %i buffers", g_queue_get_length (&self->current_frames));
+	GST_LOG_OBJECT (self, "new buffer requested. queue has %i buffers", gst_dreamsource_frame_queue_get_length (self->frames));
 
-	g_mutex_lock (&self->mutex);
-	while (g_queue_is_empty (&self->current_frames) && !self->flushing)
-	{
-		GST_DEBUG_OBJECT (self, "waiting for buffer from encoder");
-		g_cond_wait (&self->cond, &self->mutex);
-	}
-
-	*outbuf = g_queue_pop_head (&self->current_frames);
-	g_mutex_unlock (&self->mutex);
+	gint64 read_time = 0;
+	*outbuf = gst_dreamsource_frame_queue_pop_stamped (self->frames, &read_time);
 
 	if (*outbuf)
 	{
-		GST_INFO_OBJECT (self, "pushing %" GST_PTR_FORMAT ". queue has %i buffers", *outbuf, g_queue_get_length (&self->current_frames));
+		GST_INFO_OBJECT (self, "pushing %" GST_PTR_FORMAT ". queue has %i buffers", *outbuf, gst_dreamsource_frame_queue_get_length (self->frames));
+		gst_dreamsource_stats_add_latency (&self->stats, read_time);
 		return GST_FLOW_OK;
 	}
 	GST_INFO_OBJECT (self, "FLUSHING");
@@ -938,32 +1198,57 @@ static GstStateChangeReturn gst_dreamaudiosource_change_state (GstElement * elem
 		{
 			if (!gst_dreamaudiosource_encoder_init (self))
 			{
+				gst_dreamaudiosource_encoder_release (self);
 				GError *err = g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ, "Can't initialize encoder device");
 				GstMessage *msg = gst_message_new_error (GST_OBJECT (self), err, NULL);
 				gst_element_post_message (element, msg);
 				g_error_free (err);
 				return GST_STATE_CHANGE_FAILURE;
 			}
+			self->sync = gst_dreamsource_sync_obtain (element, self->encoder->device_index);
+			gst_dreamsource_sync_join (self->sync, ENCODER_KIND_AUDIO);
 			GST_DEBUG_OBJECT (self, "GST_STATE_CHANGE_NULL_TO_READY");
 			break;
 		}
 		case GST_STATE_CHANGE_READY_TO_PAUSED:
 			GST_LOG_OBJECT (self, "GST_STATE_CHANGE_READY_TO_PAUSED");
-			self->dreamvideosrc = gst_bin_get_by_name_recurse_up(GST_BIN(GST_ELEMENT_PARENT(self)), "dreamvideosource0");
+			gst_dreamsource_sync_start (self->sync);
+			self->dreamvideosrc = gst_dreamsource_device_get_peer (self->encoder);
 			if (self->dreamvideosrc)
 			{
 				gint videobitrate = 0;
 				g_object_get (G_OBJECT (self->dreamvideosrc), "bitrate", &videobitrate, NULL);
 				gfloat x = videobitrate/100.0;
 				GST_DEBUG_OBJECT (self, "bitrate/100.0 = %f", x);
-				self->buffer_size = (gint)((-0.0026)*x*x) + (gint)(1.0756*x) + DEFAULT_BUFFER_SIZE; // empirically approximated polynom
+				gint size = (gint)((-0.0026)*x*x) + (gint)(1.0756*x) + DEFAULT_BUFFER_SIZE; // empirically approximated polynom
+				/* the polynom turns negative above ~44 Mbit/s */
+				self->buffer_size = MAX (size, DEFAULT_BUFFER_SIZE);
 				GST_INFO_OBJECT (self, "%" GST_PTR_FORMAT "'s bitrate=%i -> set internal buffer_size to %i", self->dreamvideosrc, videobitrate, self->buffer_size);
 			}
+			gst_dreamsource_frame_queue_set_limit (self->frames, self->buffer_size);
 			self->dts_offset = GST_CLOCK_TIME_NONE;
 #ifdef PROVIDE_CLOCK
 			gst_element_post_message (element, gst_message_new_clock_provide (GST_OBJECT_CAST (element), self->encoder_clock, TRUE));
 #endif
-			self->flushing = TRUE;
+			gst_dreamsource_timestamp_reset (&self->pts_unit);
+			gst_dreamsource_stats_reset (&self->stats);
+			gst_dreamsource_latency_reset (&self->latency);
+			gst_dreamsource_frame_queue_set_flushing (self->frames, TRUE);
+			self->read_state = READTHREADSTATE_NONE;
+			self->discont = TRUE;
+			self->tracker_full = FALSE;
+			/* descriptors are given back right away, the ring memory is reused */
+			gst_dreamsource_gop_cache_configure (&self->gop_cache, self->gop_cache_size, 0, TRUE);
+			gst_dreamaudiosource_timeshift_start (self, TIMESHIFT_MAX_QUEUED, TRUE);
+			gst_dreamsource_command_queue_open (self->commands);
+			g_atomic_int_set (&self->loop_running, TRUE);
+			if (self->shared_reactor)
+			{
+				self->reactor = gst_dreamsource_reactor_get ();
+				self->reactor_source = gst_dreamsource_reactor_add (self->reactor, self->commands->fd, (DreamSourceReactorFunc) gst_dreamaudiosource_read_handle, self);
+				GST_DEBUG_OBJECT (self, "reading on the shared reactor");
+				break;
+			}
 			self->readthread = g_thread_try_new ("dreamaudiosrc-read", (GThreadFunc) gst_dreamaudiosource_read_thread_func, self, NULL);
 			GST_DEBUG_OBJECT (self, "started readthread @%p", self->readthread);
 			break;
@@ -983,11 +1268,10 @@ static GstStateChangeReturn gst_dreamaudiosource_change_state (GstElement * elem
 			}
 				else
 					GST_WARNING_OBJECT (self, "no pipeline clock!");
-			ret = ioctl(self->encoder->fd, AENC_START);
+			ret = gst_dreamsource_encoder_ioctl (self->encoder, AENC_START, NULL);
 			if ( ret != 0 )
 				goto fail;
 			self->descriptors_available = 0;
-			CLEAR_COMMAND (self);
 			g_mutex_unlock (&self->mutex);
 			break;
 		default:
@@ -1000,19 +1284,19 @@ static GstStateChangeReturn gst_dreamaudiosource_change_state (GstElement * elem
 	switch (transition) {
 		case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
 			g_mutex_lock (&self->mutex);
-			SEND_COMMAND (self, CONTROL_RUN);
+			gst_dreamsource_command_queue_push (self->commands, COMMAND_RUN, 0);
 			GST_INFO_OBJECT (self, "started encoder!");
 			g_mutex_unlock (&self->mutex);
 			break;
 		case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
 			g_mutex_lock (&self->mutex);
 			GST_DEBUG_OBJECT (self, "GST_STATE_CHANGE_PLAYING_TO_PAUSED self->descriptors_count=%i self->descriptors_available=%i", self->descriptors_count, self->descriptors_available);
-			SEND_COMMAND (self, CONTROL_PAUSE);
+			gst_dreamsource_command_queue_push (self->commands, COMMAND_PAUSE, 0);
 			if (self->descriptors_count < self->descriptors_available)
 				self->descriptors_count = self->descriptors_available;
 			if (self->descriptors_count)
-				write(self->encoder->fd, &self->descriptors_count, sizeof(self->descriptors_count));
-			ret = ioctl(self->encoder->fd, AENC_STOP);
+				gst_dreamsource_encoder_release (self->encoder, self->descriptors_count);
+			ret = gst_dreamsource_encoder_ioctl (self->encoder, AENC_STOP, NULL);
 			if ( ret != 0 )
 				goto fail;
 #ifdef PROVIDE_CLOCK
@@ -1027,9 +1311,28 @@ static GstStateChangeReturn gst_dreamaudiosource_change_state (GstElement * elem
 			gst_element_post_message (element, gst_message_new_clock_lost (GST_OBJECT_CAST (element), self->encoder_clock));
 			gst_clock_set_calibration (self->encoder_clock, 0, 0, 1, 1);
 #endif
-			GST_DEBUG_OBJECT (self, "stopping readthread @%p...", self->readthread);
-			SEND_COMMAND (self, CONTROL_STOP);
-			g_thread_join (self->readthread);
+			if (self->reactor)
+			{
+				gst_dreamsource_reactor_remove (self->reactor, self->reactor_source);
+				gst_dreamsource_reactor_unref (self->reactor);
+				self->reactor = NULL;
+				self->reactor_source = NULL;
+				self->read_state = READTHREADSTATE_STOP;
+			}
+			else
+			{
+				GST_DEBUG_OBJECT (self, "stopping readthread @%p...", self->readthread);
+				gst_dreamsource_command_queue_push (self->commands, COMMAND_STOP, 0);
+				g_thread_join (self->readthread);
+			}
+			g_atomic_int_set (&self->loop_running, FALSE);
+			/* a setter that still saw the loop running must not leave its
+			 * command for the next start, it gets it applied directly instead */
+			gst_dreamsource_command_queue_close (self->commands);
+			gst_dreamaudiosource_drain_commands (self);
+			gst_dreamsource_gop_cache_flush (&self->gop_cache);
+			gst_dreamaudiosource_timeshift_stop (self);
+			gst_dreamsource_sync_stop (self->sync);
 			if (self->dreamvideosrc)
 				gst_object_unref(self->dreamvideosrc);
 			self->dreamvideosrc = NULL;
@@ -1056,9 +1359,17 @@ gst_dreamaudiosource_dispose (GObject * gobject)
 #ifdef dump
 	close(self->dumpfd);
 #endif
-	g_list_free(self->memtrack_list);
+	if (self->frames) {
+		gst_dreamsource_frame_queue_free (self->frames);
+		self->frames = NULL;
+	}
+	if (self->commands) {
+		gst_dreamsource_command_queue_free (self->commands);
+		self->commands = NULL;
+	}
+	gst_dreamsource_gop_cache_clear (&self->gop_cache);
+	g_free (self->timeshift_location);
 	g_mutex_clear (&self->mutex);
-	g_cond_clear (&self->cond);
 	GST_DEBUG_OBJECT (self, "disposed");
 	G_OBJECT_CLASS (parent_class)->dispose (gobject);
 }
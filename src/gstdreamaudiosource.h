@@ -39,6 +39,7 @@ struct _AudioFormatInfo {
 #define ABDSIZE		sizeof(AudioBufferDescriptor)
 #define ABUFSIZE	(1024*16)
 #define AMMAPSIZE	(256*1024)
+#define ATRACKSLOTS	1024	/* more than AMMAPSIZE holds AAC frames */
 
 #define AENC_START        _IO('v', 128)
 #define AENC_STOP         _IO('v', 129)
@@ -74,14 +75,6 @@ typedef struct _AudioBufferDescriptor      AudioBufferDescriptor;
 // #define dump 1
 #define PROVIDE_CLOCK
 
-struct _buffer_memorytracker
-{
-	GstDreamAudioSource *self;
-	GstBuffer *buffer;
-	guint uiOffset;
-	guint uiLength;
-};
-
 struct _GstDreamAudioSource
 {
 	GstPushSrc element;
@@ -99,20 +92,39 @@ struct _GstDreamAudioSource
 	goffset dumpsize;
 
 	GstElement *dreamvideosrc;
+	DreamSourceSync *sync;     /* shared with the video source of the same encoder slot */
 	gint64 dts_offset;
+	TimestampUnit pts_unit;
+	TimestampCalibration calibration;
 
 	GMutex mutex;
-	GCond cond;
-	int control_sock[2];
-
-	gboolean flushing;
+	CommandQueue *commands;
+	gint loop_running;
 
 	GThread *readthread;
-	GQueue current_frames;
+	DreamSourceReactor *reactor;
+	DreamSourceReactorSource *reactor_source;
+	gboolean shared_reactor;
+	guint gop_cache_size;
+	GopCache gop_cache;
+	gchar *timeshift_location;
+	guint64 timeshift_size;
+	Timeshift *timeshift;      /* GST_OBJECT_LOCK, set while the read loop runs */
+	GstDreamSourceReadthreadState read_state;
+	GstClockTime read_clock_time, read_base_time;
+	gboolean discont;
+	FrameQueue *frames;
 	guint buffer_size;
-	GList *memtrack_list;
+	gboolean batch;
+	DreamSourceStats stats;
+	EncoderLatency latency;
+	uint32_t read_stc;         /* STC at the last encoder read, from read_clock_time */
+	gboolean read_stc_valid;
+	gboolean tracker_full;     /* the read loop waits for downstream to free buffers */
 
 	GstClock *encoder_clock;
+	GstDreamSourceClockMode clock_mode;
+	gint device_index;
 	GstClockTime last_ts;
 };
 
@@ -123,6 +135,9 @@ struct _GstDreamAudioSourceClass
 	void (*signal_lost)  (GstDreamAudioSource *self);
 	/* actions */
 	gint64 (*get_dts_offset) (GstDreamAudioSource *self);
+	GstBufferList * (*get_gop_cache) (GstDreamAudioSource *self, guint64 since);
+	guint64 (*timeshift_seek) (GstDreamAudioSource *self, guint64 time);
+	GstBufferList * (*timeshift_read) (GstDreamAudioSource *self, guint64 sequence, guint max_frames);
 };
 
 GType gst_dreamaudiosource_get_type (void);
@@ -0,0 +1,348 @@
+/*
+ * GStreamer dreamavsource
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include "gstdreamavsource.h"
+
+GST_DEBUG_CATEGORY_STATIC (dreamavsource_debug);
+#define GST_CAT_DEFAULT dreamavsource_debug
+
+enum
+{
+	ARG_0,
+	ARG_DEVICE_INDEX,
+	ARG_INTERLEAVE,
+	ARG_INTERLEAVE_TIMEOUT
+};
+
+#define DEFAULT_DEVICE_INDEX GST_DREAMSOURCE_DEVICE_INDEX_AUTO
+#define DEFAULT_INTERLEAVE  TRUE
+#define DEFAULT_INTERLEAVE_TIMEOUT READTHREAD_TIMEOUT
+
+static const gchar *stream_names[AVSOURCE_N_STREAMS] = { "video", "audio" };
+
+#define gst_dreamavsource_parent_class parent_class
+G_DEFINE_TYPE (GstDreamAvSource, gst_dreamavsource, GST_TYPE_BIN);
+
+static void gst_dreamavsource_dispose (GObject * gobject);
+static void gst_dreamavsource_finalize (GObject * gobject);
+static void gst_dreamavsource_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_dreamavsource_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec);
+
+static GstStateChangeReturn gst_dreamavsource_change_state (GstElement * element, GstStateChange transition);
+static GstClock *gst_dreamavsource_provide_clock (GstElement * element);
+static GstPadProbeReturn gst_dreamavsource_probe (GstPad * pad, GstPadProbeInfo * info, GstDreamAvSource * self);
+
+/* the pads take over the caps of the source elements' templates */
+static void
+gst_dreamavsource_add_pad_template (GstElementClass * gstelement_class, GType source_type, const gchar * name)
+{
+	GstElementClass *source_class = g_type_class_ref (source_type);
+	GstCaps *caps = gst_pad_template_get_caps (gst_element_class_get_pad_template (source_class, "src"));
+
+	gst_element_class_add_pad_template (gstelement_class, gst_pad_template_new (name, GST_PAD_SRC, GST_PAD_ALWAYS, caps));
+	gst_caps_unref (caps);
+	g_type_class_unref (source_class);
+}
+
+static void
+gst_dreamavsource_class_init (GstDreamAvSourceClass * klass)
+{
+	GObjectClass *gobject_class;
+	GstElementClass *gstelement_class;
+
+	gobject_class = (GObjectClass *) klass;
+	gstelement_class = (GstElementClass *) klass;
+
+	gobject_class->set_property = gst_dreamavsource_set_property;
+	gobject_class->get_property = gst_dreamavsource_get_property;
+	gobject_class->dispose = gst_dreamavsource_dispose;
+	gobject_class->finalize = gst_dreamavsource_finalize;
+
+	gst_dreamavsource_add_pad_template (gstelement_class, GST_TYPE_DREAMVIDEOSOURCE, stream_names[AVSOURCE_STREAM_VIDEO]);
+	gst_dreamavsource_add_pad_template (gstelement_class, GST_TYPE_DREAMAUDIOSOURCE, stream_names[AVSOURCE_STREAM_AUDIO]);
+
+	gst_element_class_set_static_metadata (gstelement_class,
+	    "Dream Audio/Video source", "Source/Audio/Video",
+	    "Provide interleaved video and audio elementary streams from one Dreambox encoder",
+	    "Andreas Frisch <fraxinas@opendreambox.org>");
+
+	gstelement_class->change_state = gst_dreamavsource_change_state;
+	gstelement_class->provide_clock = GST_DEBUG_FUNCPTR (gst_dreamavsource_provide_clock);
+
+	g_object_class_install_property (gobject_class, ARG_DEVICE_INDEX,
+	  g_param_spec_int ("device-index", "Device index",
+	    "Encoder device pair to use, -1 picks the first free one (takes effect in NULL state)",
+	    GST_DREAMSOURCE_DEVICE_INDEX_AUTO, GST_DREAMSOURCE_MAX_DEVICES - 1, DEFAULT_DEVICE_INDEX,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_INTERLEAVE,
+	  g_param_spec_boolean ("interleave", "Interleave",
+	    "Hold back buffers of the stream ahead until the other one caught up, so they leave in timestamp order. This blocks the streaming thread of the stream ahead for up to interleave-timeout, its encoder is still read meanwhile",
+	    DEFAULT_INTERLEAVE, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_INTERLEAVE_TIMEOUT,
+	  g_param_spec_uint ("interleave-timeout", "Interleave timeout",
+	    "ms to hold back a buffer for the other stream before that one counts as stalled",
+	    0, G_MAXINT, DEFAULT_INTERLEAVE_TIMEOUT,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_dreamavsource_init (GstDreamAvSource * self)
+{
+	GType types[AVSOURCE_N_STREAMS] = { GST_TYPE_DREAMVIDEOSOURCE, GST_TYPE_DREAMAUDIOSOURCE };
+	AvSourceStream i;
+
+	self->device_index = DEFAULT_DEVICE_INDEX;
+	self->interleave = DEFAULT_INTERLEAVE;
+	self->interleave_timeout = DEFAULT_INTERLEAVE_TIMEOUT;
+	g_mutex_init (&self->lock);
+	g_cond_init (&self->cond);
+
+	/* the children stay reachable for their own settings through the child
+	 * proxy interface, e.g. video::bitrate */
+	for (i = 0; i < AVSOURCE_N_STREAMS; i++)
+	{
+		GstPad *ghost;
+
+		self->source[i] = g_object_new (types[i], "name", stream_names[i], "shared-reactor", TRUE, NULL);
+		gst_bin_add (GST_BIN (self), self->source[i]);
+		self->srcpad[i] = gst_element_get_static_pad (self->source[i], "src");
+		self->probe[i] = gst_pad_add_probe (self->srcpad[i], GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+			(GstPadProbeCallback) gst_dreamavsource_probe, self, NULL);
+		ghost = gst_ghost_pad_new_from_template (stream_names[i], self->srcpad[i], gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS (self), stream_names[i]));
+		gst_element_add_pad (GST_ELEMENT (self), ghost);
+		self->ghostpad[i] = ghost;
+		self->position[i] = GST_CLOCK_TIME_NONE;
+		self->stalled[i] = FALSE;
+	}
+	self->flushing = TRUE;
+}
+
+static void
+gst_dreamavsource_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+	GstDreamAvSource *self = GST_DREAMAVSOURCE (object);
+	AvSourceStream i;
+
+	switch (prop_id) {
+		case ARG_DEVICE_INDEX:
+			self->device_index = g_value_get_int (value);
+			for (i = 0; i < AVSOURCE_N_STREAMS; i++)
+				g_object_set (self->source[i], "device-index", self->device_index, NULL);
+			break;
+		case ARG_INTERLEAVE:
+			g_mutex_lock (&self->lock);
+			self->interleave = g_value_get_boolean (value);
+			g_cond_broadcast (&self->cond);
+			g_mutex_unlock (&self->lock);
+			break;
+		case ARG_INTERLEAVE_TIMEOUT:
+			g_mutex_lock (&self->lock);
+			self->interleave_timeout = g_value_get_uint (value);
+			g_mutex_unlock (&self->lock);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+gst_dreamavsource_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
+{
+	GstDreamAvSource *self = GST_DREAMAVSOURCE (object);
+
+	switch (prop_id) {
+		case ARG_DEVICE_INDEX:
+			g_value_set_int (value, self->device_index);
+			break;
+		case ARG_INTERLEAVE:
+			g_value_set_boolean (value, self->interleave);
+			break;
+		case ARG_INTERLEAVE_TIMEOUT:
+			g_value_set_uint (value, self->interleave_timeout);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+/* wakes up and keeps out streaming threads waiting for the other stream */
+static void
+gst_dreamavsource_set_flushing (GstDreamAvSource * self, gboolean flushing)
+{
+	AvSourceStream i;
+
+	g_mutex_lock (&self->lock);
+	self->flushing = flushing;
+	for (i = 0; i < AVSOURCE_N_STREAMS; i++)
+	{
+		self->position[i] = GST_CLOCK_TIME_NONE;
+		self->stalled[i] = FALSE;
+	}
+	g_cond_broadcast (&self->cond);
+	g_mutex_unlock (&self->lock);
+}
+
+/* a buffer leaves once the other stream got as far, so the stream that is
+ * behind never waits and the two can't block each other. A stream that
+ * doesn't push for interleave-timeout is passed over until it does again. */
+static void
+gst_dreamavsource_interleave (GstDreamAvSource * self, AvSourceStream stream, GstClockTime ts)
+{
+	AvSourceStream other = stream == AVSOURCE_STREAM_VIDEO ? AVSOURCE_STREAM_AUDIO : AVSOURCE_STREAM_VIDEO;
+	gint64 deadline;
+
+	g_mutex_lock (&self->lock);
+	self->position[stream] = ts;
+	self->stalled[stream] = FALSE;
+	g_cond_broadcast (&self->cond);
+	deadline = g_get_monotonic_time () + self->interleave_timeout * G_TIME_SPAN_MILLISECOND;
+	while (self->interleave && !self->flushing && !self->stalled[other] &&
+		(self->position[other] == GST_CLOCK_TIME_NONE || self->position[other] < ts))
+	{
+		if (!g_cond_wait_until (&self->cond, &self->lock, deadline))
+		{
+			GST_DEBUG_OBJECT (self, "%s stalled at %" GST_TIME_FORMAT ", %s at %" GST_TIME_FORMAT " goes on alone", stream_names[other],
+				GST_TIME_ARGS (self->position[other]), stream_names[stream], GST_TIME_ARGS (ts));
+			self->stalled[other] = TRUE;
+		}
+	}
+	g_mutex_unlock (&self->lock);
+}
+
+static GstPadProbeReturn
+gst_dreamavsource_probe (GstPad * pad, GstPadProbeInfo * info, GstDreamAvSource * self)
+{
+	AvSourceStream stream = pad == self->srcpad[AVSOURCE_STREAM_VIDEO] ? AVSOURCE_STREAM_VIDEO : AVSOURCE_STREAM_AUDIO;
+	GstBuffer *buffer = NULL;
+
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+		buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+		buffer = gst_buffer_list_get (GST_PAD_PROBE_INFO_BUFFER_LIST (info), 0);
+	else if (info->type & GST_PAD_PROBE_TYPE_EVENT_BOTH)
+	{
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+		switch (GST_EVENT_TYPE (event)) {
+			case GST_EVENT_FLUSH_START:
+				gst_dreamavsource_set_flushing (self, TRUE);
+				break;
+			case GST_EVENT_FLUSH_STOP:
+				gst_dreamavsource_set_flushing (self, FALSE);
+				break;
+			case GST_EVENT_EOS:
+				g_mutex_lock (&self->lock);
+				self->stalled[stream] = TRUE;
+				g_cond_broadcast (&self->cond);
+				g_mutex_unlock (&self->lock);
+				break;
+			default:
+				break;
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	/* the child would fail with not-linked and take the bin down with it, a
+	 * pad nobody wants, e.g. audio of a video-only pipeline, is just dropped */
+	if (!gst_pad_is_linked (self->ghostpad[stream]))
+	{
+		g_mutex_lock (&self->lock);
+		self->stalled[stream] = TRUE;
+		g_cond_broadcast (&self->cond);
+		g_mutex_unlock (&self->lock);
+		return GST_PAD_PROBE_DROP;
+	}
+
+	if (buffer && GST_BUFFER_DTS_OR_PTS (buffer) != GST_CLOCK_TIME_NONE)
+		gst_dreamavsource_interleave (self, stream, GST_BUFFER_DTS_OR_PTS (buffer));
+	return GST_PAD_PROBE_OK;
+}
+
+/* dreamvideosource times itself by the audio encoder's clock once it found
+ * its peer, so the audio one is the clock of both */
+static GstClock *
+gst_dreamavsource_provide_clock (GstElement * element)
+{
+	GstDreamAvSource *self = GST_DREAMAVSOURCE (element);
+	return gst_element_provide_clock (self->source[AVSOURCE_STREAM_AUDIO]);
+}
+
+static GstStateChangeReturn
+gst_dreamavsource_change_state (GstElement * element, GstStateChange transition)
+{
+	GstDreamAvSource *self = GST_DREAMAVSOURCE (element);
+
+	switch (transition) {
+		case GST_STATE_CHANGE_READY_TO_PAUSED:
+			gst_dreamavsource_set_flushing (self, FALSE);
+			break;
+		case GST_STATE_CHANGE_PAUSED_TO_READY:
+			/* before the children stop their streaming threads */
+			gst_dreamavsource_set_flushing (self, TRUE);
+			break;
+		default:
+			break;
+	}
+
+	return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+gst_dreamavsource_dispose (GObject * gobject)
+{
+	GstDreamAvSource *self = GST_DREAMAVSOURCE (gobject);
+	AvSourceStream i;
+
+	for (i = 0; i < AVSOURCE_N_STREAMS; i++)
+	{
+		if (self->srcpad[i])
+		{
+			gst_pad_remove_probe (self->srcpad[i], self->probe[i]);
+			gst_object_unref (self->srcpad[i]);
+			self->srcpad[i] = NULL;
+		}
+		self->source[i] = NULL;
+		self->ghostpad[i] = NULL;
+	}
+	GST_DEBUG_OBJECT (self, "disposed");
+	G_OBJECT_CLASS (parent_class)->dispose (gobject);
+}
+
+static void
+gst_dreamavsource_finalize (GObject * gobject)
+{
+	GstDreamAvSource *self = GST_DREAMAVSOURCE (gobject);
+	g_cond_clear (&self->cond);
+	g_mutex_clear (&self->lock);
+	G_OBJECT_CLASS (parent_class)->finalize (gobject);
+}
+
+gboolean
+gst_dreamavsource_plugin_init (GstPlugin *plugin)
+{
+	GST_DEBUG_CATEGORY_INIT (dreamavsource_debug, "dreamavsource", 0, "dreamavsource");
+	return gst_element_register (plugin, "dreamavsource", GST_RANK_PRIMARY, GST_TYPE_DREAMAVSOURCE);
+}
@@ -0,0 +1,83 @@
+/*
+ * GStreamer dreamavsource
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMAVSOURCE_H__
+#define __GST_DREAMAVSOURCE_H__
+
+#include "gstdreamvideosource.h"
+#include "gstdreamaudiosource.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DREAMAVSOURCE \
+  (gst_dreamavsource_get_type())
+#define GST_DREAMAVSOURCE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_DREAMAVSOURCE,GstDreamAvSource))
+#define GST_DREAMAVSOURCE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_DREAMAVSOURCE,GstDreamAvSourceClass))
+#define GST_IS_DREAMAVSOURCE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_DREAMAVSOURCE))
+#define GST_IS_DREAMAVSOURCE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_DREAMAVSOURCE))
+
+typedef struct _GstDreamAvSource        GstDreamAvSource;
+typedef struct _GstDreamAvSourceClass   GstDreamAvSourceClass;
+
+typedef enum
+{
+	AVSOURCE_STREAM_VIDEO = 0,
+	AVSOURCE_STREAM_AUDIO,
+	AVSOURCE_N_STREAMS
+} AvSourceStream;
+
+/* a dreamvideosource and a dreamaudiosource of one encoder slot behind a
+ * "video" and an "audio" pad, reading on the shared reactor and, with
+ * interleave, pushing in timestamp order. Buffers for an unlinked pad are
+ * dropped. */
+struct _GstDreamAvSource
+{
+	GstBin bin;
+
+	GstElement *source[AVSOURCE_N_STREAMS];
+	GstPad *srcpad[AVSOURCE_N_STREAMS];       /* the children's, the ghost pads target them */
+	GstPad *ghostpad[AVSOURCE_N_STREAMS];     /* owned by the bin */
+	gulong probe[AVSOURCE_N_STREAMS];
+
+	gint device_index;
+	gboolean interleave;
+	guint interleave_timeout;                 /* ms */
+
+	/* interleaving state of the two streaming threads */
+	GMutex lock;
+	GCond cond;
+	GstClockTime position[AVSOURCE_N_STREAMS];
+	gboolean stalled[AVSOURCE_N_STREAMS];     /* don't wait for it until it pushes again */
+	gboolean flushing;
+};
+
+struct _GstDreamAvSourceClass
+{
+	GstBinClass parent_class;
+};
+
+GType gst_dreamavsource_get_type (void);
+gboolean gst_dreamavsource_plugin_init (GstPlugin * plugin);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMAVSOURCE_H__ */
@@ -0,0 +1,139 @@
+/*
+ * GStreamer dreamsource command queue
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "gstdreamcommand.h"
+
+CommandQueue *
+gst_dreamsource_command_queue_new (void)
+{
+	CommandQueue *queue = g_new0 (CommandQueue, 1);
+
+	g_mutex_init (&queue->lock);
+	queue->fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	queue->n_items = 16;
+	queue->items = g_new0 (DreamSourceCommand, queue->n_items);
+	return queue;
+}
+
+void
+gst_dreamsource_command_queue_free (CommandQueue *queue)
+{
+	if (queue->fd >= 0)
+		close (queue->fd);
+	g_mutex_clear (&queue->lock);
+	g_free (queue->items);
+	g_free (queue);
+}
+
+/* never blocks, a pending command of a coalescing type just takes the new
+ * value and keeps its place. Returns FALSE if the queue is closed. */
+gboolean
+gst_dreamsource_command_queue_push (CommandQueue *queue, DreamSourceCommandType type, guint32 value)
+{
+	guint i;
+
+	g_mutex_lock (&queue->lock);
+	if (queue->closed)
+	{
+		g_mutex_unlock (&queue->lock);
+		return FALSE;
+	}
+	if (type >= COMMAND_WAKEUP)
+	{
+		for (i = 0; i < queue->len; i++)
+		{
+			if (queue->items[i].type == type)
+			{
+				queue->items[i].value = value;
+				g_mutex_unlock (&queue->lock);
+				return TRUE;
+			}
+		}
+	}
+	if (queue->len == queue->n_items)
+	{
+		queue->n_items *= 2;
+		queue->items = g_renew (DreamSourceCommand, queue->items, queue->n_items);
+	}
+	queue->items[queue->len].type = type;
+	queue->items[queue->len].value = value;
+	if (queue->len++ == 0)
+		eventfd_write (queue->fd, 1);
+	g_mutex_unlock (&queue->lock);
+	return TRUE;
+}
+
+/* takes the oldest command, fd stops being readable with the last one */
+gboolean
+gst_dreamsource_command_queue_pop (CommandQueue *queue, DreamSourceCommand *command)
+{
+	eventfd_t count;
+
+	g_mutex_lock (&queue->lock);
+	if (queue->len == 0)
+	{
+		g_mutex_unlock (&queue->lock);
+		return FALSE;
+	}
+	*command = queue->items[0];
+	memmove (queue->items, queue->items + 1, --queue->len * sizeof (DreamSourceCommand));
+	if (queue->len == 0)
+		eventfd_read (queue->fd, &count);
+	g_mutex_unlock (&queue->lock);
+	return TRUE;
+}
+
+void
+gst_dreamsource_command_queue_clear (CommandQueue *queue)
+{
+	eventfd_t count;
+
+	g_mutex_lock (&queue->lock);
+	if (queue->len)
+		eventfd_read (queue->fd, &count);
+	queue->len = 0;
+	g_mutex_unlock (&queue->lock);
+}
+
+/* for a new read loop, whatever an earlier one left behind is dropped */
+void
+gst_dreamsource_command_queue_open (CommandQueue *queue)
+{
+	gst_dreamsource_command_queue_clear (queue);
+	g_mutex_lock (&queue->lock);
+	queue->closed = FALSE;
+	g_mutex_unlock (&queue->lock);
+}
+
+/* once the read loop stopped, so nothing can be pushed after the last
+ * drain. The commands still pending stay to be popped. */
+void
+gst_dreamsource_command_queue_close (CommandQueue *queue)
+{
+	g_mutex_lock (&queue->lock);
+	queue->closed = TRUE;
+	g_mutex_unlock (&queue->lock);
+}
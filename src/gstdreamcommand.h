@@ -0,0 +1,76 @@
+/*
+ * GStreamer dreamsource command queue
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMCOMMAND_H__
+#define __GST_DREAMCOMMAND_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _CommandQueue CommandQueue;
+typedef struct _DreamSourceCommand DreamSourceCommand;
+
+typedef enum
+{
+	/* read loop state, queued in order */
+	COMMAND_RUN = 0,
+	COMMAND_PAUSE,
+	COMMAND_STOP,
+	/* everything below coalesces with a pending command of the same type */
+	COMMAND_WAKEUP,            /* re-evaluate what the read loop waits for */
+	COMMAND_SET_BITRATE,
+	COMMAND_SET_GOP_LENGTH,
+	COMMAND_SET_GOP_SCENE,
+	COMMAND_SET_OPEN_GOP,
+	COMMAND_SET_BFRAMES,
+	COMMAND_SET_PFRAMES,
+	COMMAND_SET_SLICES,
+	COMMAND_SET_LEVEL,
+	COMMAND_SET_INPUT_MODE,
+	COMMAND_RESTART,           /* stop and start the encoder once no descriptors are pending */
+	COMMAND_FLUSH              /* drop queued buffers and mark the next one discont */
+} DreamSourceCommandType;
+
+struct _DreamSourceCommand {
+	DreamSourceCommandType type;
+	guint32 value;
+};
+
+/* commands for the read loop, which watches fd and runs them between two
+ * encoder reads, so a property change never waits for the driver */
+struct _CommandQueue {
+	GMutex lock;
+	int fd;                    /* eventfd, readable while commands are pending */
+	DreamSourceCommand *items;
+	guint n_items;
+	guint len;
+	gboolean closed;           /* the read loop is gone, pushes are refused */
+};
+
+CommandQueue *gst_dreamsource_command_queue_new (void);
+void gst_dreamsource_command_queue_free (CommandQueue *queue);
+gboolean gst_dreamsource_command_queue_push (CommandQueue *queue, DreamSourceCommandType type, guint32 value);
+gboolean gst_dreamsource_command_queue_pop (CommandQueue *queue, DreamSourceCommand *command);
+void gst_dreamsource_command_queue_clear (CommandQueue *queue);
+void gst_dreamsource_command_queue_open (CommandQueue *queue);
+void gst_dreamsource_command_queue_close (CommandQueue *queue);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMCOMMAND_H__ */
@@ -0,0 +1,310 @@
+/*
+ * GStreamer dreamsource encoder backends
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstdreamsource.h"
+
+GST_DEBUG_CATEGORY (dreamsourceencoder_debug);
+#define GST_CAT_DEFAULT dreamsourceencoder_debug
+
+static gboolean
+device_open (EncoderInfo *enc, EncoderKind kind, const gchar *device)
+{
+	enc->fd = open(device, O_RDWR | O_SYNC);
+	return enc->fd > 0;
+}
+
+static unsigned char *
+device_mmap (EncoderInfo *enc, size_t size)
+{
+	unsigned char *cdb = (unsigned char *)mmap (0, size, PROT_READ, MAP_PRIVATE, enc->fd, 0);
+	if (cdb == MAP_FAILED)
+		return NULL;
+	return cdb;
+}
+
+static int
+device_ioctl (EncoderInfo *enc, unsigned long request, void *arg)
+{
+	return ioctl(enc->fd, request, arg);
+}
+
+static ssize_t
+device_read (EncoderInfo *enc, void *buffer, size_t size)
+{
+	return read(enc->fd, buffer, size);
+}
+
+static int
+device_release (EncoderInfo *enc, unsigned int count)
+{
+	if (write(enc->fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+	return 0;
+}
+
+static int
+device_get_stc (EncoderInfo *enc, uint32_t *stc)
+{
+	return ioctl(enc->fd, ENC_GET_STC, stc);
+}
+
+static void
+device_close (EncoderInfo *enc)
+{
+	if (enc->cdb)
+		munmap(enc->cdb, enc->cdb_size);
+	if (enc->fd > 0)
+		close(enc->fd);
+}
+
+const EncoderBackend gst_dreamsource_device_backend = {
+	"device",
+	device_open,
+	device_mmap,
+	device_ioctl,
+	device_read,
+	device_release,
+	device_get_stc,
+	device_close
+};
+
+EncoderInfo *
+gst_dreamsource_encoder_open (EncoderKind kind, const gchar *device)
+{
+	static gsize debug_initialized = 0;
+	const gchar *backend_name = g_getenv (GST_DREAMSOURCE_BACKEND_ENV);
+	EncoderInfo *enc;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (dreamsourceencoder_debug, "dreamsourceencoder", 0, "dreamsourceencoder");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	enc = g_new0 (EncoderInfo, 1);
+	enc->fd = -1;
+	if (backend_name && !strcmp (backend_name, gst_dreamsource_simulator_backend.name))
+		enc->backend = &gst_dreamsource_simulator_backend;
+	else
+		enc->backend = &gst_dreamsource_device_backend;
+
+	if (!enc->backend->open (enc, kind, device))
+	{
+		GST_ERROR ("%s backend cannot open %s (%s)", enc->backend->name, device, strerror(errno));
+		g_free (enc);
+		return NULL;
+	}
+	GST_INFO ("opened %s with %s backend, fd=%i", device, enc->backend->name, enc->fd);
+	return enc;
+}
+
+unsigned char *
+gst_dreamsource_encoder_mmap (EncoderInfo *enc, size_t size)
+{
+	enc->cdb = enc->backend->mmap (enc, size);
+	if (enc->cdb)
+		enc->cdb_size = size;
+	return enc->cdb;
+}
+
+int
+gst_dreamsource_encoder_ioctl (EncoderInfo *enc, unsigned long request, void *arg)
+{
+	return enc->backend->ioctl (enc, request, arg);
+}
+
+ssize_t
+gst_dreamsource_encoder_read (EncoderInfo *enc, void *buffer, size_t size)
+{
+	return enc->backend->read (enc, buffer, size);
+}
+
+/* gives the oldest count descriptors back to the encoder */
+int
+gst_dreamsource_encoder_release (EncoderInfo *enc, unsigned int count)
+{
+	return enc->backend->release (enc, count);
+}
+
+int
+gst_dreamsource_encoder_get_stc (EncoderInfo *enc, uint32_t *stc)
+{
+	return enc->backend->get_stc (enc, stc);
+}
+
+/* unmaps, closes and frees enc */
+void
+gst_dreamsource_encoder_close (EncoderInfo *enc)
+{
+	enc->backend->close (enc);
+	g_free (enc);
+}
+
+typedef struct
+{
+	EncoderInfo *encoder[2];
+	GstElement *owner[2];
+	guint refcount;
+} EncoderSlot;
+
+static GMutex device_lock;
+static EncoderSlot device_slots[GST_DREAMSOURCE_MAX_DEVICES];
+
+/* the outermost parent of element, transfer full. Every step holds a
+ * reference and reads the parent under its child's object lock, so a bin
+ * being unparented meanwhile can't go away under us. */
+static GstObject *
+device_toplevel (GstElement *element)
+{
+	GstObject *top = gst_object_ref (element);
+	GstObject *parent;
+
+	while ((parent = gst_object_get_parent (top)))
+	{
+		gst_object_unref (top);
+		top = parent;
+	}
+	return top;
+}
+
+/* whether element belongs to the pipeline top, which is held by the caller */
+static gboolean
+device_in_pipeline (GstElement *element, GstObject *top)
+{
+	GstObject *other = device_toplevel (element);
+	gboolean same = other == top;
+
+	gst_object_unref (other);
+	return same;
+}
+
+static EncoderInfo *
+device_open_slot (EncoderKind kind, gint index, GstElement *owner)
+{
+	EncoderSlot *slot = &device_slots[index];
+	EncoderInfo *enc;
+	char fn_buf[32];
+
+	sprintf(fn_buf, kind == ENCODER_KIND_AUDIO ? "/dev/aenc%d" : "/dev/venc%d", index);
+	enc = gst_dreamsource_encoder_open (kind, fn_buf);
+	if (!enc)
+		return NULL;
+	enc->kind = kind;
+	enc->device_index = index;
+	slot->encoder[kind] = enc;
+	slot->owner[kind] = owner;
+	slot->refcount++;
+	GST_INFO_OBJECT (owner, "acquired %s (slot refcount %u)", fn_buf, slot->refcount);
+	return enc;
+}
+
+/* opens the kind encoder of slot index for owner, or with
+ * GST_DREAMSOURCE_DEVICE_INDEX_AUTO the one of the slot whose other encoder
+ * is owned by an element of the same pipeline, else of the first free slot */
+EncoderInfo *
+gst_dreamsource_device_acquire (EncoderKind kind, gint index, GstElement *owner)
+{
+	EncoderKind other = kind == ENCODER_KIND_AUDIO ? ENCODER_KIND_VIDEO : ENCODER_KIND_AUDIO;
+	GstObject *top;
+	EncoderInfo *enc = NULL;
+	gint i;
+
+	g_return_val_if_fail (index < GST_DREAMSOURCE_MAX_DEVICES, NULL);
+
+	top = device_toplevel (owner);
+	g_mutex_lock (&device_lock);
+	if (index != GST_DREAMSOURCE_DEVICE_INDEX_AUTO)
+	{
+		if (device_slots[index].encoder[kind])
+			errno = EBUSY;
+		else
+			enc = device_open_slot (kind, index, owner);
+		goto done;
+	}
+
+	for (i = 0; i < GST_DREAMSOURCE_MAX_DEVICES; i++)
+	{
+		EncoderSlot *slot = &device_slots[i];
+		if (!slot->encoder[kind] && slot->owner[other] && device_in_pipeline (slot->owner[other], top))
+		{
+			enc = device_open_slot (kind, i, owner);
+			goto done;
+		}
+	}
+
+	errno = EBUSY;
+	for (i = 0; i < GST_DREAMSOURCE_MAX_DEVICES && !enc; i++)
+	{
+		if (device_slots[i].refcount == 0)
+			enc = device_open_slot (kind, i, owner);
+	}
+
+done:
+	g_mutex_unlock (&device_lock);
+	gst_object_unref (top);
+	return enc;
+}
+
+/* returns the element owning the other encoder of enc's slot if it runs in
+ * the same pipeline, transfer full */
+GstElement *
+gst_dreamsource_device_get_peer (EncoderInfo *enc)
+{
+	EncoderSlot *slot = &device_slots[enc->device_index];
+	EncoderKind other = enc->kind == ENCODER_KIND_AUDIO ? ENCODER_KIND_VIDEO : ENCODER_KIND_AUDIO;
+	GstElement *peer = NULL;
+	GstObject *top;
+
+	g_mutex_lock (&device_lock);
+	/* referenced before looking at it, it's the caller's from here on */
+	if (slot->owner[other])
+		peer = gst_object_ref (slot->owner[other]);
+	if (peer)
+	{
+		top = device_toplevel (slot->owner[enc->kind]);
+		if (!device_in_pipeline (peer, top))
+		{
+			gst_object_unref (peer);
+			peer = NULL;
+		}
+		gst_object_unref (top);
+	}
+	g_mutex_unlock (&device_lock);
+	return peer;
+}
+
+/* gives enc back to the manager and closes it */
+void
+gst_dreamsource_device_release (EncoderInfo *enc)
+{
+	EncoderSlot *slot = &device_slots[enc->device_index];
+
+	g_mutex_lock (&device_lock);
+	g_assert (slot->encoder[enc->kind] == enc);
+	slot->encoder[enc->kind] = NULL;
+	slot->owner[enc->kind] = NULL;
+	slot->refcount--;
+	GST_DEBUG ("released %s encoder %i (slot refcount %u)", enc->kind == ENCODER_KIND_AUDIO ? "audio" : "video", enc->device_index, slot->refcount);
+	g_mutex_unlock (&device_lock);
+
+	gst_dreamsource_encoder_close (enc);
+}
@@ -0,0 +1,71 @@
+/*
+ * GStreamer dreamsource encoder backends
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMENCODER_H__
+#define __GST_DREAMENCODER_H__
+
+/* included by gstdreamsource.h, which provides EncoderInfo */
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+	ENCODER_KIND_VIDEO = 0,
+	ENCODER_KIND_AUDIO
+} EncoderKind;
+
+/* everything the elements do with an encoder device goes through one of
+ * these, so the read path can run without a Dreambox */
+struct _EncoderBackend {
+	const gchar *name;
+
+	gboolean        (*open)    (EncoderInfo *enc, EncoderKind kind, const gchar *device);
+	unsigned char * (*mmap)    (EncoderInfo *enc, size_t size);
+	int             (*ioctl)   (EncoderInfo *enc, unsigned long request, void *arg);
+	ssize_t         (*read)    (EncoderInfo *enc, void *buffer, size_t size);
+	int             (*release) (EncoderInfo *enc, unsigned int count);
+	int             (*get_stc) (EncoderInfo *enc, uint32_t *stc);
+	void            (*close)   (EncoderInfo *enc);
+};
+
+/* set GST_DREAMSOURCE_BACKEND=simulator to use the synthetic encoder */
+#define GST_DREAMSOURCE_BACKEND_ENV        "GST_DREAMSOURCE_BACKEND"
+
+extern const EncoderBackend gst_dreamsource_device_backend;
+extern const EncoderBackend gst_dreamsource_simulator_backend;
+
+EncoderInfo *gst_dreamsource_encoder_open (EncoderKind kind, const gchar *device);
+unsigned char *gst_dreamsource_encoder_mmap (EncoderInfo *enc, size_t size);
+int gst_dreamsource_encoder_ioctl (EncoderInfo *enc, unsigned long request, void *arg);
+ssize_t gst_dreamsource_encoder_read (EncoderInfo *enc, void *buffer, size_t size);
+int gst_dreamsource_encoder_release (EncoderInfo *enc, unsigned int count);
+int gst_dreamsource_encoder_get_stc (EncoderInfo *enc, uint32_t *stc);
+void gst_dreamsource_encoder_close (EncoderInfo *enc);
+
+/* process-wide device manager: slot N pairs /dev/vencN with /dev/aencN and
+ * every encoder of a slot is owned by at most one element at a time */
+#define GST_DREAMSOURCE_MAX_DEVICES        8
+#define GST_DREAMSOURCE_DEVICE_INDEX_AUTO  -1
+
+EncoderInfo *gst_dreamsource_device_acquire (EncoderKind kind, gint index, GstElement *owner);
+GstElement *gst_dreamsource_device_get_peer (EncoderInfo *enc);
+void gst_dreamsource_device_release (EncoderInfo *enc);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMENCODER_H__ */
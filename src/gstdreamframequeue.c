@@ -0,0 +1,272 @@
+/*
+ * GStreamer dreamsource frame queue
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "gstdreamframequeue.h"
+
+static guint
+gst_dreamsource_frame_queue_ring_size (guint limit)
+{
+	guint size = 1;
+
+	/* one spare slot, so push never fails after dropping down to limit-1 */
+	while (size < limit + 1)
+		size <<= 1;
+	return size;
+}
+
+FrameQueue *
+gst_dreamsource_frame_queue_new (guint limit)
+{
+	FrameQueue *queue = g_new0 (FrameQueue, 1);
+
+	queue->n_items = gst_dreamsource_frame_queue_ring_size (limit);
+	queue->items = g_new0 (GstBuffer *, queue->n_items);
+	queue->stamps = g_new0 (gint64, queue->n_items);
+	queue->limit = limit;
+	queue->wakeup_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return queue;
+}
+
+/* must only be called while neither the producer nor the consumer is running,
+ * queued buffers are dropped */
+void
+gst_dreamsource_frame_queue_set_limit (FrameQueue *queue, guint limit)
+{
+	guint size = gst_dreamsource_frame_queue_ring_size (limit);
+
+	gst_dreamsource_frame_queue_publish (queue);
+	gst_dreamsource_frame_queue_clear (queue);
+	if (size != queue->n_items)
+	{
+		g_free (queue->items);
+		g_free (queue->stamps);
+		queue->items = g_new0 (GstBuffer *, size);
+		queue->stamps = g_new0 (gint64, size);
+		queue->n_items = size;
+		queue->head = queue->tail = 0;
+		queue->staged = 0;
+	}
+	queue->limit = limit;
+}
+
+/* must only be called while neither the producer nor the consumer is running */
+void
+gst_dreamsource_frame_queue_set_notify (FrameQueue *queue, FrameQueueNotify notify, gpointer user_data)
+{
+	queue->notify = notify;
+	queue->notify_data = user_data;
+}
+
+/* producer side, returns TRUE if the queue is full. The producer then stops
+ * pushing until the notify is called from the consumer's next pop. */
+gboolean
+gst_dreamsource_frame_queue_wait_room (FrameQueue *queue)
+{
+	if (!gst_dreamsource_frame_queue_is_full (queue))
+		return FALSE;
+	g_atomic_int_set (&queue->blocked, 1);
+	/* re-check after announcing ourselves, the consumer might have popped in between */
+	if (gst_dreamsource_frame_queue_is_full (queue))
+		return TRUE;
+	g_atomic_int_set (&queue->blocked, 0);
+	return FALSE;
+}
+
+void
+gst_dreamsource_frame_queue_free (FrameQueue *queue)
+{
+	gst_dreamsource_frame_queue_publish (queue);
+	gst_dreamsource_frame_queue_clear (queue);
+	if (queue->wakeup_fd >= 0)
+		close (queue->wakeup_fd);
+	g_free (queue->items);
+	g_free (queue->stamps);
+	g_free (queue);
+}
+
+static void
+gst_dreamsource_frame_queue_wakeup (FrameQueue *queue)
+{
+	eventfd_write (queue->wakeup_fd, 1);
+}
+
+static GstBuffer *
+gst_dreamsource_frame_queue_take_head (FrameQueue *queue, gint64 *read_time)
+{
+	GstBuffer *buffer;
+	gint64 stamp;
+	gint head;
+
+	do {
+		head = g_atomic_int_get (&queue->head);
+		if (head == g_atomic_int_get (&queue->tail))
+			return NULL;
+		buffer = queue->items[(guint) head & (queue->n_items - 1)];
+		stamp = queue->stamps[(guint) head & (queue->n_items - 1)];
+	} while (!g_atomic_int_compare_and_exchange (&queue->head, head, (gint) ((guint) head + 1)));
+
+	if (read_time)
+		*read_time = stamp;
+	return buffer;
+}
+
+/* producer side, the time the following buffers were read from the encoder */
+void
+gst_dreamsource_frame_queue_set_read_time (FrameQueue *queue, gint64 read_time)
+{
+	queue->read_time = read_time;
+}
+
+/* producer side, writes the buffer to the ring without making it visible to
+ * the consumer yet, returns FALSE if the ring is full */
+gboolean
+gst_dreamsource_frame_queue_stage (FrameQueue *queue, GstBuffer *buffer)
+{
+	guint pos = (guint) queue->tail + queue->staged;
+
+	if (pos - (guint) g_atomic_int_get (&queue->head) >= queue->n_items)
+		return FALSE;
+
+	queue->items[pos & (queue->n_items - 1)] = buffer;
+	queue->stamps[pos & (queue->n_items - 1)] = queue->read_time;
+	queue->staged++;
+	return TRUE;
+}
+
+/* producer side, makes all staged buffers visible with a single wakeup */
+void
+gst_dreamsource_frame_queue_publish (FrameQueue *queue)
+{
+	if (!queue->staged)
+		return;
+
+	g_atomic_int_set (&queue->tail, (gint) ((guint) queue->tail + queue->staged));
+	queue->staged = 0;
+
+	if (g_atomic_int_get (&queue->waiting))
+		gst_dreamsource_frame_queue_wakeup (queue);
+}
+
+/* producer side, returns FALSE if the ring is full */
+gboolean
+gst_dreamsource_frame_queue_push (FrameQueue *queue, GstBuffer *buffer)
+{
+	if (!gst_dreamsource_frame_queue_stage (queue, buffer))
+		return FALSE;
+	gst_dreamsource_frame_queue_publish (queue);
+	return TRUE;
+}
+
+/* producer side, removes the oldest buffer to make room for a new one */
+GstBuffer *
+gst_dreamsource_frame_queue_drop_oldest (FrameQueue *queue)
+{
+	GstBuffer *buffer;
+
+	/* a batch larger than the limit overflows into its own staged buffers */
+	if (g_atomic_int_get (&queue->head) == queue->tail)
+		gst_dreamsource_frame_queue_publish (queue);
+
+	buffer = gst_dreamsource_frame_queue_take_head (queue, NULL);
+	if (buffer)
+		g_atomic_int_set (&queue->discont, 1);
+	return buffer;
+}
+
+/* consumer side, blocks until a buffer is available, returns NULL when flushing */
+GstBuffer *
+gst_dreamsource_frame_queue_pop (FrameQueue *queue)
+{
+	return gst_dreamsource_frame_queue_pop_stamped (queue, NULL);
+}
+
+/* like gst_dreamsource_frame_queue_pop (), also returns the buffer's read time */
+GstBuffer *
+gst_dreamsource_frame_queue_pop_stamped (FrameQueue *queue, gint64 *read_time)
+{
+	GstBuffer *buffer;
+
+	while (!(buffer = gst_dreamsource_frame_queue_take_head (queue, read_time)))
+	{
+		eventfd_t value;
+
+		if (g_atomic_int_get (&queue->flushing))
+			return NULL;
+
+		g_atomic_int_set (&queue->waiting, 1);
+		/* re-check after announcing ourselves, the producer might have pushed in between */
+		if (g_atomic_int_get (&queue->head) == g_atomic_int_get (&queue->tail) && !g_atomic_int_get (&queue->flushing))
+		{
+			struct pollfd pfd = { queue->wakeup_fd, POLLIN, 0 };
+			poll (&pfd, 1, -1);
+		}
+		g_atomic_int_set (&queue->waiting, 0);
+		eventfd_read (queue->wakeup_fd, &value);
+	}
+
+	if (g_atomic_int_compare_and_exchange (&queue->discont, 1, 0))
+		GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+	if (g_atomic_int_get (&queue->blocked) && g_atomic_int_compare_and_exchange (&queue->blocked, 1, 0) && queue->notify)
+		queue->notify (queue->notify_data);
+	return buffer;
+}
+
+void
+gst_dreamsource_frame_queue_clear (FrameQueue *queue)
+{
+	GstBuffer *buffer;
+	while ((buffer = gst_dreamsource_frame_queue_take_head (queue, NULL)))
+		gst_buffer_unref (buffer);
+	g_atomic_int_set (&queue->discont, 0);
+	g_atomic_int_set (&queue->blocked, 0);
+}
+
+void
+gst_dreamsource_frame_queue_set_flushing (FrameQueue *queue, gboolean flushing)
+{
+	g_atomic_int_set (&queue->flushing, flushing);
+	if (flushing)
+		gst_dreamsource_frame_queue_wakeup (queue);
+}
+
+gboolean
+gst_dreamsource_frame_queue_is_flushing (FrameQueue *queue)
+{
+	return g_atomic_int_get (&queue->flushing);
+}
+
+guint
+gst_dreamsource_frame_queue_get_length (FrameQueue *queue)
+{
+	return (guint) g_atomic_int_get (&queue->tail) - (guint) g_atomic_int_get (&queue->head);
+}
+
+/* producer side, counts staged buffers as well */
+gboolean
+gst_dreamsource_frame_queue_is_full (FrameQueue *queue)
+{
+	return gst_dreamsource_frame_queue_get_length (queue) + queue->staged >= queue->limit;
+}
@@ -0,0 +1,74 @@
+/*
+ * GStreamer dreamsource frame queue
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMFRAMEQUEUE_H__
+#define __GST_DREAMFRAMEQUEUE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _FrameQueue FrameQueue;
+
+typedef void (*FrameQueueNotify) (gpointer user_data);
+
+/* bounded single-producer/single-consumer ring handing buffers from the
+ * read thread to create(). The producer may drop the oldest buffer on
+ * overflow, so head is advanced with compare-and-swap by both sides. */
+struct _FrameQueue {
+	GstBuffer **items;
+	gint64   *stamps;          /* read time of each queued buffer */
+	guint    n_items;          /* power of two */
+	guint    limit;            /* buffers queued before the oldest one is dropped */
+
+	gint     head;             /* next buffer to pop */
+	gint     tail;             /* next slot to push to, producer only */
+	guint    staged;           /* slots written but not yet published, producer only */
+
+	gint     flushing;
+	gint     waiting;          /* consumer sleeps on wakeup_fd */
+	gint     discont;          /* buffers were dropped, flag the next one popped */
+	int      wakeup_fd;        /* eventfd */
+	gint64   read_time;        /* stamped onto staged buffers, producer only */
+
+	gint     blocked;          /* the producer waits for room */
+	FrameQueueNotify notify;   /* called from the consumer once there is room again */
+	gpointer notify_data;
+};
+
+FrameQueue *gst_dreamsource_frame_queue_new (guint limit);
+void gst_dreamsource_frame_queue_free (FrameQueue *queue);
+void gst_dreamsource_frame_queue_set_limit (FrameQueue *queue, guint limit);
+void gst_dreamsource_frame_queue_set_notify (FrameQueue *queue, FrameQueueNotify notify, gpointer user_data);
+gboolean gst_dreamsource_frame_queue_wait_room (FrameQueue *queue);
+gboolean gst_dreamsource_frame_queue_push (FrameQueue *queue, GstBuffer *buffer);
+gboolean gst_dreamsource_frame_queue_stage (FrameQueue *queue, GstBuffer *buffer);
+void gst_dreamsource_frame_queue_publish (FrameQueue *queue);
+GstBuffer *gst_dreamsource_frame_queue_pop (FrameQueue *queue);
+GstBuffer *gst_dreamsource_frame_queue_pop_stamped (FrameQueue *queue, gint64 *read_time);
+void gst_dreamsource_frame_queue_set_read_time (FrameQueue *queue, gint64 read_time);
+GstBuffer *gst_dreamsource_frame_queue_drop_oldest (FrameQueue *queue);
+void gst_dreamsource_frame_queue_clear (FrameQueue *queue);
+void gst_dreamsource_frame_queue_set_flushing (FrameQueue *queue, gboolean flushing);
+gboolean gst_dreamsource_frame_queue_is_flushing (FrameQueue *queue);
+guint gst_dreamsource_frame_queue_get_length (FrameQueue *queue);
+gboolean gst_dreamsource_frame_queue_is_full (FrameQueue *queue);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMFRAMEQUEUE_H__ */
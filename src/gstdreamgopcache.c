@@ -0,0 +1,153 @@
+/*
+ * GStreamer dreamsource GOP cache
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstdreamgopcache.h"
+
+void
+gst_dreamsource_gop_cache_init (GopCache *cache, gboolean rolling)
+{
+	g_mutex_init (&cache->lock);
+	g_queue_init (&cache->buffers);
+	cache->bytes = 0;
+	cache->limit = 0;
+	cache->descriptors = 0;
+	cache->max_descriptors = 0;
+	cache->copy = FALSE;
+	cache->rolling = rolling;
+	cache->valid = FALSE;
+	cache->last_delta = TRUE;
+}
+
+void
+gst_dreamsource_gop_cache_clear (GopCache *cache)
+{
+	gst_dreamsource_gop_cache_flush (cache);
+	g_mutex_clear (&cache->lock);
+}
+
+static void
+gop_cache_flush_unlocked (GopCache *cache)
+{
+	GstBuffer *buffer;
+
+	while ((buffer = g_queue_pop_head (&cache->buffers)))
+		gst_buffer_unref (buffer);
+	cache->bytes = 0;
+	cache->descriptors = 0;
+	cache->valid = FALSE;
+	cache->last_delta = TRUE;
+}
+
+/* only while the read loop doesn't run. max_descriptors bounds the encoder
+ * descriptors the cache pins when it references the ring (copy = FALSE),
+ * with alignment=au one buffer holds several of them */
+void
+gst_dreamsource_gop_cache_configure (GopCache *cache, gsize limit, guint max_descriptors, gboolean copy)
+{
+	g_mutex_lock (&cache->lock);
+	gop_cache_flush_unlocked (cache);
+	cache->limit = limit;
+	cache->max_descriptors = max_descriptors;
+	cache->copy = copy;
+	g_mutex_unlock (&cache->lock);
+}
+
+void
+gst_dreamsource_gop_cache_flush (GopCache *cache)
+{
+	g_mutex_lock (&cache->lock);
+	gop_cache_flush_unlocked (cache);
+	g_mutex_unlock (&cache->lock);
+}
+
+/* a keyframe following a delta unit starts a new GOP. A GOP exceeding the
+ * limits isn't cached at all, half of one is no use to a decoder. */
+void
+gst_dreamsource_gop_cache_push (GopCache *cache, GstBuffer *buffer)
+{
+	gboolean delta = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+	gsize size = gst_buffer_get_size (buffer);
+	guint descriptors = gst_buffer_n_memory (buffer);
+	GstBuffer *old;
+
+	g_mutex_lock (&cache->lock);
+	if (cache->rolling)
+	{
+		while ((cache->bytes + size > cache->limit || (cache->max_descriptors && cache->descriptors + descriptors > cache->max_descriptors))
+			&& (old = g_queue_pop_head (&cache->buffers)))
+		{
+			cache->bytes -= gst_buffer_get_size (old);
+			cache->descriptors -= gst_buffer_n_memory (old);
+			gst_buffer_unref (old);
+		}
+		cache->valid = size <= cache->limit;
+	}
+	else
+	{
+		if (!delta && cache->last_delta)
+		{
+			gop_cache_flush_unlocked (cache);
+			cache->valid = TRUE;
+		}
+		cache->last_delta = delta;
+		if (cache->valid && (cache->bytes + size > cache->limit || (cache->max_descriptors && cache->descriptors + descriptors > cache->max_descriptors)))
+		{
+			GST_DEBUG ("GOP exceeds the cache limits, not caching it");
+			gop_cache_flush_unlocked (cache);
+			cache->last_delta = delta;
+		}
+	}
+	if (cache->valid)
+	{
+		g_queue_push_tail (&cache->buffers, cache->copy ? gst_buffer_copy_deep (buffer) : gst_buffer_ref (buffer));
+		cache->bytes += size;
+		cache->descriptors += descriptors;
+	}
+	g_mutex_unlock (&cache->lock);
+}
+
+/* the cached buffers with a PTS from since on (all for GST_CLOCK_TIME_NONE),
+ * the first one flagged discont. Empty while no complete GOP start is cached. */
+GstBufferList *
+gst_dreamsource_gop_cache_get (GopCache *cache, GstClockTime since)
+{
+	GstBufferList *list = gst_buffer_list_new ();
+	GList *l;
+
+	g_mutex_lock (&cache->lock);
+	for (l = cache->valid ? cache->buffers.head : NULL; l; l = l->next)
+	{
+		GstBuffer *buffer = l->data;
+		if (GST_CLOCK_TIME_IS_VALID (since) && GST_BUFFER_PTS_IS_VALID (buffer) && GST_BUFFER_PTS (buffer) < since)
+			continue;
+		if (gst_buffer_list_length (list) == 0)
+		{
+			buffer = gst_buffer_copy (buffer);
+			GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+			gst_buffer_list_add (list, buffer);
+		}
+		else
+			gst_buffer_list_add (list, gst_buffer_ref (buffer));
+	}
+	g_mutex_unlock (&cache->lock);
+	return list;
+}
@@ -0,0 +1,53 @@
+/*
+ * GStreamer dreamsource GOP cache
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMGOPCACHE_H__
+#define __GST_DREAMGOPCACHE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GopCache GopCache;
+
+/* the buffers since the last keyframe, handed to consumers attaching to a
+ * running source so they can start decoding right away. Filled by the read
+ * loop, read by whoever emits "get-gop-cache". */
+struct _GopCache {
+	GMutex lock;
+	GQueue buffers;
+	gsize bytes;
+	gsize limit;               /* bytes, 0 = disabled */
+	guint descriptors;         /* memories of the cached buffers, each wraps one encoder descriptor */
+	guint max_descriptors;     /* 0 = unbounded */
+	gboolean copy;             /* buffer memory may be reused by the encoder while referenced, keep copies */
+	gboolean rolling;          /* no keyframes (audio): drop the oldest buffers instead of starting over */
+	gboolean valid;            /* starts with a keyframe */
+	gboolean last_delta;
+};
+
+void gst_dreamsource_gop_cache_init (GopCache *cache, gboolean rolling);
+void gst_dreamsource_gop_cache_clear (GopCache *cache);
+void gst_dreamsource_gop_cache_configure (GopCache *cache, gsize limit, guint max_descriptors, gboolean copy);
+void gst_dreamsource_gop_cache_flush (GopCache *cache);
+void gst_dreamsource_gop_cache_push (GopCache *cache, GstBuffer *buffer);
+GstBufferList *gst_dreamsource_gop_cache_get (GopCache *cache, GstClockTime since);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMGOPCACHE_H__ */
@@ -0,0 +1,415 @@
+/*
+ * GStreamer dreamsource h.264 helpers
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstdreamh264.h"
+
+#define H264_ONES              ((gsize) -1 / 0xff)
+#define H264_HIGHS             (H264_ONES * 0x80)
+
+typedef struct {
+	GstMapInfo map[GST_BUFFER_MEM_MAX];
+	gsize offset[GST_BUFFER_MEM_MAX + 1];
+	guint n_mem;
+} H264Scanner;
+
+typedef struct {
+	gsize start;
+	gsize size;
+} H264Nal;
+
+/* offset of the first 00 00 01 in data, or size if there is none. Looks at
+ * a machine word at a time and only falls back to bytes for words that
+ * contain a zero byte, which in coded slice data is rare */
+gsize
+gst_dreamsource_h264_find_start_code (const guint8 *data, gsize size)
+{
+	gsize i = 0, end;
+	gsize v;
+
+	while (i + 3 <= size)
+	{
+		if (i + sizeof (gsize) <= size)
+		{
+			memcpy (&v, data + i, sizeof (gsize));
+			if (!((v - H264_ONES) & ~v & H264_HIGHS))
+			{
+				i += sizeof (gsize);
+				continue;
+			}
+		}
+		end = MIN (i + sizeof (gsize), size - 2);
+		for (; i < end; i++)
+			if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1)
+				return i;
+	}
+	return size;
+}
+
+static gboolean
+h264_scanner_init (H264Scanner *s, GstBuffer *buffer)
+{
+	guint i;
+
+	s->n_mem = gst_buffer_n_memory (buffer);
+	s->offset[0] = 0;
+	for (i = 0; i < s->n_mem; i++)
+	{
+		if (!gst_memory_map (gst_buffer_peek_memory (buffer, i), &s->map[i], GST_MAP_READ))
+		{
+			while (i--)
+				gst_memory_unmap (s->map[i].memory, &s->map[i]);
+			return FALSE;
+		}
+		s->offset[i+1] = s->offset[i] + s->map[i].size;
+	}
+	return TRUE;
+}
+
+static void
+h264_scanner_clear (H264Scanner *s)
+{
+	guint i;
+
+	for (i = 0; i < s->n_mem; i++)
+		gst_memory_unmap (s->map[i].memory, &s->map[i]);
+}
+
+static guint8
+h264_scanner_byte (H264Scanner *s, gsize pos)
+{
+	guint i;
+
+	for (i = 0; i < s->n_mem; i++)
+		if (pos < s->offset[i+1])
+			return s->map[i].data[pos - s->offset[i]];
+	return 0xff;
+}
+
+/* number of memories the bytes from start to end are spread over */
+static guint
+h264_scanner_span (H264Scanner *s, gsize start, gsize end)
+{
+	guint i, n = 0;
+
+	for (i = 0; i < s->n_mem; i++)
+		if (s->offset[i] < end && s->offset[i+1] > start)
+			n++;
+	return n;
+}
+
+/* like find_start_code over all memories of the buffer, including start
+ * codes split between two of them */
+static gsize
+h264_scanner_next (H264Scanner *s, gsize from)
+{
+	gsize total = s->offset[s->n_mem];
+	gsize local, found, j;
+	guint i;
+
+	for (i = 0; i < s->n_mem; i++)
+	{
+		if (from >= s->offset[i+1])
+			continue;
+		local = from > s->offset[i] ? from - s->offset[i] : 0;
+		found = gst_dreamsource_h264_find_start_code (s->map[i].data + local, s->map[i].size - local);
+		if (found < s->map[i].size - local)
+			return s->offset[i] + local + found;
+		for (j = MAX (s->offset[i] + local, s->offset[i+1] >= 2 ? s->offset[i+1] - 2 : 0); j < s->offset[i+1] && j + 3 <= total; j++)
+			if (h264_scanner_byte (s, j) == 0 && h264_scanner_byte (s, j+1) == 0 && h264_scanner_byte (s, j+2) == 1)
+				return j;
+	}
+	return total;
+}
+
+static gboolean
+h264_headers_store (GBytes **stored, const guint8 *data, gsize size)
+{
+	gsize len;
+
+	if (*stored)
+	{
+		const guint8 *old = g_bytes_get_data (*stored, &len);
+		if (len == size && memcmp (old, data, size) == 0)
+			return FALSE;
+		g_bytes_unref (*stored);
+	}
+	*stored = g_bytes_new (data, size);
+	return TRUE;
+}
+
+static gboolean
+h264_headers_update (GBytes **stored, GstBuffer *au, gsize start, gsize size)
+{
+	gpointer data;
+	gsize len;
+	gboolean changed;
+
+	gst_buffer_extract_dup (au, start, size, &data, &len);
+	changed = h264_headers_store (stored, data, len);
+	g_free (data);
+	return changed;
+}
+
+/* AVCDecoderConfigurationRecord with 4 byte NAL lengths */
+static GstBuffer *
+h264_headers_to_codec_data (H264Headers *headers)
+{
+	gsize sps_len, pps_len;
+	const guint8 *sps = g_bytes_get_data (headers->sps, &sps_len);
+	const guint8 *pps = g_bytes_get_data (headers->pps, &pps_len);
+	guint8 *data, *p;
+
+	if (sps_len < 4)
+		return NULL;
+	p = data = g_malloc (11 + sps_len + pps_len);
+	*p++ = 1;
+	*p++ = sps[1];  /* profile_idc */
+	*p++ = sps[2];  /* constraint flags */
+	*p++ = sps[3];  /* level_idc */
+	*p++ = 0xff;    /* lengthSizeMinusOne = 3 */
+	*p++ = 0xe1;    /* one SPS */
+	GST_WRITE_UINT16_BE (p, sps_len);
+	memcpy (p + 2, sps, sps_len);
+	p += 2 + sps_len;
+	*p++ = 1;       /* one PPS */
+	GST_WRITE_UINT16_BE (p, pps_len);
+	memcpy (p + 2, pps, pps_len);
+	return gst_buffer_new_wrapped (data, 11 + sps_len + pps_len);
+}
+
+static GQuark
+h264_codec_data_quark (void)
+{
+	static GQuark quark = 0;
+
+	if (!quark)
+		quark = g_quark_from_static_string ("GstDreamSourceCodecData");
+	return quark;
+}
+
+void
+gst_dreamsource_h264_headers_clear (H264Headers *headers)
+{
+	if (headers->sps)
+		g_bytes_unref (headers->sps);
+	if (headers->pps)
+		g_bytes_unref (headers->pps);
+	headers->sps = headers->pps = NULL;
+}
+
+/* stores the SPS and PPS of an Annex B chunk, stopping at the first slice
+ * so a keyframe costs no more than its first few bytes */
+guint
+gst_dreamsource_h264_headers_scan (H264Headers *headers, const guint8 *data, gsize size, gboolean *changed)
+{
+	gsize pos, next, start, end;
+	guint seen = 0;
+
+	for (pos = gst_dreamsource_h264_find_start_code (data, size); pos < size; pos = next)
+	{
+		start = pos + 3;
+		next = start + gst_dreamsource_h264_find_start_code (data + start, size - start);
+		for (end = next; end > start && data[end-1] == 0; end--);
+		if (end == start)
+			continue;
+
+		switch (data[start] & 0x1f) {
+			case H264_NAL_SPS:
+				seen |= H264_HEADERS_SPS;
+				*changed |= h264_headers_store (&headers->sps, data + start, end - start);
+				break;
+			case H264_NAL_PPS:
+				seen |= H264_HEADERS_PPS;
+				*changed |= h264_headers_store (&headers->pps, data + start, end - start);
+				break;
+			case 1: case 2: case 3: case 4: case 5:
+				return seen | H264_HEADERS_SLICE;
+		}
+	}
+	return seen;
+}
+
+/* nal_ref_idc of the first slice of an Annex B chunk, -1 if it holds none.
+ * 0 means no other picture refers to it, so it can be dropped on its own. */
+gint
+gst_dreamsource_h264_slice_ref_idc (const guint8 *data, gsize size)
+{
+	gsize pos, start;
+
+	for (pos = gst_dreamsource_h264_find_start_code (data, size); pos < size; pos = start + gst_dreamsource_h264_find_start_code (data + start, size - start))
+	{
+		start = pos + 3;
+		if (start < size && (data[start] & 0x1f) >= 1 && (data[start] & 0x1f) <= 5)
+			return (data[start] >> 5) & 0x3;
+	}
+	return -1;
+}
+
+/* bytes of the access unit delimiter an Annex B chunk starts with, up to the
+ * NAL unit after it (including its zero_byte), 0 if it doesn't start with one */
+gsize
+gst_dreamsource_h264_aud_size (const guint8 *data, gsize size)
+{
+	gsize start = gst_dreamsource_h264_find_start_code (data, size), next;
+
+	if (start > 1 || start + 3 >= size || (data[start + 3] & 0x1f) != H264_NAL_AUD)
+		return 0;
+	start += 4;
+	next = start + gst_dreamsource_h264_find_start_code (data + start, size - start);
+	if (next < size && data[next - 1] == 0)
+		next--;
+	return next;
+}
+
+/* SPS and PPS with start codes, to be shared by every buffer they're put in front of */
+GstMemory *
+gst_dreamsource_h264_headers_to_memory (H264Headers *headers)
+{
+	gsize sps_len, pps_len, size;
+	const guint8 *sps, *pps;
+	guint8 *data;
+
+	if (!headers->sps || !headers->pps)
+		return NULL;
+	sps = g_bytes_get_data (headers->sps, &sps_len);
+	pps = g_bytes_get_data (headers->pps, &pps_len);
+	size = 8 + sps_len + pps_len;
+	data = g_malloc (size);
+	GST_WRITE_UINT32_BE (data, 1);
+	memcpy (data + 4, sps, sps_len);
+	GST_WRITE_UINT32_BE (data + 4 + sps_len, 1);
+	memcpy (data + 8 + sps_len, pps, pps_len);
+	return gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY, data, size, 0, size, data, g_free);
+}
+
+/* converts an Annex B access unit to length prefixed NAL units. As long as
+ * it fits into GST_BUFFER_MEM_MAX memories, the payload isn't copied: every
+ * NAL unit is a share of one memory holding all length prefixes followed by
+ * shares of the original memories. Beyond that gst_buffer_append_memory ()
+ * would merge them anyway, so the whole access unit is copied into a single
+ * memory instead. Takes au, returns NULL if there is nothing to output. When
+ * the SPS or PPS changed, the new codec_data is attached to the result, see
+ * gst_dreamsource_h264_get_codec_data () */
+GstBuffer *
+gst_dreamsource_h264_to_avc (GstBuffer *au, H264Headers *headers)
+{
+	H264Scanner s;
+	GstBuffer *out = NULL;
+	GArray *nals;
+	GstMemory *mem;
+	GstMapInfo map;
+	gsize pos, next, start, end, total, size = 0;
+	guint i, n_mem = 0;
+	gboolean changed = FALSE;
+
+	if (!h264_scanner_init (&s, au))
+	{
+		gst_buffer_unref (au);
+		return NULL;
+	}
+	total = s.offset[s.n_mem];
+	nals = g_array_new (FALSE, FALSE, sizeof (H264Nal));
+
+	for (pos = h264_scanner_next (&s, 0); pos < total; pos = next)
+	{
+		start = pos + 3;
+		next = h264_scanner_next (&s, start);
+		/* trailing zero bytes belong to the next start code */
+		for (end = next; end > start && h264_scanner_byte (&s, end - 1) == 0; end--);
+		if (end == start)
+			continue;
+
+		switch (h264_scanner_byte (&s, start) & 0x1f) {
+			case H264_NAL_SPS:
+				changed |= h264_headers_update (&headers->sps, au, start, end - start);
+				break;
+			case H264_NAL_PPS:
+				changed |= h264_headers_update (&headers->pps, au, start, end - start);
+				break;
+		}
+
+		H264Nal nal = { start, end - start };
+		g_array_append_val (nals, nal);
+		n_mem += 1 + h264_scanner_span (&s, start, end);
+		size += 4 + nal.size;
+	}
+
+	if (nals->len && n_mem <= GST_BUFFER_MEM_MAX)
+	{
+		/* all prefixes are written before the first share of them is handed out */
+		mem = gst_allocator_alloc (NULL, 4 * nals->len, NULL);
+		gst_memory_map (mem, &map, GST_MAP_WRITE);
+		for (i = 0; i < nals->len; i++)
+			GST_WRITE_UINT32_BE (map.data + 4 * i, g_array_index (nals, H264Nal, i).size);
+		gst_memory_unmap (mem, &map);
+
+		out = gst_buffer_new ();
+		gst_buffer_copy_into (out, au, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META, 0, -1);
+		for (i = 0; i < nals->len; i++)
+		{
+			H264Nal *nal = &g_array_index (nals, H264Nal, i);
+			gst_buffer_append_memory (out, gst_memory_share (mem, 4 * i, 4));
+			out = gst_buffer_append (out, gst_buffer_copy_region (au, GST_BUFFER_COPY_MEMORY, nal->start, nal->size));
+		}
+		gst_memory_unref (mem);
+	}
+	else if (nals->len)
+	{
+		mem = gst_allocator_alloc (NULL, size, NULL);
+		gst_memory_map (mem, &map, GST_MAP_WRITE);
+		for (pos = 0, i = 0; i < nals->len; i++)
+		{
+			H264Nal *nal = &g_array_index (nals, H264Nal, i);
+			GST_WRITE_UINT32_BE (map.data + pos, nal->size);
+			gst_buffer_extract (au, nal->start, map.data + pos + 4, nal->size);
+			pos += 4 + nal->size;
+		}
+		gst_memory_unmap (mem, &map);
+
+		out = gst_buffer_new ();
+		gst_buffer_copy_into (out, au, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META, 0, -1);
+		gst_buffer_append_memory (out, mem);
+	}
+
+	g_array_free (nals, TRUE);
+	h264_scanner_clear (&s);
+	gst_buffer_unref (au);
+
+	if (!out)
+		return NULL;
+	if (changed && headers->sps && headers->pps)
+	{
+		GstBuffer *codec_data = h264_headers_to_codec_data (headers);
+		if (codec_data)
+			gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (out), h264_codec_data_quark (), codec_data, (GDestroyNotify) gst_buffer_unref);
+	}
+	return out;
+}
+
+/* the codec_data which is valid from buffer on, or NULL if it didn't change */
+GstBuffer *
+gst_dreamsource_h264_get_codec_data (GstBuffer *buffer)
+{
+	return gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer), h264_codec_data_quark ());
+}
@@ -0,0 +1,54 @@
+/*
+ * GStreamer dreamsource h.264 helpers
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMH264_H__
+#define __GST_DREAMH264_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _H264Headers H264Headers;
+
+#define H264_NAL_SPS           7
+#define H264_NAL_PPS           8
+#define H264_NAL_AUD           9
+
+/* what gst_dreamsource_h264_headers_scan () came across */
+#define H264_HEADERS_SPS       (1 << 0)
+#define H264_HEADERS_PPS       (1 << 1)
+#define H264_HEADERS_SLICE     (1 << 2)
+
+/* parameter sets seen last, codec_data is rebuilt whenever one changes */
+struct _H264Headers {
+	GBytes *sps;
+	GBytes *pps;
+};
+
+gsize gst_dreamsource_h264_find_start_code (const guint8 *data, gsize size);
+void gst_dreamsource_h264_headers_clear (H264Headers *headers);
+guint gst_dreamsource_h264_headers_scan (H264Headers *headers, const guint8 *data, gsize size, gboolean *changed);
+gint gst_dreamsource_h264_slice_ref_idc (const guint8 *data, gsize size);
+gsize gst_dreamsource_h264_aud_size (const guint8 *data, gsize size);
+GstMemory *gst_dreamsource_h264_headers_to_memory (H264Headers *headers);
+GstBuffer *gst_dreamsource_h264_to_avc (GstBuffer *au, H264Headers *headers);
+GstBuffer *gst_dreamsource_h264_get_codec_data (GstBuffer *buffer);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMH264_H__ */
@@ -0,0 +1,321 @@
+/*
+ * GStreamer dreamsource reactor
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "gstdreamreactor.h"
+
+GST_DEBUG_CATEGORY_STATIC (dreamsourcereactor_debug);
+#define GST_CAT_DEFAULT dreamsourcereactor_debug
+
+/* epoll data of the reactor's own eventfd, sources use (id << 1) | encoder */
+#define REACTOR_WAKEUP_ID  G_MAXUINT64
+
+struct _DreamSourceReactorSource {
+	guint64 id;
+	DreamSourceReactorFunc func;
+	gpointer user_data;
+
+	int control_fd;
+	int encoder_fd;            /* registered encoder fd or -1 */
+	gint64 deadline;           /* monotonic time the handler times out at, -1 for never */
+	guint events;              /* collected for the next dispatch */
+	gboolean dispatching;      /* handler runs, its fds are disarmed */
+	gboolean removed;
+};
+
+struct _DreamSourceReactor {
+	gint refcount;
+	int epoll_fd;
+	int wakeup_fd;
+	GThread *thread;
+	GThreadPool *workers;
+
+	GMutex lock;
+	GCond cond;                /* signalled whenever a dispatch finished */
+	GHashTable *sources;       /* id -> DreamSourceReactorSource */
+	guint64 next_id;
+	gboolean quit;
+};
+
+static DreamSourceReactor *reactor_instance = NULL;
+G_LOCK_DEFINE_STATIC (reactor_instance);
+
+static void
+reactor_wakeup (DreamSourceReactor *reactor)
+{
+	eventfd_write (reactor->wakeup_fd, 1);
+}
+
+/* (re)arms fd for one event, a registered fd other than fd is removed first.
+ * Called with the lock held. */
+static int
+reactor_arm (DreamSourceReactor *reactor, guint64 data, int old_fd, int fd, guint32 events)
+{
+	struct epoll_event ev;
+
+	if (old_fd >= 0 && old_fd != fd)
+		epoll_ctl (reactor->epoll_fd, EPOLL_CTL_DEL, old_fd, NULL);
+	if (fd < 0)
+		return -1;
+
+	ev.events = events | EPOLLONESHOT;
+	ev.data.u64 = data;
+	if (epoll_ctl (reactor->epoll_fd, old_fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		GST_WARNING ("cannot watch fd %i: %s", fd, g_strerror (errno));
+		return -1;
+	}
+	return fd;
+}
+
+/* runs the handler of a source that was marked dispatching by the reactor
+ * thread, either inline or on a worker, and arms it again */
+static void
+reactor_dispatch (DreamSourceReactorSource *source, DreamSourceReactor *reactor)
+{
+	guint events = source->events;
+	gboolean running;
+	int fd = -1, timeout = -1;
+	gint64 deadline;
+
+	while ((running = source->func (source->user_data, events, &fd, &timeout)) && timeout == 0)
+	{
+		struct pollfd pfd = { source->control_fd, POLLIN | POLLPRI, 0 };
+		events = poll (&pfd, 1, 0) > 0 ? GST_DREAMSOURCE_REACTOR_CONTROL : 0;
+	}
+
+	g_mutex_lock (&reactor->lock);
+	if (!running)
+		fd = -1;
+	source->events = 0;
+	deadline = source->deadline = (running && timeout > 0) ? g_get_monotonic_time () + timeout * G_GINT64_CONSTANT (1000) : -1;
+	if (!source->removed)
+	{
+		reactor_arm (reactor, source->id << 1, source->control_fd, running ? source->control_fd : -1, EPOLLIN | EPOLLPRI);
+		source->encoder_fd = reactor_arm (reactor, (source->id << 1) | 1, source->encoder_fd, fd, EPOLLIN);
+	}
+	source->dispatching = FALSE;
+	g_cond_broadcast (&reactor->cond);
+	g_mutex_unlock (&reactor->lock);
+
+	/* a new deadline has to be picked up by epoll_wait(), source may be
+	 * freed by gst_dreamsource_reactor_remove () once it isn't dispatching */
+	if (g_thread_self () != reactor->thread && deadline >= 0)
+		reactor_wakeup (reactor);
+}
+
+static void
+reactor_worker_func (gpointer data, gpointer user_data)
+{
+	reactor_dispatch ((DreamSourceReactorSource *) data, (DreamSourceReactor *) user_data);
+}
+
+static gpointer
+reactor_thread_func (DreamSourceReactor *reactor)
+{
+	struct epoll_event events[16];
+	GHashTableIter iter;
+	gpointer value;
+
+	while (TRUE)
+	{
+		DreamSourceReactorSource *source;
+		GSList *ready = NULL, *l;
+		gint64 now, next = -1;
+		int i, n, timeout = -1;
+
+		g_mutex_lock (&reactor->lock);
+		if (reactor->quit)
+		{
+			g_mutex_unlock (&reactor->lock);
+			break;
+		}
+		g_hash_table_iter_init (&iter, reactor->sources);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+		{
+			source = value;
+			if (!source->dispatching && source->deadline >= 0 && (next < 0 || source->deadline < next))
+				next = source->deadline;
+		}
+		g_mutex_unlock (&reactor->lock);
+
+		if (next >= 0)
+			timeout = MAX (0, (next - g_get_monotonic_time () + 999) / 1000);
+		n = epoll_wait (reactor->epoll_fd, events, G_N_ELEMENTS (events), timeout);
+		if (n < 0 && errno != EINTR)
+		{
+			GST_ERROR ("epoll_wait failed: %s", g_strerror (errno));
+			break;
+		}
+
+		now = g_get_monotonic_time ();
+		g_mutex_lock (&reactor->lock);
+		for (i = 0; i < n; i++)
+		{
+			eventfd_t count;
+			if (events[i].data.u64 == REACTOR_WAKEUP_ID)
+			{
+				eventfd_read (reactor->wakeup_fd, &count);
+				continue;
+			}
+			/* removed sources just aren't found anymore */
+			source = g_hash_table_lookup (reactor->sources, &(guint64) { events[i].data.u64 >> 1 });
+			if (source && !source->dispatching)
+				source->events |= (events[i].data.u64 & 1) ? GST_DREAMSOURCE_REACTOR_ENCODER : GST_DREAMSOURCE_REACTOR_CONTROL;
+		}
+		g_hash_table_iter_init (&iter, reactor->sources);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+		{
+			source = value;
+			if (source->dispatching || source->removed)
+				continue;
+			if (source->events || (source->deadline >= 0 && now >= source->deadline))
+			{
+				source->dispatching = TRUE;
+				ready = g_slist_prepend (ready, source);
+			}
+		}
+		g_mutex_unlock (&reactor->lock);
+
+		for (l = ready; l; l = l->next)
+		{
+			if (reactor->workers)
+				g_thread_pool_push (reactor->workers, l->data, NULL);
+			else
+				reactor_dispatch (l->data, reactor);
+		}
+		g_slist_free (ready);
+	}
+	return NULL;
+}
+
+/* returns the process-wide reactor, starting it on first use */
+DreamSourceReactor *
+gst_dreamsource_reactor_get (void)
+{
+	static gsize debug_initialized = 0;
+	DreamSourceReactor *reactor;
+
+	if (g_once_init_enter (&debug_initialized))
+	{
+		GST_DEBUG_CATEGORY_INIT (dreamsourcereactor_debug, "dreamsourcereactor", 0, "dreamsourcereactor");
+		g_once_init_leave (&debug_initialized, 1);
+	}
+
+	G_LOCK (reactor_instance);
+	reactor = reactor_instance;
+	if (!reactor)
+	{
+		const gchar *workers = g_getenv (GST_DREAMSOURCE_REACTOR_WORKERS_ENV);
+		struct epoll_event ev;
+
+		reactor = g_new0 (DreamSourceReactor, 1);
+		reactor->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+		reactor->wakeup_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+		ev.events = EPOLLIN;
+		ev.data.u64 = REACTOR_WAKEUP_ID;
+		epoll_ctl (reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wakeup_fd, &ev);
+		g_mutex_init (&reactor->lock);
+		g_cond_init (&reactor->cond);
+		reactor->sources = g_hash_table_new (g_int64_hash, g_int64_equal);
+		if (workers && atoi (workers) > 0)
+			reactor->workers = g_thread_pool_new (reactor_worker_func, reactor, atoi (workers), TRUE, NULL);
+		reactor->thread = g_thread_new ("dreamsrc-reactor", (GThreadFunc) reactor_thread_func, reactor);
+		GST_INFO ("started reactor with %i workers", reactor->workers ? atoi (workers) : 0);
+		reactor_instance = reactor;
+	}
+	reactor->refcount++;
+	G_UNLOCK (reactor_instance);
+	return reactor;
+}
+
+/* stops the reactor when the last user is gone, all sources must have been
+ * removed */
+void
+gst_dreamsource_reactor_unref (DreamSourceReactor *reactor)
+{
+	G_LOCK (reactor_instance);
+	if (--reactor->refcount > 0)
+	{
+		G_UNLOCK (reactor_instance);
+		return;
+	}
+	reactor_instance = NULL;
+	G_UNLOCK (reactor_instance);
+
+	g_mutex_lock (&reactor->lock);
+	reactor->quit = TRUE;
+	g_mutex_unlock (&reactor->lock);
+	reactor_wakeup (reactor);
+	g_thread_join (reactor->thread);
+	if (reactor->workers)
+		g_thread_pool_free (reactor->workers, FALSE, TRUE);
+	g_hash_table_destroy (reactor->sources);
+	g_cond_clear (&reactor->cond);
+	g_mutex_clear (&reactor->lock);
+	close (reactor->wakeup_fd);
+	close (reactor->epoll_fd);
+	g_free (reactor);
+	GST_INFO ("stopped reactor");
+}
+
+/* func is first called once control_fd becomes readable */
+DreamSourceReactorSource *
+gst_dreamsource_reactor_add (DreamSourceReactor *reactor, int control_fd, DreamSourceReactorFunc func, gpointer user_data)
+{
+	DreamSourceReactorSource *source = g_new0 (DreamSourceReactorSource, 1);
+
+	source->func = func;
+	source->user_data = user_data;
+	source->control_fd = control_fd;
+	source->encoder_fd = -1;
+	source->deadline = -1;
+
+	g_mutex_lock (&reactor->lock);
+	source->id = reactor->next_id++;
+	g_hash_table_insert (reactor->sources, &source->id, source);
+	reactor_arm (reactor, source->id << 1, -1, control_fd, EPOLLIN | EPOLLPRI);
+	g_mutex_unlock (&reactor->lock);
+	return source;
+}
+
+/* waits for a running handler to return, func is not called anymore
+ * afterwards and source is freed */
+void
+gst_dreamsource_reactor_remove (DreamSourceReactor *reactor, DreamSourceReactorSource *source)
+{
+	g_mutex_lock (&reactor->lock);
+	source->removed = TRUE;
+	while (source->dispatching)
+		g_cond_wait (&reactor->cond, &reactor->lock);
+	epoll_ctl (reactor->epoll_fd, EPOLL_CTL_DEL, source->control_fd, NULL);
+	reactor_arm (reactor, 0, source->encoder_fd, -1, 0);
+	g_hash_table_remove (reactor->sources, &source->id);
+	g_mutex_unlock (&reactor->lock);
+	g_free (source);
+}
@@ -0,0 +1,50 @@
+/*
+ * GStreamer dreamsource reactor
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMREACTOR_H__
+#define __GST_DREAMREACTOR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DreamSourceReactor        DreamSourceReactor;
+typedef struct _DreamSourceReactorSource  DreamSourceReactorSource;
+
+/* what woke a handler up, 0 means its timeout expired */
+#define GST_DREAMSOURCE_REACTOR_CONTROL    (1 << 0)
+#define GST_DREAMSOURCE_REACTOR_ENCODER    (1 << 1)
+
+/* handles events like one iteration of a read thread's poll() loop and
+ * returns FALSE to stop. fd is the encoder fd to wait for next or -1,
+ * timeout is in ms as for poll(): 0 runs the handler again right away,
+ * -1 waits for the control channel only. */
+typedef gboolean (*DreamSourceReactorFunc) (gpointer user_data, guint events, int *fd, int *timeout);
+
+/* set GST_DREAMSOURCE_REACTOR_WORKERS=n to run the handlers of ready
+ * sources on a pool of n threads instead of on the reactor thread */
+#define GST_DREAMSOURCE_REACTOR_WORKERS_ENV "GST_DREAMSOURCE_REACTOR_WORKERS"
+
+DreamSourceReactor *gst_dreamsource_reactor_get (void);
+void gst_dreamsource_reactor_unref (DreamSourceReactor *reactor);
+DreamSourceReactorSource *gst_dreamsource_reactor_add (DreamSourceReactor *reactor, int control_fd, DreamSourceReactorFunc func, gpointer user_data);
+void gst_dreamsource_reactor_remove (DreamSourceReactor *reactor, DreamSourceReactorSource *source);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMREACTOR_H__ */
@@ -0,0 +1,391 @@
+/*
+ * GStreamer dreamsource encoder simulator
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "gstdreamsource.h"
+#include "gstdreamvideosource.h"
+#include "gstdreamaudiosource.h"
+
+/* Synthetic encoder producing Video-/AudioBufferDescriptor streams at the
+ * configured rate and bitrate into an anonymous mapping. A timerfd ticks
+ * once per frame, so the elements can poll() it like the real device. */
+
+GST_DEBUG_CATEGORY_EXTERN (dreamsourceencoder_debug);
+#define GST_CAT_DEFAULT dreamsourceencoder_debug
+
+#define SIM_MAX_OUTSTANDING    8192                /* power of two */
+#define SIM_STC_START          (10 * GST_SECOND)   /* timestamps must not start at zero */
+#define SIM_AUDIO_SAMPLERATE   48000
+#define SIM_AUDIO_FRAME        1024                /* samples per AAC frame */
+#define SIM_NAL_START_CODE     "\x00\x00\x00\x01"
+
+typedef struct
+{
+	EncoderKind kind;
+	int timerfd;
+	GMutex lock;
+
+	unsigned char *ring;
+	size_t ring_size;
+	size_t write_pos;
+	size_t used;
+
+	/* lengths of descriptors handed out and not released yet, in ring order */
+	guint32 outstanding[SIM_MAX_OUTSTANDING];
+	guint out_head, out_tail;
+
+	guint bitrate;               /* bit/s */
+	gint fps_n, fps_d;
+	gint custom_fps_n, custom_fps_d;   /* VENC_SET_CUSTOM_FRAMERATE, used for rate_custom */
+	guint gop_length;            /* ms, 0 = one second */
+	gboolean running;
+
+	guint64 epoch;               /* CLOCK_MONOTONIC ns at STC zero */
+	guint64 next_frame;          /* capture time of the next frame, ns since epoch */
+	guint64 frame_no;
+	guint64 dropped;
+} SimulatorState;
+
+/* parameter sets for 1280x720 main profile, only the syntax is meaningful */
+static const guint8 sim_sps[] = { 0x67, 0x4d, 0x40, 0x1f, 0x96, 0x54, 0x02, 0x80, 0x2d, 0xc8 };
+static const guint8 sim_pps[] = { 0x68, 0xee, 0x3c, 0x80 };
+
+static guint64
+sim_now (SimulatorState *st)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec - st->epoch;
+}
+
+static guint64
+sim_frame_duration (SimulatorState *st)
+{
+	if (st->kind == ENCODER_KIND_AUDIO)
+		return gst_util_uint64_scale (SIM_AUDIO_FRAME, GST_SECOND, SIM_AUDIO_SAMPLERATE);
+	return gst_util_uint64_scale (GST_SECOND, st->fps_d, st->fps_n);
+}
+
+static void
+sim_arm_timer (SimulatorState *st, gboolean arm)
+{
+	struct itimerspec its;
+	memset (&its, 0, sizeof(its));
+	if (arm)
+	{
+		guint64 duration = sim_frame_duration (st);
+		its.it_interval.tv_sec = duration / GST_SECOND;
+		its.it_interval.tv_nsec = duration % GST_SECOND;
+		its.it_value = its.it_interval;
+	}
+	timerfd_settime (st->timerfd, 0, &its, NULL);
+}
+
+static gboolean
+sim_open (EncoderInfo *enc, EncoderKind kind, const gchar *device)
+{
+	SimulatorState *st = g_new0 (SimulatorState, 1);
+	struct timespec ts;
+
+	st->kind = kind;
+	st->timerfd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (st->timerfd < 0)
+	{
+		g_free (st);
+		return FALSE;
+	}
+	g_mutex_init (&st->lock);
+	st->bitrate = kind == ENCODER_KIND_AUDIO ? 128000 : 2000000;
+	st->fps_n = 25;
+	st->fps_d = 1;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	st->epoch = (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec - SIM_STC_START;
+
+	enc->fd = st->timerfd;
+	enc->backend_data = st;
+	GST_INFO ("simulating %s encoder %s", kind == ENCODER_KIND_AUDIO ? "audio" : "video", device);
+	return TRUE;
+}
+
+static unsigned char *
+sim_mmap (EncoderInfo *enc, size_t size)
+{
+	SimulatorState *st = enc->backend_data;
+	unsigned char *ring = (unsigned char *)mmap (0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED)
+		return NULL;
+	st->ring = ring;
+	st->ring_size = size;
+	return ring;
+}
+
+static void
+sim_set_framerate (SimulatorState *st, int venc_fps)
+{
+	static const gint rates[][2] = {
+		[rate_25] = { 25, 1 }, [rate_30] = { 30, 1 }, [rate_50] = { 50, 1 }, [rate_60] = { 60, 1 },
+		[rate_23_976] = { 24000, 1001 }, [rate_24] = { 24, 1 }, [rate_29_97] = { 30000, 1001 }, [rate_59_94] = { 60000, 1001 }
+	};
+	if (venc_fps > rate_custom && venc_fps < (int) G_N_ELEMENTS (rates))
+	{
+		st->fps_n = rates[venc_fps][0];
+		st->fps_d = rates[venc_fps][1];
+	}
+	else if (venc_fps == rate_custom && st->custom_fps_n && st->custom_fps_d)
+	{
+		st->fps_n = st->custom_fps_n;
+		st->fps_d = st->custom_fps_d;
+	}
+}
+
+/* video and audio encoders share the ioctl numbers */
+static int
+sim_ioctl (EncoderInfo *enc, unsigned long request, void *arg)
+{
+	SimulatorState *st = enc->backend_data;
+
+	g_mutex_lock (&st->lock);
+	switch (request) {
+		case VENC_START:
+			/* the encoder starts from scratch */
+			st->write_pos = st->used = 0;
+			st->out_head = st->out_tail = 0;
+			st->frame_no = 0;
+			st->next_frame = sim_now (st);
+			st->running = TRUE;
+			sim_arm_timer (st, TRUE);
+			break;
+		case VENC_STOP:
+			st->running = FALSE;
+			sim_arm_timer (st, FALSE);
+			break;
+		case VENC_SET_BITRATE:
+			st->bitrate = *(unsigned int *) arg;
+			break;
+		case VENC_SET_FRAMERATE:
+			sim_set_framerate (st, *(int *) arg);
+			if (st->running)
+				sim_arm_timer (st, TRUE);
+			break;
+#ifdef VENC_SET_CUSTOM_FRAMERATE
+		case VENC_SET_CUSTOM_FRAMERATE:
+			st->custom_fps_n = *(unsigned int *) arg >> 16;
+			st->custom_fps_d = *(unsigned int *) arg & 0xffff;
+			break;
+#endif
+		case VENC_SET_GOP_LENGTH:
+			st->gop_length = *(unsigned int *) arg;
+			break;
+		default:
+			break;
+	}
+	g_mutex_unlock (&st->lock);
+	return 0;
+}
+
+/* copies len bytes (prefix, then filler) into the ring and describes them,
+ * splitting into two descriptors at the end of the ring like the driver */
+static void
+sim_emit (SimulatorState *st, unsigned char *out, guint *count, size_t desc_size, uint32_t flags, uint32_t video_flags,
+	uint8_t unit_type, guint64 capture, size_t len, const guint8 *prefix, size_t prefix_len)
+{
+	size_t done = 0;
+	uint64_t pts = gst_util_uint64_scale (capture, 9, GST_MSECOND / 10) & G_GUINT64_CONSTANT (0x1ffffffff);
+	uint64_t stc = gst_util_uint64_scale (capture, 27, GST_USECOND) & G_GUINT64_CONSTANT (0x3ffffffffff);
+
+	while (done < len)
+	{
+		size_t chunk = MIN (len - done, st->ring_size - st->write_pos);
+		size_t i;
+		CompressedBufferDescriptor *desc = (CompressedBufferDescriptor *) (out + *count * desc_size);
+
+		for (i = 0; i < chunk; i++)
+			st->ring[st->write_pos + i] = done + i < prefix_len ? prefix[done + i] : 0x55;
+
+		memset (desc, 0, desc_size);
+		desc->uiFlags = flags | CDB_FLAG_PTS_VALID | CDB_FLAG_STCSNAPSHOT_VALID;
+		if (done > 0)
+			desc->uiFlags &= ~CDB_FLAG_FRAME_START;
+		if (done + chunk < len)
+			desc->uiFlags &= ~CDB_FLAG_FRAME_END;
+		desc->uiPTS = pts;
+		desc->uiSTCSnapshot = stc;
+		desc->uiOffset = st->write_pos;
+		desc->uiLength = chunk;
+
+		if (st->kind == ENCODER_KIND_VIDEO)
+		{
+			VideoBufferDescriptor *vdesc = (VideoBufferDescriptor *) desc;
+			vdesc->stCommon.uiFlags |= VBD_FLAG_DTS_VALID;
+			vdesc->uiVideoFlags = video_flags | VBD_FLAG_DTS_VALID | (done == 0 ? VBD_FLAG_DATA_UNIT_START : 0);
+			vdesc->uiDTS = pts;
+			vdesc->uiDataUnitType = unit_type;
+		}
+		else
+			((AudioBufferDescriptor *) desc)->uiDataUnitType = unit_type;
+
+		st->outstanding[st->out_tail++ & (SIM_MAX_OUTSTANDING - 1)] = chunk;
+		st->used += chunk;
+		st->write_pos = (st->write_pos + chunk) % st->ring_size;
+		done += chunk;
+		(*count)++;
+	}
+}
+
+static gboolean
+sim_generate_frame (SimulatorState *st, unsigned char *out, guint *count, guint max, size_t desc_size)
+{
+	guint64 capture = st->next_frame;
+	guint64 duration = sim_frame_duration (st);
+	size_t frame_len = gst_util_uint64_scale (st->bitrate / 8, duration, GST_SECOND);
+
+	st->next_frame += duration;
+
+	if (st->kind == ENCODER_KIND_AUDIO)
+	{
+		guint8 adts[7] = { 0xff, 0xf1, 0x4c, 0x80, 0x00, 0x1f, 0xfc };
+		frame_len = CLAMP (frame_len, sizeof(adts), 0x1fff);
+		/* worst case: split at the end of the ring */
+		if (*count + 2 > max || st->used + frame_len > st->ring_size || st->out_tail - st->out_head + 2 > SIM_MAX_OUTSTANDING)
+			return FALSE;
+		adts[3] |= (frame_len >> 11) & 0x03;
+		adts[4] = (frame_len >> 3) & 0xff;
+		adts[5] |= (frame_len & 0x07) << 5;
+		sim_emit (st, out, count, desc_size, CDB_FLAG_FRAME_START | CDB_FLAG_FRAME_END, 0, 0, capture, frame_len, adts, sizeof(adts));
+	}
+	else
+	{
+		guint gop_frames = st->gop_length ? gst_util_uint64_scale (st->gop_length, st->fps_n, st->fps_d * 1000) : (guint) (st->fps_n / st->fps_d);
+		gboolean idr = (st->frame_no % MAX (gop_frames, 1)) == 0;
+		guint8 slice[5] = { 0x00, 0x00, 0x00, 0x01, idr ? 0x65 : 0x41 };
+		guint8 sps[4 + sizeof(sim_sps)], pps[4 + sizeof(sim_pps)];
+		uint32_t rap = idr ? VBD_FLAG_RAP : 0;
+
+		if (idr)
+			frame_len *= 3;
+		frame_len = MAX (frame_len, 64);
+		if (*count + 6 > max || st->used + frame_len + sizeof(sps) + sizeof(pps) > st->ring_size || st->out_tail - st->out_head + 6 > SIM_MAX_OUTSTANDING)
+			return FALSE;
+
+		if (idr)
+		{
+			memcpy (sps, SIM_NAL_START_CODE, 4);
+			memcpy (sps + 4, sim_sps, sizeof(sim_sps));
+			memcpy (pps, SIM_NAL_START_CODE, 4);
+			memcpy (pps + 4, sim_pps, sizeof(sim_pps));
+			sim_emit (st, out, count, desc_size, CDB_FLAG_FRAME_START, rap, 7, capture, sizeof(sps), sps, sizeof(sps));
+			sim_emit (st, out, count, desc_size, 0, rap, 8, capture, sizeof(pps), pps, sizeof(pps));
+		}
+		sim_emit (st, out, count, desc_size, (idr ? 0 : CDB_FLAG_FRAME_START) | CDB_FLAG_FRAME_END, rap, idr ? 5 : 1, capture, frame_len, slice, sizeof(slice));
+	}
+	st->frame_no++;
+	return TRUE;
+}
+
+static ssize_t
+sim_read (EncoderInfo *enc, void *buffer, size_t size)
+{
+	SimulatorState *st = enc->backend_data;
+	size_t desc_size = st->kind == ENCODER_KIND_AUDIO ? ABDSIZE : VBDSIZE;
+	guint max = size / desc_size;
+	guint count = 0;
+	uint64_t expirations;
+
+	/* blocks until the next frame is due, like the driver */
+	if (read (st->timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return -1;
+
+	g_mutex_lock (&st->lock);
+	while (expirations--)
+	{
+		if (!st->running)
+			break;
+		if (!sim_generate_frame (st, buffer, &count, max, desc_size))
+		{
+			st->dropped++;
+			GST_DEBUG ("encoder ring full, dropped frame %" G_GUINT64_FORMAT " (%" G_GUINT64_FORMAT " total)", st->frame_no, st->dropped);
+			st->frame_no++;
+		}
+	}
+
+	if (count == 0 && max > 0)
+	{
+		/* nothing fitted, hand out an empty descriptor the elements skip */
+		CompressedBufferDescriptor *desc = buffer;
+		memset (desc, 0, desc_size);
+		desc->uiFlags = CDB_FLAG_METADATA;
+		desc->uiOffset = st->write_pos;
+		st->outstanding[st->out_tail++ & (SIM_MAX_OUTSTANDING - 1)] = 0;
+		count = 1;
+	}
+	g_mutex_unlock (&st->lock);
+
+	return count * desc_size;
+}
+
+static int
+sim_release (EncoderInfo *enc, unsigned int count)
+{
+	SimulatorState *st = enc->backend_data;
+
+	g_mutex_lock (&st->lock);
+	count = MIN (count, st->out_tail - st->out_head);
+	while (count--)
+		st->used -= st->outstanding[st->out_head++ & (SIM_MAX_OUTSTANDING - 1)];
+	g_mutex_unlock (&st->lock);
+	return 0;
+}
+
+static int
+sim_get_stc (EncoderInfo *enc, uint32_t *stc)
+{
+	SimulatorState *st = enc->backend_data;
+	*stc = (uint32_t) gst_util_uint64_scale (sim_now (st), 27, GST_USECOND);
+	return 0;
+}
+
+static void
+sim_close (EncoderInfo *enc)
+{
+	SimulatorState *st = enc->backend_data;
+
+	if (st->ring)
+		munmap (st->ring, st->ring_size);
+	close (st->timerfd);
+	g_mutex_clear (&st->lock);
+	GST_INFO ("simulator closed after %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " dropped", st->frame_no, st->dropped);
+	g_free (st);
+	enc->backend_data = NULL;
+}
+
+const EncoderBackend gst_dreamsource_simulator_backend = {
+	"simulator",
+	sim_open,
+	sim_mmap,
+	sim_ioctl,
+	sim_read,
+	sim_release,
+	sim_get_stc,
+	sim_close
+};
@@ -20,11 +20,13 @@
 #include "config.h"
 #endif
 #include <gst/gst.h>
+#include <time.h>
 
 #include "gstdreamsource.h"
 #include "gstdreamaudiosource.h"
 #include "gstdreamvideosource.h"
 #include "gstdreamtssource.h"
+#include "gstdreamavsource.h"
 
 static gboolean
 plugin_init (GstPlugin * plugin)
@@ -33,6 +35,8 @@ plugin_init (GstPlugin * plugin)
   res &= gst_dreamaudiosource_plugin_init (plugin);
   res &= gst_dreamvideosource_plugin_init (plugin);
   res &= gst_dreamtssource_plugin_init (plugin);
+  res &= gst_dreamavsource_plugin_init (plugin);
+  res &= gst_dreamsource_tracer_plugin_init (plugin);
 
   return res;
 }
@@ -52,74 +56,805 @@ GST_PLUGIN_DEFINE (
 GST_DEBUG_CATEGORY_STATIC (dreamsourceclock_debug);
 #define GST_CAT_DEFAULT dreamsourceclock_debug
 
+enum
+{
+	PROP_CLOCK_0,
+	PROP_CLOCK_MODE,
+	PROP_CLOCK_SAMPLE_INTERVAL,
+	PROP_CLOCK_MAX_DEVIATION,
+	PROP_CLOCK_QUERIES,
+	PROP_CLOCK_STC_READS,
+	PROP_CLOCK_RESYNCS
+};
+
+#define DEFAULT_CLOCK_MODE             GST_DREAMSOURCE_CLOCK_MODE_DIRECT
+#define DEFAULT_CLOCK_SAMPLE_INTERVAL  (50 * GST_MSECOND)
+#define DEFAULT_CLOCK_MAX_DEVIATION    (1 * GST_MSECOND)
+#define CLOCK_RATE_WINDOW              GST_SECOND       /* min. span of one rate measurement */
+#define CLOCK_MAX_RATE_PPB             1000000          /* further off is a jump, not drift */
+
 G_DEFINE_TYPE (GstDreamSourceClock, gst_dreamsource_clock, GST_TYPE_SYSTEM_CLOCK);
 
 static GstClockTime gst_dreamsource_clock_get_internal_time (GstClock * clock);
+static void gst_dreamsource_clock_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_dreamsource_clock_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec);
+
+GType gst_dreamsource_clock_mode_get_type (void)
+{
+	static volatile gsize clock_mode_type = 0;
+	static const GEnumValue clock_mode[] = {
+		{GST_DREAMSOURCE_CLOCK_MODE_DIRECT, "GST_DREAMSOURCE_CLOCK_MODE_DIRECT", "direct"},
+		{GST_DREAMSOURCE_CLOCK_MODE_INTERPOLATE, "GST_DREAMSOURCE_CLOCK_MODE_INTERPOLATE", "interpolate"},
+		{0, NULL, NULL},
+	};
+
+	if (g_once_init_enter (&clock_mode_type)) {
+		GType tmp = g_enum_register_static ("GstDreamSourceClockMode", clock_mode);
+		g_once_init_leave (&clock_mode_type, tmp);
+	}
+	return (GType) clock_mode_type;
+}
 
 static void
 gst_dreamsource_clock_class_init (GstDreamSourceClockClass * klass)
 {
+	GObjectClass *gobject_class = (GObjectClass *) klass;
 	GstClockClass *clock_class = (GstClockClass *) klass;
 	GST_DEBUG_CATEGORY_INIT (dreamsourceclock_debug, "dreamsourceclock", 0, "dreamsourceclock");
 	clock_class->get_internal_time = gst_dreamsource_clock_get_internal_time;
+	gobject_class->set_property = gst_dreamsource_clock_set_property;
+	gobject_class->get_property = gst_dreamsource_clock_get_property;
+
+	g_object_class_install_property (gobject_class, PROP_CLOCK_MODE,
+	  g_param_spec_enum ("mode", "Mode",
+	    "Read the STC on every query or interpolate between periodic reads",
+	    GST_TYPE_DREAMSOURCE_CLOCK_MODE, DEFAULT_CLOCK_MODE,
+	    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, PROP_CLOCK_SAMPLE_INTERVAL,
+	  g_param_spec_uint64 ("sample-interval", "Sample interval",
+	    "Minimum time between two STC reads in interpolate mode",
+	    GST_MSECOND, 10 * GST_SECOND, DEFAULT_CLOCK_SAMPLE_INTERVAL,
+	    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, PROP_CLOCK_MAX_DEVIATION,
+	  g_param_spec_uint64 ("max-deviation", "Max. deviation",
+	    "Drop the rate estimate when the STC is further off than this from the interpolated time",
+	    GST_USECOND, GST_SECOND, DEFAULT_CLOCK_MAX_DEVIATION,
+	    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, PROP_CLOCK_QUERIES,
+	  g_param_spec_uint64 ("queries", "Queries",
+	    "Number of internal time queries",
+	    0, G_MAXUINT64, 0,
+	    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, PROP_CLOCK_STC_READS,
+	  g_param_spec_uint64 ("stc-reads", "STC reads",
+	    "Number of times the STC was read from the encoder",
+	    0, G_MAXUINT64, 0,
+	    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, PROP_CLOCK_RESYNCS,
+	  g_param_spec_uint64 ("resyncs", "Resyncs",
+	    "Number of times the interpolation was off by more than max-deviation",
+	    0, G_MAXUINT64, 0,
+	    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
 gst_dreamsource_clock_init (GstDreamSourceClock * self)
 {
-	self->fd = 0;
-	self->stc_offset = 0;
+	self->encoder = NULL;
 	self->first_stc = 0;
-	self->prev_stc = 0;
+	gst_dreamsource_timestamp_init (&self->stc_unit, STC_BITS, STC_RATE);
+	self->mode = DEFAULT_CLOCK_MODE;
+	self->sample_interval = DEFAULT_CLOCK_SAMPLE_INTERVAL;
+	self->max_deviation = DEFAULT_CLOCK_MAX_DEVIATION;
+	self->created = g_get_monotonic_time ();
 	GST_OBJECT_FLAG_SET (self, GST_CLOCK_FLAG_CAN_SET_MASTER);
 }
 
+static void
+gst_dreamsource_clock_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+	GstDreamSourceClock *self = GST_DREAMSOURCE_CLOCK (object);
+
+	GST_OBJECT_LOCK (self);
+	switch (prop_id) {
+		case PROP_CLOCK_MODE:
+			self->mode = g_value_get_enum (value);
+			self->sampled = FALSE;
+			break;
+		case PROP_CLOCK_SAMPLE_INTERVAL:
+			self->sample_interval = g_value_get_uint64 (value);
+			break;
+		case PROP_CLOCK_MAX_DEVIATION:
+			self->max_deviation = g_value_get_uint64 (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+	GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_dreamsource_clock_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
+{
+	GstDreamSourceClock *self = GST_DREAMSOURCE_CLOCK (object);
+
+	GST_OBJECT_LOCK (self);
+	switch (prop_id) {
+		case PROP_CLOCK_MODE:
+			g_value_set_enum (value, self->mode);
+			break;
+		case PROP_CLOCK_SAMPLE_INTERVAL:
+			g_value_set_uint64 (value, self->sample_interval);
+			break;
+		case PROP_CLOCK_MAX_DEVIATION:
+			g_value_set_uint64 (value, self->max_deviation);
+			break;
+		case PROP_CLOCK_QUERIES:
+			g_value_set_uint64 (value, self->queries);
+			break;
+		case PROP_CLOCK_STC_READS:
+			g_value_set_uint64 (value, self->stc_reads);
+			break;
+		case PROP_CLOCK_RESYNCS:
+			g_value_set_uint64 (value, self->resyncs);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+	GST_OBJECT_UNLOCK (self);
+}
+
 GstClock *
-gst_dreamsource_clock_new (const gchar * name, int fd)
+gst_dreamsource_clock_new (const gchar * name, EncoderInfo *encoder)
 {
 	GstDreamSourceClock *self = GST_DREAMSOURCE_CLOCK (g_object_new (GST_TYPE_DREAMSOURCE_CLOCK, "name", name, "clock-type", GST_CLOCK_TYPE_OTHER, NULL));
-	self->fd = fd;
-	GST_DEBUG_OBJECT (self, "gst_dreamsource_clock_new fd=%i", self->fd);
+	self->encoder = encoder;
+	GST_DEBUG_OBJECT (self, "gst_dreamsource_clock_new fd=%i", encoder->fd);
 	return GST_CLOCK_CAST (self);
 }
 
-static GstClockTime gst_dreamsource_clock_get_internal_time (GstClock * clock)
+/* the clock may outlive the encoder it reads the STC from */
+void
+gst_dreamsource_clock_detach (GstClock *clock, EncoderInfo *encoder)
 {
 	GstDreamSourceClock *self = GST_DREAMSOURCE_CLOCK (clock);
+	GST_OBJECT_LOCK(self);
+	if (self->encoder == encoder)
+	{
+		self->encoder = NULL;
+		self->sampled = FALSE;
+	}
+	GST_OBJECT_UNLOCK(self);
+}
+
+/* the 32 bit STC at an internal time of clock, so that STC snapshots can be
+ * compared to a time already taken from it without reading the STC again.
+ * FALSE before the clock read it the first time. */
+gboolean
+gst_dreamsource_clock_time_to_stc (GstClock *clock, GstClockTime time, uint32_t *stc)
+{
+	GstDreamSourceClock *self;
+	gboolean valid;
+
+	if (!clock || !G_TYPE_CHECK_INSTANCE_TYPE (clock, GST_TYPE_DREAMSOURCE_CLOCK))
+		return FALSE;
+	self = GST_DREAMSOURCE_CLOCK (clock);
+
+	GST_OBJECT_LOCK (self);
+	valid = self->first_stc != 0;
+	if (valid)
+		*stc = self->first_stc + (uint32_t) gst_util_uint64_scale (time, STC_RATE, GST_SECOND);
+	GST_OBJECT_UNLOCK (self);
+	return valid;
+}
+
+/* adds the STC read rate of clock to an element's stats structure */
+void
+gst_dreamsource_clock_add_stats (GstClock *clock, GstStructure *stats)
+{
+	GstDreamSourceClock *self;
+	gdouble seconds;
+
+	if (!clock || !G_TYPE_CHECK_INSTANCE_TYPE (clock, GST_TYPE_DREAMSOURCE_CLOCK))
+		return;
+	self = GST_DREAMSOURCE_CLOCK (clock);
 
+	GST_OBJECT_LOCK (self);
+	seconds = (g_get_monotonic_time () - self->created) / (gdouble) G_USEC_PER_SEC;
+	gst_structure_set (stats,
+		"clock-queries", G_TYPE_UINT64, self->queries,
+		"clock-stc-reads", G_TYPE_UINT64, self->stc_reads,
+		"clock-stc-reads-per-second", G_TYPE_DOUBLE, seconds > 0 ? self->stc_reads / seconds : 0.0,
+		"clock-resyncs", G_TYPE_UINT64, self->resyncs,
+		NULL);
+	GST_OBJECT_UNLOCK (self);
+}
+
+static GstClockTime
+gst_dreamsource_clock_raw_time (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+	return GST_TIMESPEC_TO_TIME (ts);
+}
+
+/* reads and unwraps the STC, called with the object lock held */
+static gboolean gst_dreamsource_clock_read_stc (GstDreamSourceClock * self, GstClockTime * encoder_time)
+{
 	uint32_t stc = 0;
-	GstClockTime encoder_time = 0;
 
-	GST_OBJECT_LOCK(self);
-	if (self->fd > 0) {
-		int ret = ioctl(self->fd, ENC_GET_STC, &stc);
-		if (ret == 0)
-		{
-			GST_TRACE_OBJECT (self, "current stc=%" GST_TIME_FORMAT "", GST_TIME_ARGS(ENCTIME_TO_GSTTIME(stc)));
-			if (G_UNLIKELY(self->first_stc == 0))
-				self->first_stc = stc;
+	if (!self->encoder) {
+		GST_ERROR_OBJECT (self, "timebase not available because encoder device is not opened");
+		return FALSE;
+	}
+
+	int ret = gst_dreamsource_encoder_get_stc (self->encoder, &stc);
+	self->stc_reads++;
+	if (ret != 0)
+	{
+		GST_WARNING_OBJECT (self, "can't ENC_GET_STC error: %s, fd=%i, ret=%i", strerror(errno), self->encoder->fd, ret);
+		return FALSE;
+	}
 
-			stc -= self->first_stc;
+	GST_TRACE_OBJECT (self, "current stc=%" PRIu32 "", stc);
+	if (G_UNLIKELY(self->first_stc == 0))
+		self->first_stc = stc;
 
-			if (stc < self->prev_stc)
+	/* the 32 bit STC wraps every ~159 seconds */
+	*encoder_time = gst_dreamsource_timestamp_to_time (&self->stc_unit, gst_dreamsource_timestamp_unwrap (&self->stc_unit, stc - self->first_stc));
+	return TRUE;
+}
+
+/* encoder time at raw from the last sample and the fitted rate */
+static GstClockTime gst_dreamsource_clock_extrapolate (GstDreamSourceClock * self, GstClockTime raw)
+{
+	gint64 elapsed = raw - self->sample_raw;
+	return self->sample_time + elapsed + elapsed * self->rate_ppb / 1000000000;
+}
+
+/* takes a new STC sample and refines the rate estimate, called with the object lock held */
+static gboolean gst_dreamsource_clock_sample (GstDreamSourceClock * self)
+{
+	GstClockTime before, raw, encoder_time;
+	GstClockTimeDiff deviation;
+
+	before = gst_dreamsource_clock_raw_time ();
+	if (!gst_dreamsource_clock_read_stc (self, &encoder_time))
+		return FALSE;
+	/* the STC was latched somewhere inside the ioctl */
+	raw = before + (gst_dreamsource_clock_raw_time () - before) / 2;
+
+	if (!self->sampled)
+	{
+		self->ref_raw = raw;
+		self->ref_time = encoder_time;
+		self->rate_ppb = 0;
+	}
+	else
+	{
+		deviation = GST_CLOCK_DIFF (gst_dreamsource_clock_extrapolate (self, raw), encoder_time);
+		if ((GstClockTime) ABS (deviation) > self->max_deviation)
+		{
+			GST_DEBUG_OBJECT (self, "interpolation off by %" G_GINT64_FORMAT " ns, resync", deviation);
+			self->resyncs++;
+			self->ref_raw = raw;
+			self->ref_time = encoder_time;
+			self->rate_ppb = 0;
+			/* last_time stays, a STC behind it holds the clock until it caught up */
+		}
+		else if (raw - self->ref_raw >= CLOCK_RATE_WINDOW)
+		{
+			gint64 span = raw - self->ref_raw;
+			gint64 drift = GST_CLOCK_DIFF (span, encoder_time - self->ref_time);
+			gint64 ppb = gst_util_uint64_scale (ABS (drift), GST_SECOND, span);
+			if (drift < 0)
+				ppb = -ppb;
+			if (ABS (ppb) <= CLOCK_MAX_RATE_PPB)
 			{
-				self->stc_offset += UINT32_MAX;
-				GST_LOG_OBJECT (self, "clock_wrap! new offset=%" PRIu64 " ", self->stc_offset);
+				/* smooth out the jitter of the ioctl latency */
+				self->rate_ppb += (ppb - self->rate_ppb) / 4;
+				GST_LOG_OBJECT (self, "measured %" G_GINT64_FORMAT " ppb, rate now %" G_GINT64_FORMAT " ppb", ppb, self->rate_ppb);
 			}
+			self->ref_raw = raw;
+			self->ref_time = encoder_time;
+		}
+	}
 
-			self->prev_stc = stc;
+	self->sample_raw = raw;
+	self->sample_time = encoder_time;
+	self->sampled = TRUE;
+	return TRUE;
+}
 
-			uint64_t total_stc = stc + self->stc_offset;
-// 			GST_WARNING_OBJECT (self, "after subtract stc_offset=%" PRIu64 "   new total_stc=%" PRIu64 "", self->stc_offset, total_stc);
-			encoder_time = ENCTIME_TO_GSTTIME(total_stc);
-			GST_TRACE_OBJECT (self, "result %" GST_TIME_FORMAT "", GST_TIME_ARGS(encoder_time));
-		}
-		else
-			GST_WARNING_OBJECT (self, "can't ENC_GET_STC error: %s, fd=%i, ret=%i", strerror(errno), self->fd, ret);
+static GstClockTime gst_dreamsource_clock_get_internal_time (GstClock * clock)
+{
+	GstDreamSourceClock *self = GST_DREAMSOURCE_CLOCK (clock);
+	GstClockTime encoder_time = 0;
+
+	GST_OBJECT_LOCK(self);
+	self->queries++;
+	if (self->mode == GST_DREAMSOURCE_CLOCK_MODE_DIRECT)
+	{
+		if (!gst_dreamsource_clock_read_stc (self, &encoder_time))
+			encoder_time = 0;
 	}
 	else
-		GST_ERROR_OBJECT (self, "timebase not available because encoder device is not opened");
+	{
+		GstClockTime raw = gst_dreamsource_clock_raw_time ();
+
+		if (!self->sampled || raw - self->sample_raw >= self->sample_interval)
+		{
+			if (gst_dreamsource_clock_sample (self))
+				raw = self->sample_raw;
+		}
+		if (self->sampled)
+		{
+			/* rebasing onto a new sample must not make the clock go backwards */
+			encoder_time = MAX (gst_dreamsource_clock_extrapolate (self, raw), self->last_time);
+			self->last_time = encoder_time;
+		}
+	}
+	GST_TRACE_OBJECT (self, "result %" GST_TIME_FORMAT "", GST_TIME_ARGS(encoder_time));
 
 	GST_OBJECT_UNLOCK(self);
 	return encoder_time;
 }
+
+GType gst_dreamsource_release_mode_get_type (void)
+{
+	static volatile gsize release_mode_type = 0;
+	static const GEnumValue release_mode[] = {
+		{GST_DREAMSOURCE_RELEASE_MODE_IMMEDIATE, "GST_DREAMSOURCE_RELEASE_MODE_IMMEDIATE", "immediate"},
+		{GST_DREAMSOURCE_RELEASE_MODE_TRACKED, "GST_DREAMSOURCE_RELEASE_MODE_TRACKED", "tracked"},
+		{0, NULL, NULL},
+	};
+
+	if (g_once_init_enter (&release_mode_type)) {
+		GType tmp = g_enum_register_static ("GstDreamSourceReleaseMode", release_mode);
+		g_once_init_leave (&release_mode_type, tmp);
+	}
+	return (GType) release_mode_type;
+}
+
+DescriptorTracker *
+gst_dreamsource_tracker_new (guint n_slots, guint ring_size, EncoderInfo *encoder)
+{
+	DescriptorTracker *tracker = g_new0 (DescriptorTracker, 1);
+	guint size = 1;
+
+	while (size < n_slots)
+		size <<= 1;
+
+	g_mutex_init (&tracker->lock);
+	g_cond_init (&tracker->idle);
+	tracker->refcount = 1;
+	tracker->slots = g_new0 (DescriptorTrackerSlot, size);
+	tracker->n_slots = size;
+	tracker->ring_size = ring_size;
+	tracker->encoder = encoder;
+	return tracker;
+}
+
+void
+gst_dreamsource_tracker_unref (DescriptorTracker *tracker)
+{
+	if (!g_atomic_int_dec_and_test (&tracker->refcount))
+		return;
+	g_mutex_clear (&tracker->lock);
+	g_cond_clear (&tracker->idle);
+	g_free (tracker->slots);
+	g_free (tracker);
+}
+
+/* called when the encoder device goes away, memory which is still
+ * referenced downstream must not write to the (closed) fd anymore */
+void
+gst_dreamsource_tracker_detach (DescriptorTracker *tracker)
+{
+	g_mutex_lock (&tracker->lock);
+	tracker->encoder = NULL;
+	tracker->notify = NULL;
+	tracker->notify_data = NULL;
+	g_mutex_unlock (&tracker->lock);
+}
+
+void
+gst_dreamsource_tracker_set_notify (DescriptorTracker *tracker, guint wakeup_limit, DescriptorTrackerNotify notify, gpointer user_data)
+{
+	g_mutex_lock (&tracker->lock);
+	tracker->wakeup_limit = wakeup_limit;
+	tracker->notify = notify;
+	tracker->notify_data = user_data;
+	g_mutex_unlock (&tracker->lock);
+}
+
+DescriptorTrackerSlot *
+gst_dreamsource_tracker_acquire (DescriptorTracker *tracker, guint offset, guint length)
+{
+	DescriptorTrackerSlot *slot = NULL;
+
+	g_mutex_lock (&tracker->lock);
+	if (tracker->tail - tracker->head < tracker->n_slots)
+	{
+		slot = &tracker->slots[tracker->tail & (tracker->n_slots - 1)];
+		slot->tracker = tracker;
+		slot->offset = offset;
+		slot->length = length;
+		slot->in_use = TRUE;
+		tracker->tail++;
+		g_atomic_int_inc (&tracker->refcount);
+	}
+	g_mutex_unlock (&tracker->lock);
+	return slot;
+}
+
+/* usable as GDestroyNotify for memory wrapping the slot's range */
+void
+gst_dreamsource_tracker_release (DescriptorTrackerSlot *slot)
+{
+	DescriptorTracker *tracker = slot->tracker;
+	DescriptorTrackerNotify notify = NULL;
+	gpointer notify_data = NULL;
+	guint in_flight;
+
+	g_mutex_lock (&tracker->lock);
+	in_flight = tracker->tail - tracker->head;
+	slot->in_use = FALSE;
+	while (tracker->head != tracker->tail && !tracker->slots[tracker->head & (tracker->n_slots - 1)].in_use)
+		tracker->head++;
+	if (tracker->head == tracker->tail)
+		g_cond_broadcast (&tracker->idle);
+
+	if ((gint) (tracker->head - tracker->released) > 0)
+	{
+		unsigned int count = tracker->head - tracker->released;
+		tracker->released = tracker->head;
+		if (tracker->encoder && gst_dreamsource_encoder_release (tracker->encoder, count) != 0)
+			GST_WARNING ("release of %u descriptors failed: %s", count, strerror(errno));
+	}
+
+	if (tracker->notify && in_flight >= tracker->wakeup_limit && tracker->tail - tracker->head < tracker->wakeup_limit)
+	{
+		notify = tracker->notify;
+		notify_data = tracker->notify_data;
+	}
+	g_mutex_unlock (&tracker->lock);
+
+	if (notify)
+		notify (notify_data);
+	gst_dreamsource_tracker_unref (tracker);
+}
+
+/* the encoder starts over at the beginning of its ring, the bookkeeping of
+ * the last run goes. Only while no memory is referenced downstream (all of
+ * it has been given back then), returns FALSE and changes nothing otherwise. */
+gboolean
+gst_dreamsource_tracker_reset (DescriptorTracker *tracker)
+{
+	gboolean idle;
+
+	g_mutex_lock (&tracker->lock);
+	idle = tracker->head == tracker->tail;
+	if (idle)
+		tracker->head = tracker->tail = tracker->released = 0;
+	g_mutex_unlock (&tracker->lock);
+	return idle;
+}
+
+/* waits up to timeout µs for downstream to free all tracked memory,
+ * returns FALSE if some is still referenced */
+gboolean
+gst_dreamsource_tracker_wait_idle (DescriptorTracker *tracker, gint64 timeout)
+{
+	gint64 end = g_get_monotonic_time () + timeout;
+	gboolean idle;
+
+	g_mutex_lock (&tracker->lock);
+	while (tracker->head != tracker->tail && g_cond_wait_until (&tracker->idle, &tracker->lock, end));
+	idle = tracker->head == tracker->tail;
+	g_mutex_unlock (&tracker->lock);
+	return idle;
+}
+
+/* slots gst_dreamsource_tracker_acquire () can hand out before it fails */
+guint
+gst_dreamsource_tracker_get_free (DescriptorTracker *tracker)
+{
+	guint free_slots;
+	g_mutex_lock (&tracker->lock);
+	free_slots = tracker->n_slots - (tracker->tail - tracker->head);
+	g_mutex_unlock (&tracker->lock);
+	return free_slots;
+}
+
+guint
+gst_dreamsource_tracker_get_in_flight (DescriptorTracker *tracker)
+{
+	guint in_flight;
+	g_mutex_lock (&tracker->lock);
+	in_flight = tracker->tail - tracker->head;
+	g_mutex_unlock (&tracker->lock);
+	return in_flight;
+}
+
+/* window of the ring from the oldest referenced to the end of the newest
+ * descriptor, must be called with the tracker lock held. Zero-length
+ * descriptors take up no memory and don't delimit it. */
+static gboolean
+gst_dreamsource_tracker_window (DescriptorTracker *tracker, guint *start, guint *end)
+{
+	DescriptorTrackerSlot *first = NULL, *last = NULL;
+	guint i;
+
+	for (i = tracker->head; i != tracker->tail && !first; i++)
+		if (tracker->slots[i & (tracker->n_slots - 1)].length)
+			first = &tracker->slots[i & (tracker->n_slots - 1)];
+	for (i = tracker->tail; first && i != tracker->head && !last; i--)
+		if (tracker->slots[(i - 1) & (tracker->n_slots - 1)].length)
+			last = &tracker->slots[(i - 1) & (tracker->n_slots - 1)];
+	if (!first)
+		return FALSE;
+	*start = first->offset;
+	*end = last->offset + last->length;
+	return TRUE;
+}
+
+/* bytes of the ring between the oldest referenced and the newest descriptor */
+guint
+gst_dreamsource_tracker_get_occupancy (DescriptorTracker *tracker)
+{
+	guint occupancy = 0;
+	guint start, end;
+	g_mutex_lock (&tracker->lock);
+	if (gst_dreamsource_tracker_window (tracker, &start, &end))
+	{
+		if (end >= start)
+			occupancy = end - start;
+		else
+			occupancy = tracker->ring_size - start + end;
+	}
+	g_mutex_unlock (&tracker->lock);
+	return occupancy;
+}
+
+/* TRUE if [offset, offset+length) lies in the part of the ring which is still
+ * referenced downstream, i.e. the encoder has overwritten memory in use */
+gboolean
+gst_dreamsource_tracker_overlaps (DescriptorTracker *tracker, guint offset, guint length)
+{
+	gboolean overlaps = FALSE;
+	guint start, end;
+
+	if (length == 0)
+		return FALSE;
+
+	g_mutex_lock (&tracker->lock);
+	if (gst_dreamsource_tracker_window (tracker, &start, &end))
+	{
+		if (end > start)
+			overlaps = offset < end && offset + length > start;
+		else if (end < start)
+			overlaps = offset < end || offset + length > start;
+		else
+			overlaps = TRUE;   /* the whole ring */
+	}
+	g_mutex_unlock (&tracker->lock);
+	return overlaps;
+}
+
+void
+gst_dreamsource_stats_reset (DreamSourceStats *stats)
+{
+	memset (stats, 0, sizeof(DreamSourceStats));
+	stats->started = g_get_monotonic_time ();
+}
+
+/* g_mutex_lock () which accounts the time spent waiting */
+void
+gst_dreamsource_stats_lock (DreamSourceStats *stats, GMutex *mutex)
+{
+	gint64 start;
+
+	if (G_LIKELY (g_mutex_trylock (mutex)))
+		return;
+
+	start = g_get_monotonic_time ();
+	g_mutex_lock (mutex);
+	stats->mutex_wait += g_get_monotonic_time () - start;
+	stats->mutex_contended++;
+}
+
+static guint
+gst_dreamsource_stats_bucket (guint64 us)
+{
+	guint msb;
+
+	if (us < (1 << STATS_LATENCY_SUB_BITS))
+		return us;
+	us = MIN (us, G_MAXUINT32);
+	msb = g_bit_storage ((gulong) us) - 1;
+	return MIN (((msb - STATS_LATENCY_SUB_BITS + 1) << STATS_LATENCY_SUB_BITS) + ((us >> (msb - STATS_LATENCY_SUB_BITS)) & ((1 << STATS_LATENCY_SUB_BITS) - 1)), STATS_LATENCY_BUCKETS - 1);
+}
+
+/* largest value falling into bucket */
+static guint64
+gst_dreamsource_stats_bucket_limit (guint bucket)
+{
+	guint shift;
+
+	if (bucket < (1 << STATS_LATENCY_SUB_BITS))
+		return bucket;
+	shift = (bucket >> STATS_LATENCY_SUB_BITS) - 1;
+	return ((guint64) ((1 << STATS_LATENCY_SUB_BITS) + (bucket & ((1 << STATS_LATENCY_SUB_BITS) - 1)) + 1) << shift) - 1;
+}
+
+void
+gst_dreamsource_stats_add_latency (DreamSourceStats *stats, gint64 read_time)
+{
+	gint64 latency = g_get_monotonic_time () - read_time;
+
+	stats->pushed++;
+	if (read_time && latency >= 0)
+		stats->latency[gst_dreamsource_stats_bucket (latency)]++;
+}
+
+static GstClockTime
+gst_dreamsource_stats_percentile (const guint *histogram, guint64 total, guint per_mille)
+{
+	guint64 rank = (total * per_mille + 999) / 1000;
+	guint64 seen = 0;
+	guint i;
+
+	if (total == 0)
+		return GST_CLOCK_TIME_NONE;
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++)
+	{
+		seen += histogram[i];
+		if (seen >= rank)
+			break;
+	}
+	return gst_dreamsource_stats_bucket_limit (MIN (i, STATS_LATENCY_BUCKETS - 1)) * GST_USECOND;
+}
+
+GstStructure *
+gst_dreamsource_stats_to_structure (DreamSourceStats *stats, const gchar *name)
+{
+	guint64 total = 0;
+	guint i;
+
+	for (i = 0; i < STATS_LATENCY_BUCKETS; i++)
+		total += stats->latency[i];
+
+	return gst_structure_new (name,
+		"elapsed", G_TYPE_UINT64, stats->started ? (guint64) (g_get_monotonic_time () - stats->started) * GST_USECOND : 0,
+		"descriptors", G_TYPE_UINT64, stats->descriptors,
+		"frames", G_TYPE_UINT64, stats->frames,
+		"bytes", G_TYPE_UINT64, stats->bytes,
+		"dropped", G_TYPE_UINT64, stats->dropped,
+		"pushed", G_TYPE_UINT64, stats->pushed,
+		"mutex-wait", G_TYPE_UINT64, stats->mutex_wait * GST_USECOND,
+		"mutex-contended", G_TYPE_UINT64, stats->mutex_contended,
+		"latency-p50", G_TYPE_UINT64, gst_dreamsource_stats_percentile (stats->latency, total, 500),
+		"latency-p99", G_TYPE_UINT64, gst_dreamsource_stats_percentile (stats->latency, total, 990),
+		"latency-p999", G_TYPE_UINT64, gst_dreamsource_stats_percentile (stats->latency, total, 999),
+		NULL);
+}
+
+void
+gst_dreamsource_latency_reset (EncoderLatency *latency)
+{
+	memset (latency->histogram, 0, sizeof (latency->histogram));
+	latency->samples = 0;
+	latency->measured = GST_CLOCK_TIME_NONE;
+	latency->updates = 0;
+}
+
+/* capture to read-out time of a descriptor: its STC snapshot against the
+ * STC at the read which handed it out, both 27 MHz, the snapshot reduced
+ * to the 32 bits of the latter */
+GstClockTime
+gst_dreamsource_latency_measure (const CompressedBufferDescriptor *desc, uint32_t read_stc)
+{
+	uint32_t ticks = read_stc - (uint32_t) desc->uiSTCSnapshot;
+	GstClockTime latency = gst_util_uint64_scale (ticks, GST_SECOND, STC_RATE);
+
+	if (!(desc->uiFlags & CDB_FLAG_STCSNAPSHOT_VALID) || latency > LATENCY_MAX)
+		return GST_CLOCK_TIME_NONE;
+	return latency;
+}
+
+/* adds one frame's latency, returns the new value to report once a window
+ * is complete and its p99 is off the reported one, else GST_CLOCK_TIME_NONE */
+GstClockTime
+gst_dreamsource_latency_add (EncoderLatency *latency, GstClockTime sample)
+{
+	GstClockTime p99, drift;
+
+	if (sample == GST_CLOCK_TIME_NONE)
+		return GST_CLOCK_TIME_NONE;
+	latency->histogram[gst_dreamsource_stats_bucket (sample / GST_USECOND)]++;
+	if (++latency->samples < LATENCY_WINDOW)
+		return GST_CLOCK_TIME_NONE;
+
+	p99 = gst_dreamsource_stats_percentile (latency->histogram, latency->samples, 990);
+	memset (latency->histogram, 0, sizeof (latency->histogram));
+	latency->samples = 0;
+	if (latency->measured != GST_CLOCK_TIME_NONE)
+	{
+		drift = p99 > latency->measured ? p99 - latency->measured : latency->measured - p99;
+		if (drift <= MAX (latency->measured / 4, LATENCY_MIN_DRIFT))
+			return GST_CLOCK_TIME_NONE;
+	}
+	latency->updates++;
+	return p99;
+}
+
+void
+gst_dreamsource_keyframe_index_init (KeyframeIndex *index)
+{
+	g_mutex_init (&index->lock);
+	index->count = 0;
+}
+
+void
+gst_dreamsource_keyframe_index_clear (KeyframeIndex *index)
+{
+	g_mutex_clear (&index->lock);
+}
+
+void
+gst_dreamsource_keyframe_index_reset (KeyframeIndex *index)
+{
+	g_mutex_lock (&index->lock);
+	index->count = 0;
+	g_mutex_unlock (&index->lock);
+}
+
+void
+gst_dreamsource_keyframe_index_add (KeyframeIndex *index, GstClockTime pts, GstClockTime dts, guint64 offset)
+{
+	KeyframeIndexEntry *entry;
+
+	g_mutex_lock (&index->lock);
+	entry = &index->entries[index->count++ % KEYFRAME_INDEX_SIZE];
+	entry->pts = pts;
+	entry->dts = dts;
+	entry->offset = offset;
+	g_mutex_unlock (&index->lock);
+}
+
+/* "keyframes" lists the indexed keyframes oldest first, "count" is the
+ * total since the last reset including the ones already rotated out */
+GstStructure *
+gst_dreamsource_keyframe_index_to_structure (KeyframeIndex *index, const gchar *name)
+{
+	GValue keyframes = G_VALUE_INIT;
+	GValue value = G_VALUE_INIT;
+	GstStructure *structure;
+	guint64 i;
+
+	g_value_init (&keyframes, GST_TYPE_ARRAY);
+	g_mutex_lock (&index->lock);
+	for (i = index->count > KEYFRAME_INDEX_SIZE ? index->count - KEYFRAME_INDEX_SIZE : 0; i < index->count; i++)
+	{
+		KeyframeIndexEntry *entry = &index->entries[i % KEYFRAME_INDEX_SIZE];
+		g_value_init (&value, GST_TYPE_STRUCTURE);
+		g_value_take_boxed (&value, gst_structure_new ("keyframe",
+			"pts", G_TYPE_UINT64, entry->pts,
+			"dts", G_TYPE_UINT64, entry->dts,
+			"offset", G_TYPE_UINT64, entry->offset,
+			NULL));
+		gst_value_array_append_and_take_value (&keyframes, &value);
+	}
+	structure = gst_structure_new (name, "count", G_TYPE_UINT64, index->count, NULL);
+	g_mutex_unlock (&index->lock);
+	gst_structure_take_value (structure, "keyframes", &keyframes);
+	return structure;
+}
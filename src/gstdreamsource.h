@@ -36,10 +36,22 @@
 #include <sys/socket.h>
 
 #include "gstdreamsource-marshal.h"
-
+#include "gstdreamframequeue.h"
+#include "gstdreamtracer.h"
+#include "gstdreamtimestamp.h"
+#include "gstdreamreactor.h"
+#include "gstdreamcommand.h"
+#include "gstdreamabr.h"
+#include "gstdreamh264.h"
+#include "gstdreamgopcache.h"
+#include "gstdreamtimeshift.h"
+#include "gstdreamsync.h"
+
+/* dreamtssource's control socket, the encoder sources use a CommandQueue */
 #define CONTROL_RUN            'R'     /* start producing frames */
 #define CONTROL_PAUSE          'P'     /* pause producing frames */
 #define CONTROL_STOP           'S'     /* stop the select call */
+#define CONTROL_WAKEUP         'W'     /* re-evaluate the poll set */
 #define CONTROL_SOCKETS(src)   src->control_sock
 #define WRITE_SOCKET(src)      src->control_sock[1]
 #define READ_SOCKET(src)       src->control_sock[0]
@@ -69,13 +81,22 @@ typedef enum
 	READTHREADSTATE_STOP
 } GstDreamSourceReadthreadState;
 
+/* ms a running read loop waits for the encoder before it takes the gap as a discont */
+#define READTHREAD_TIMEOUT     200
+/* µs the encoder waits for downstream to free the ring before restarting */
+#define TRACKER_IDLE_TIMEOUT   G_TIME_SPAN_SECOND
+
 G_BEGIN_DECLS
 
 typedef struct _CompressedBufferDescriptor CompressedBufferDescriptor;
 typedef struct _EncoderInfo                EncoderInfo;
-
-#define ENCTIME_TO_GSTTIME(time)           (gst_util_uint64_scale ((time), GST_USECOND, 27LL))
-#define MPEGTIME_TO_GSTTIME(time)          (gst_util_uint64_scale ((time), GST_MSECOND/10, 9LL))
+typedef struct _EncoderBackend             EncoderBackend;
+typedef struct _DescriptorTracker          DescriptorTracker;
+typedef struct _DescriptorTrackerSlot      DescriptorTrackerSlot;
+typedef struct _DreamSourceStats           DreamSourceStats;
+typedef struct _KeyframeIndex              KeyframeIndex;
+typedef struct _KeyframeIndexEntry         KeyframeIndexEntry;
+typedef struct _EncoderLatency             EncoderLatency;
 
 /* validity flags */
 #define CDB_FLAG_ORIGINALPTS_VALID         0x00000001
@@ -119,18 +140,115 @@ struct _CompressedBufferDescriptor
 struct _EncoderInfo {
 	int fd;
 
+	/* device or simulator, see gstdreamencoder.h */
+	const EncoderBackend *backend;
+	gpointer backend_data;
+
 	/* descriptor space */
 	unsigned char *buffer;
 
 	/* mmapp'ed data buffer */
 	unsigned char *cdb;
+	size_t cdb_size;
 
-	guint         used_range_min;
-	guint         used_range_max;
+	/* descriptors which are still referenced downstream */
+	DescriptorTracker *tracker;
+
+	/* device manager slot, see gstdreamencoder.h */
+	int kind;
+	int device_index;
 };
 
 #define ENC_GET_STC      _IOR('v', 141, uint32_t)
 
+typedef enum
+{
+	GST_DREAMSOURCE_RELEASE_MODE_IMMEDIATE = 0,  /* give descriptors back as soon as they are parsed */
+	GST_DREAMSOURCE_RELEASE_MODE_TRACKED         /* give descriptors back when the wrapping GstMemory is freed */
+} GstDreamSourceReleaseMode;
+
+#define GST_TYPE_DREAMSOURCE_RELEASE_MODE (gst_dreamsource_release_mode_get_type ())
+
+typedef void (*DescriptorTrackerNotify)    (gpointer user_data);
+
+struct _DescriptorTrackerSlot {
+	DescriptorTracker *tracker;
+	guint    offset;
+	guint    length;
+	gboolean in_use;
+};
+
+/* keeps the descriptors handed out by the encoder in ring order, so they
+ * can be given back to the driver (in order) once every GstMemory that
+ * points into the mmap'ed area has been freed */
+struct _DescriptorTracker {
+	GMutex   lock;
+	GCond    idle;             /* signalled when nothing is referenced anymore */
+	gint     refcount;
+
+	DescriptorTrackerSlot *slots;
+	guint    n_slots;          /* power of two */
+	guint    head;             /* oldest descriptor still referenced */
+	guint    tail;             /* next descriptor to be handed out */
+	guint    released;         /* descriptors given back to the driver so far */
+	guint    ring_size;
+
+	EncoderInfo *encoder;      /* encoder to give released descriptors back to, NULL = don't */
+	guint    wakeup_limit;     /* call notify when in-flight count drops below this */
+	DescriptorTrackerNotify notify;
+	gpointer notify_data;
+};
+
+/* latency histogram: 2^STATS_LATENCY_SUB_BITS linear buckets per power of two µs */
+#define STATS_LATENCY_SUB_BITS             3
+#define STATS_LATENCY_BUCKETS              (30 << STATS_LATENCY_SUB_BITS)
+
+/* read path counters, exposed through the "stats" property. The producer
+ * counters are only written by the read thread, the latency histogram only
+ * by the streaming thread and the mutex counters with the mutex held. */
+struct _DreamSourceStats {
+	gint64   started;          /* monotonic time of the last reset */
+	guint64  descriptors;      /* descriptors read from the encoder */
+	guint64  frames;           /* buffers queued */
+	guint64  bytes;            /* payload bytes queued */
+	guint64  dropped;          /* buffers dropped on queue overflow */
+	guint64  pushed;           /* buffers returned by create() */
+	guint64  mutex_wait;       /* µs spent waiting for the element mutex */
+	guint64  mutex_contended;  /* number of times it was not free */
+	guint    latency[STATS_LATENCY_BUCKETS];  /* µs from encoder read to create() return */
+};
+
+#define LATENCY_WINDOW                     256                 /* frames per measurement */
+#define LATENCY_MAX                        (2 * GST_SECOND)    /* beyond that the snapshot is bogus */
+#define LATENCY_MIN_DRIFT                  (2 * GST_MSECOND)
+
+/* capture to read-out latency of the encoder, measured by the read thread
+ * over windows of LATENCY_WINDOW frames, the queueing after the read is
+ * covered by the frame queue limit. measured is written with the element
+ * mutex held and answers LATENCY queries. */
+struct _EncoderLatency {
+	guint    histogram[STATS_LATENCY_BUCKETS];  /* µs, current window */
+	guint    samples;
+	GstClockTime measured;     /* p99 of the window last reported, GST_CLOCK_TIME_NONE before */
+	guint64  updates;
+};
+
+#define KEYFRAME_INDEX_SIZE                64
+
+struct _KeyframeIndexEntry {
+	GstClockTime pts;
+	GstClockTime dts;
+	guint64  offset;           /* byte offset of the keyframe's first buffer in the stream */
+};
+
+/* ring of the most recent keyframes, added by the read thread and read
+ * through the "keyframe-index" property */
+struct _KeyframeIndex {
+	GMutex   lock;
+	KeyframeIndexEntry entries[KEYFRAME_INDEX_SIZE];
+	guint64  count;            /* keyframes added since the last reset */
+};
+
 #define GST_TYPE_DREAMSOURCE_CLOCK \
   (gst_dreamsource_clock_get_type())
 #define GST_DREAMSOURCE_CLOCK(obj) \
@@ -147,14 +265,39 @@ struct _EncoderInfo {
 typedef struct _GstDreamSourceClock GstDreamSourceClock;
 typedef struct _GstDreamSourceClockClass GstDreamSourceClockClass;
 
+typedef enum
+{
+	GST_DREAMSOURCE_CLOCK_MODE_DIRECT = 0,   /* read the STC on every query */
+	GST_DREAMSOURCE_CLOCK_MODE_INTERPOLATE   /* read it every sample-interval, extrapolate in between */
+} GstDreamSourceClockMode;
+
+#define GST_TYPE_DREAMSOURCE_CLOCK_MODE (gst_dreamsource_clock_mode_get_type ())
+
 struct _GstDreamSourceClock
 {
 	GstSystemClock clock;
 
-	uint32_t prev_stc;
 	uint32_t first_stc;
-	uint64_t stc_offset;
-	int fd;
+	TimestampUnit stc_unit;        /* unwraps stc - first_stc */
+	EncoderInfo *encoder;
+
+	GstDreamSourceClockMode mode;
+	GstClockTime sample_interval;
+	GstClockTime max_deviation;
+
+	/* interpolation state, CLOCK_MONOTONIC_RAW -> encoder time */
+	gboolean     sampled;
+	GstClockTime sample_raw;       /* last STC read */
+	GstClockTime sample_time;
+	GstClockTime ref_raw;          /* start of the current rate measurement */
+	GstClockTime ref_time;
+	gint64       rate_ppb;         /* encoder clock rate - 1, in parts per billion */
+	GstClockTime last_time;        /* returned last, the clock must not go backwards */
+
+	guint64      queries;
+	guint64      stc_reads;
+	guint64      resyncs;
+	gint64       created;
 };
 
 struct _GstDreamSourceClockClass
@@ -163,8 +306,44 @@ struct _GstDreamSourceClockClass
 };
 
 GType gst_dreamsource_clock_get_type (void);
-GstClock *gst_dreamsource_clock_new (const gchar * name, int fd);
+GstClock *gst_dreamsource_clock_new (const gchar * name, EncoderInfo *encoder);
+void gst_dreamsource_clock_detach (GstClock *clock, EncoderInfo *encoder);
+void gst_dreamsource_clock_add_stats (GstClock *clock, GstStructure *stats);
+gboolean gst_dreamsource_clock_time_to_stc (GstClock *clock, GstClockTime time, uint32_t *stc);
+GType gst_dreamsource_clock_mode_get_type (void);
+
+GType gst_dreamsource_release_mode_get_type (void);
+
+DescriptorTracker *gst_dreamsource_tracker_new (guint n_slots, guint ring_size, EncoderInfo *encoder);
+void gst_dreamsource_tracker_unref (DescriptorTracker *tracker);
+void gst_dreamsource_tracker_detach (DescriptorTracker *tracker);
+void gst_dreamsource_tracker_set_notify (DescriptorTracker *tracker, guint wakeup_limit, DescriptorTrackerNotify notify, gpointer user_data);
+DescriptorTrackerSlot *gst_dreamsource_tracker_acquire (DescriptorTracker *tracker, guint offset, guint length);
+void gst_dreamsource_tracker_release (DescriptorTrackerSlot *slot);
+gboolean gst_dreamsource_tracker_reset (DescriptorTracker *tracker);
+gboolean gst_dreamsource_tracker_wait_idle (DescriptorTracker *tracker, gint64 timeout);
+guint gst_dreamsource_tracker_get_in_flight (DescriptorTracker *tracker);
+guint gst_dreamsource_tracker_get_free (DescriptorTracker *tracker);
+guint gst_dreamsource_tracker_get_occupancy (DescriptorTracker *tracker);
+gboolean gst_dreamsource_tracker_overlaps (DescriptorTracker *tracker, guint offset, guint length);
+
+void gst_dreamsource_stats_reset (DreamSourceStats *stats);
+void gst_dreamsource_stats_lock (DreamSourceStats *stats, GMutex *mutex);
+void gst_dreamsource_stats_add_latency (DreamSourceStats *stats, gint64 read_time);
+GstStructure *gst_dreamsource_stats_to_structure (DreamSourceStats *stats, const gchar *name);
+
+void gst_dreamsource_latency_reset (EncoderLatency *latency);
+GstClockTime gst_dreamsource_latency_measure (const CompressedBufferDescriptor *desc, uint32_t read_stc);
+GstClockTime gst_dreamsource_latency_add (EncoderLatency *latency, GstClockTime sample);
+
+void gst_dreamsource_keyframe_index_init (KeyframeIndex *index);
+void gst_dreamsource_keyframe_index_clear (KeyframeIndex *index);
+void gst_dreamsource_keyframe_index_reset (KeyframeIndex *index);
+void gst_dreamsource_keyframe_index_add (KeyframeIndex *index, GstClockTime pts, GstClockTime dts, guint64 offset);
+GstStructure *gst_dreamsource_keyframe_index_to_structure (KeyframeIndex *index, const gchar *name);
 
 G_END_DECLS
 
+#include "gstdreamencoder.h"
+
 #endif /* __GST_DREAMSOURCE_H__ */
@@ -0,0 +1,191 @@
+/*
+ * GStreamer dreamsource A/V sync
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstdreamsync.h"
+
+GST_DEBUG_CATEGORY_STATIC (dreamsourcesync_debug);
+#define GST_CAT_DEFAULT dreamsourcesync_debug
+
+GType
+gst_dreamsource_sync_get_type (void)
+{
+	static volatile gsize sync_type = 0;
+
+	if (g_once_init_enter (&sync_type))
+	{
+		GType tmp = g_boxed_type_register_static ("DreamSourceSync",
+			(GBoxedCopyFunc) gst_dreamsource_sync_ref, (GBoxedFreeFunc) gst_dreamsource_sync_unref);
+		GST_DEBUG_CATEGORY_INIT (dreamsourcesync_debug, "dreamsourcesync", 0, "dreamsourcesync");
+		g_once_init_leave (&sync_type, tmp);
+	}
+	return (GType) sync_type;
+}
+
+static DreamSourceSync *
+gst_dreamsource_sync_new (gint device_index)
+{
+	DreamSourceSync *sync = g_new0 (DreamSourceSync, 1);
+
+	sync->refcount = 1;
+	sync->device_index = device_index;
+	g_mutex_init (&sync->lock);
+	sync->dts_offset = GST_CLOCK_TIME_NONE;
+	return sync;
+}
+
+static DreamSourceSync *
+gst_dreamsource_sync_from_context (GstContext *context)
+{
+	DreamSourceSync *sync = NULL;
+
+	if (context)
+		gst_structure_get (gst_context_get_structure (context), GST_DREAMSOURCE_SYNC_CONTEXT_FIELD, GST_TYPE_DREAMSOURCE_SYNC, &sync, NULL);
+	return sync;
+}
+
+/* the sync object of device_index in element's pipeline: one handed to
+ * element before, one a bin hands out on NEED_CONTEXT, or a new one that
+ * is announced with HAVE_CONTEXT, so the partner gets the same. Call
+ * after the encoder was acquired, transfer full. */
+DreamSourceSync *
+gst_dreamsource_sync_obtain (GstElement *element, gint device_index)
+{
+	gchar *type = g_strdup_printf (GST_DREAMSOURCE_SYNC_CONTEXT_TYPE, device_index);
+	GstContext *context;
+	DreamSourceSync *sync;
+
+	gst_dreamsource_sync_get_type ();
+
+	if (!(context = gst_element_get_context (element, type)))
+	{
+		gst_element_post_message (element, gst_message_new_need_context (GST_OBJECT_CAST (element), type));
+		context = gst_element_get_context (element, type);
+	}
+	sync = gst_dreamsource_sync_from_context (context);
+	if (context)
+		gst_context_unref (context);
+
+	if (!sync)
+	{
+		GstStructure *s;
+
+		sync = gst_dreamsource_sync_new (device_index);
+		context = gst_context_new (type, TRUE);
+		s = gst_context_writable_structure (context);
+		gst_structure_set (s, GST_DREAMSOURCE_SYNC_CONTEXT_FIELD, GST_TYPE_DREAMSOURCE_SYNC, sync, NULL);
+		gst_element_set_context (element, context);
+		GST_DEBUG_OBJECT (element, "new %s", type);
+		gst_element_post_message (element, gst_message_new_have_context (GST_OBJECT_CAST (element), context));
+	}
+	else
+		GST_DEBUG_OBJECT (element, "found %s", type);
+
+	g_free (type);
+	return sync;
+}
+
+DreamSourceSync *
+gst_dreamsource_sync_ref (DreamSourceSync *sync)
+{
+	g_atomic_int_inc (&sync->refcount);
+	return sync;
+}
+
+void
+gst_dreamsource_sync_unref (DreamSourceSync *sync)
+{
+	if (!g_atomic_int_dec_and_test (&sync->refcount))
+		return;
+	g_mutex_clear (&sync->lock);
+	g_free (sync);
+}
+
+void
+gst_dreamsource_sync_join (DreamSourceSync *sync, gint kind)
+{
+	g_mutex_lock (&sync->lock);
+	sync->member[kind] = TRUE;
+	g_mutex_unlock (&sync->lock);
+}
+
+void
+gst_dreamsource_sync_leave (DreamSourceSync *sync, gint kind)
+{
+	g_mutex_lock (&sync->lock);
+	sync->member[kind] = FALSE;
+	g_mutex_unlock (&sync->lock);
+}
+
+gboolean
+gst_dreamsource_sync_has_member (DreamSourceSync *sync, gint kind)
+{
+	gboolean member;
+
+	g_mutex_lock (&sync->lock);
+	member = sync->member[kind];
+	g_mutex_unlock (&sync->lock);
+	return member;
+}
+
+void
+gst_dreamsource_sync_start (DreamSourceSync *sync)
+{
+	g_mutex_lock (&sync->lock);
+	sync->running++;
+	g_mutex_unlock (&sync->lock);
+}
+
+/* the offset only holds while one of the two keeps running */
+void
+gst_dreamsource_sync_stop (DreamSourceSync *sync)
+{
+	g_mutex_lock (&sync->lock);
+	if (--sync->running == 0)
+		sync->dts_offset = GST_CLOCK_TIME_NONE;
+	g_mutex_unlock (&sync->lock);
+}
+
+/* the first offset published in a run is the one both use, returns it */
+GstClockTime
+gst_dreamsource_sync_publish (DreamSourceSync *sync, GstClockTime dts_offset)
+{
+	g_mutex_lock (&sync->lock);
+	if (sync->dts_offset == GST_CLOCK_TIME_NONE)
+	{
+		sync->dts_offset = dts_offset;
+		GST_DEBUG ("encoder %i: dts_offset=%" GST_TIME_FORMAT, sync->device_index, GST_TIME_ARGS (dts_offset));
+	}
+	dts_offset = sync->dts_offset;
+	g_mutex_unlock (&sync->lock);
+	return dts_offset;
+}
+
+GstClockTime
+gst_dreamsource_sync_get_dts_offset (DreamSourceSync *sync)
+{
+	GstClockTime dts_offset;
+
+	g_mutex_lock (&sync->lock);
+	dts_offset = sync->dts_offset;
+	g_mutex_unlock (&sync->lock);
+	return dts_offset;
+}
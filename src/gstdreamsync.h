@@ -0,0 +1,61 @@
+/*
+ * GStreamer dreamsource A/V sync
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMSYNC_H__
+#define __GST_DREAMSYNC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DreamSourceSync DreamSourceSync;
+
+/* one context type per encoder slot, so several A/V pairs can share a
+ * pipeline: "dreamsource.sync.<device index>" */
+#define GST_DREAMSOURCE_SYNC_CONTEXT_TYPE  "dreamsource.sync.%d"
+#define GST_DREAMSOURCE_SYNC_CONTEXT_FIELD "sync"
+
+#define GST_TYPE_DREAMSOURCE_SYNC (gst_dreamsource_sync_get_type ())
+
+/* what the video and audio source of one encoder slot agree on, found
+ * through a GstContext instead of asking each other */
+struct _DreamSourceSync {
+	gint refcount;
+	gint device_index;
+
+	GMutex lock;
+	gboolean member[2];        /* per EncoderKind, between NULL to READY and READY to NULL */
+	gint running;              /* members between READY to PAUSED and PAUSED to READY */
+	GstClockTime dts_offset;   /* published once per run, GST_CLOCK_TIME_NONE until then */
+};
+
+GType gst_dreamsource_sync_get_type (void);
+DreamSourceSync *gst_dreamsource_sync_obtain (GstElement *element, gint device_index);
+DreamSourceSync *gst_dreamsource_sync_ref (DreamSourceSync *sync);
+void gst_dreamsource_sync_unref (DreamSourceSync *sync);
+void gst_dreamsource_sync_join (DreamSourceSync *sync, gint kind);
+void gst_dreamsource_sync_leave (DreamSourceSync *sync, gint kind);
+gboolean gst_dreamsource_sync_has_member (DreamSourceSync *sync, gint kind);
+void gst_dreamsource_sync_start (DreamSourceSync *sync);
+void gst_dreamsource_sync_stop (DreamSourceSync *sync);
+GstClockTime gst_dreamsource_sync_publish (DreamSourceSync *sync, GstClockTime dts_offset);
+GstClockTime gst_dreamsource_sync_get_dts_offset (DreamSourceSync *sync);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMSYNC_H__ */
@@ -0,0 +1,393 @@
+/*
+ * GStreamer dreamsource time-shift buffer
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "gstdreamtimeshift.h"
+
+GST_DEBUG_CATEGORY_STATIC (dreamsourcetimeshift_debug);
+#define GST_CAT_DEFAULT dreamsourcetimeshift_debug
+
+/* one index entry per this many bytes of data, within the limits below */
+#define TIMESHIFT_BYTES_PER_ENTRY  2048
+#define TIMESHIFT_MIN_ENTRIES      4096
+#define TIMESHIFT_MAX_ENTRIES      (1 << 21)
+
+typedef struct {
+	GstBuffer *buffer;
+	gboolean discont;
+} TimeshiftItem;
+
+#define TIMESHIFT_ENTRY(ts,n) (&(ts)->index->entries[(n) % (ts)->index->n_entries])
+
+static gboolean
+timeshift_pwrite (Timeshift *ts, const guint8 *data, gsize size, guint64 offset)
+{
+	guint64 data_size = ts->index->data_size;
+
+	while (size)
+	{
+		guint64 pos = offset % data_size;
+		gsize chunk = MIN (size, data_size - pos);
+		ssize_t ret = pwrite (ts->data_fd, data, chunk, pos);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return FALSE;
+		data += ret;
+		offset += ret;
+		size -= ret;
+	}
+	return TRUE;
+}
+
+static gboolean
+timeshift_pread (Timeshift *ts, guint8 *data, gsize size, guint64 offset)
+{
+	guint64 data_size = ts->index->data_size;
+
+	while (size)
+	{
+		guint64 pos = offset % data_size;
+		gsize chunk = MIN (size, data_size - pos);
+		ssize_t ret = pread (ts->data_fd, data, chunk, pos);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return FALSE;
+		data += ret;
+		offset += ret;
+		size -= ret;
+	}
+	return TRUE;
+}
+
+/* frames are appended to the data file in order, so disk access stays
+ * sequential. The index entries of what is about to be overwritten are
+ * dropped first, the new one is only added once its data is on disk. */
+static void
+timeshift_write (Timeshift *ts, GstBuffer *buffer, gboolean discont)
+{
+	gsize size = gst_buffer_get_size (buffer);
+	guint64 offset = ts->write_offset;
+	TimeshiftEntry *entry;
+	guint i;
+
+	if (size == 0 || size > ts->index->data_size)
+		return;
+
+	g_mutex_lock (&ts->lock);
+	while (ts->index->head < ts->index->tail && TIMESHIFT_ENTRY (ts, ts->index->head)->offset + ts->index->data_size < offset + size)
+		ts->index->head++;
+	g_mutex_unlock (&ts->lock);
+
+	for (i = 0; i < gst_buffer_n_memory (buffer); i++)
+	{
+		GstMapInfo map;
+		gboolean ok;
+		if (!gst_memory_map (gst_buffer_peek_memory (buffer, i), &map, GST_MAP_READ))
+			return;
+		ok = timeshift_pwrite (ts, map.data, map.size, offset);
+		offset += map.size;
+		gst_memory_unmap (map.memory, &map);
+		if (!ok)
+		{
+			GST_WARNING ("can't write to %s: %s", ts->location, strerror (errno));
+			ts->write_errors++;
+			return;
+		}
+	}
+
+	if (GST_BUFFER_DTS_IS_VALID (buffer))
+		ts->last_time = MAX (ts->last_time, GST_BUFFER_DTS (buffer));
+	else if (GST_BUFFER_PTS_IS_VALID (buffer))
+		ts->last_time = MAX (ts->last_time, GST_BUFFER_PTS (buffer));
+
+	g_mutex_lock (&ts->lock);
+	if (ts->index->tail - ts->index->head == ts->index->n_entries)
+		ts->index->head++;
+	entry = TIMESHIFT_ENTRY (ts, ts->index->tail);
+	entry->time = ts->last_time;
+	entry->pts = GST_BUFFER_PTS (buffer);
+	entry->offset = ts->write_offset;
+	entry->size = size;
+	entry->flags = GST_BUFFER_FLAGS (buffer) | (discont ? GST_BUFFER_FLAG_DISCONT : 0);
+	ts->index->tail++;
+	ts->write_offset += size;
+	g_mutex_unlock (&ts->lock);
+}
+
+static gpointer
+timeshift_writer_func (Timeshift *ts)
+{
+	TimeshiftItem *item;
+
+	while ((item = g_async_queue_pop (ts->queue)) && item->buffer)
+	{
+		timeshift_write (ts, item->buffer, item->discont);
+		gst_buffer_unref (item->buffer);
+		g_slice_free (TimeshiftItem, item);
+	}
+	g_slice_free (TimeshiftItem, item);
+	return NULL;
+}
+
+/* creates or reuses location and location.idx, preallocated to their final
+ * size. Returns NULL with errno set if they can't be set up. */
+Timeshift *
+gst_dreamsource_timeshift_new (const gchar *location, guint64 size, guint max_queued, gboolean copy)
+{
+	static gsize debug_init = 0;
+	Timeshift *ts;
+	gchar *index_location;
+	guint32 n_entries;
+	int err;
+
+	if (g_once_init_enter (&debug_init))
+	{
+		GST_DEBUG_CATEGORY_INIT (dreamsourcetimeshift_debug, "dreamsourcetimeshift", 0, "dreamsourcetimeshift");
+		g_once_init_leave (&debug_init, 1);
+	}
+
+	ts = g_new0 (Timeshift, 1);
+	ts->refcount = 1;
+	ts->location = g_strdup (location);
+	ts->index_fd = -1;
+	ts->max_queued = max_queued;
+	ts->copy = copy;
+	g_mutex_init (&ts->lock);
+
+	ts->data_fd = open (location, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (ts->data_fd < 0)
+		goto fail;
+	if ((err = posix_fallocate (ts->data_fd, 0, size)) != 0)
+	{
+		errno = err;
+		goto fail;
+	}
+
+	n_entries = CLAMP (size / TIMESHIFT_BYTES_PER_ENTRY, TIMESHIFT_MIN_ENTRIES, TIMESHIFT_MAX_ENTRIES);
+	ts->index_size = sizeof (TimeshiftIndex) + n_entries * sizeof (TimeshiftEntry);
+	index_location = g_strconcat (location, TIMESHIFT_INDEX_SUFFIX, NULL);
+	ts->index_fd = open (index_location, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	g_free (index_location);
+	if (ts->index_fd < 0 || ftruncate (ts->index_fd, ts->index_size) < 0)
+		goto fail;
+	ts->index = mmap (NULL, ts->index_size, PROT_READ | PROT_WRITE, MAP_SHARED, ts->index_fd, 0);
+	if (ts->index == MAP_FAILED)
+	{
+		ts->index = NULL;
+		goto fail;
+	}
+	ts->index->magic = TIMESHIFT_INDEX_MAGIC;
+	ts->index->n_entries = n_entries;
+	ts->index->data_size = size;
+	ts->index->head = ts->index->tail = 0;
+
+	ts->queue = g_async_queue_new ();
+	ts->writer = g_thread_new ("dreamsrc-timeshift", (GThreadFunc) timeshift_writer_func, ts);
+	GST_INFO ("time-shift to %s, %" G_GUINT64_FORMAT " bytes, %u index entries", location, size, n_entries);
+	return ts;
+
+fail:
+	err = errno;
+	GST_WARNING ("can't set up time-shift file %s: %s", location, strerror (err));
+	gst_dreamsource_timeshift_unref (ts);
+	errno = err;
+	return NULL;
+}
+
+Timeshift *
+gst_dreamsource_timeshift_ref (Timeshift *ts)
+{
+	g_atomic_int_inc (&ts->refcount);
+	return ts;
+}
+
+void
+gst_dreamsource_timeshift_unref (Timeshift *ts)
+{
+	if (!g_atomic_int_dec_and_test (&ts->refcount))
+		return;
+	gst_dreamsource_timeshift_stop (ts);
+	if (ts->queue)
+		g_async_queue_unref (ts->queue);
+	if (ts->index)
+		munmap (ts->index, ts->index_size);
+	if (ts->index_fd >= 0)
+		close (ts->index_fd);
+	if (ts->data_fd >= 0)
+		close (ts->data_fd);
+	g_mutex_clear (&ts->lock);
+	g_free (ts->location);
+	g_free (ts);
+}
+
+/* writes what is queued and ends the writer, so no buffer (and no encoder
+ * memory) is referenced anymore. The index stays readable. */
+void
+gst_dreamsource_timeshift_stop (Timeshift *ts)
+{
+	if (!ts->writer)
+		return;
+	g_async_queue_push (ts->queue, g_slice_new0 (TimeshiftItem));
+	g_thread_join (ts->writer);
+	ts->writer = NULL;
+}
+
+/* read loop only, never blocks: frames the writer can't keep up with are
+ * dropped and the next one is flagged discont */
+void
+gst_dreamsource_timeshift_push (Timeshift *ts, GstBuffer *buffer)
+{
+	TimeshiftItem *item;
+
+	if ((guint) g_async_queue_length (ts->queue) >= ts->max_queued)
+	{
+		ts->gap = TRUE;
+		ts->dropped++;
+		return;
+	}
+	item = g_slice_new (TimeshiftItem);
+	item->buffer = ts->copy ? gst_buffer_copy_deep (buffer) : gst_buffer_ref (buffer);
+	item->discont = ts->gap;
+	ts->gap = FALSE;
+	g_async_queue_push (ts->queue, item);
+}
+
+/* sequence number of the keyframe to start from for time, the last one at
+ * or before it, or TIMESHIFT_SEQUENCE_NONE if it isn't in the window */
+guint64
+gst_dreamsource_timeshift_seek (Timeshift *ts, GstClockTime time)
+{
+	guint64 lo, hi, mid, found = TIMESHIFT_SEQUENCE_NONE;
+
+	g_mutex_lock (&ts->lock);
+	lo = ts->index->head;
+	hi = ts->index->tail;
+	if (lo == hi || TIMESHIFT_ENTRY (ts, lo)->time > time)
+		goto done;
+	/* last entry with time <= time */
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (TIMESHIFT_ENTRY (ts, mid)->time <= time)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	/* back to the first buffer of the keyframe it belongs to */
+	for (; lo >= ts->index->head; lo--)
+	{
+		if (!(TIMESHIFT_ENTRY (ts, lo)->flags & GST_BUFFER_FLAG_DELTA_UNIT) &&
+			(lo == ts->index->head || (TIMESHIFT_ENTRY (ts, lo - 1)->flags & GST_BUFFER_FLAG_DELTA_UNIT)))
+		{
+			found = lo;
+			break;
+		}
+		if (lo == 0)
+			break;
+	}
+done:
+	g_mutex_unlock (&ts->lock);
+	return found;
+}
+
+/* up to max_frames frames from sequence on, each with its sequence number
+ * as OFFSET so reading continues at OFFSET_END of the last one. Frames
+ * overwritten meanwhile are left out, the first one returned is then
+ * flagged discont. */
+GstBufferList *
+gst_dreamsource_timeshift_read (Timeshift *ts, guint64 sequence, guint max_frames)
+{
+	GstBufferList *list = gst_buffer_list_new ();
+	TimeshiftEntry *entries;
+	guint64 first, n, i, head;
+
+	g_mutex_lock (&ts->lock);
+	first = MAX (sequence, ts->index->head);
+	n = first < ts->index->tail ? MIN (ts->index->tail - first, max_frames) : 0;
+	entries = g_new (TimeshiftEntry, n);
+	for (i = 0; i < n; i++)
+		entries[i] = *TIMESHIFT_ENTRY (ts, first + i);
+	g_mutex_unlock (&ts->lock);
+
+	for (i = 0; i < n; i++)
+	{
+		GstBuffer *buffer = gst_buffer_new_allocate (NULL, entries[i].size, NULL);
+		GstMapInfo map;
+		gboolean ok;
+
+		gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+		ok = timeshift_pread (ts, map.data, map.size, entries[i].offset);
+		gst_buffer_unmap (buffer, &map);
+		if (!ok)
+		{
+			gst_buffer_unref (buffer);
+			break;
+		}
+		GST_BUFFER_FLAGS (buffer) = entries[i].flags;
+		GST_BUFFER_PTS (buffer) = entries[i].pts;
+		GST_BUFFER_DTS (buffer) = entries[i].time;
+		GST_BUFFER_OFFSET (buffer) = first + i;
+		GST_BUFFER_OFFSET_END (buffer) = first + i + 1;
+		gst_buffer_list_add (list, buffer);
+	}
+	g_free (entries);
+
+	/* the writer may have overtaken the reader */
+	g_mutex_lock (&ts->lock);
+	head = ts->index->head;
+	g_mutex_unlock (&ts->lock);
+	while (gst_buffer_list_length (list) && GST_BUFFER_OFFSET (gst_buffer_list_get (list, 0)) < head)
+		gst_buffer_list_remove (list, 0, 1);
+	if (gst_buffer_list_length (list) && (first > sequence || GST_BUFFER_OFFSET (gst_buffer_list_get (list, 0)) > first))
+	{
+		GstBuffer *buffer = gst_buffer_list_get_writable (list, 0);
+		GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+	}
+	return list;
+}
+
+GstStructure *
+gst_dreamsource_timeshift_get_window (Timeshift *ts)
+{
+	GstStructure *window;
+
+	g_mutex_lock (&ts->lock);
+	window = gst_structure_new ("GstDreamSourceTimeshiftWindow",
+		"location", G_TYPE_STRING, ts->location,
+		"first", G_TYPE_UINT64, ts->index->head,
+		"last", G_TYPE_UINT64, ts->index->tail,
+		"start", G_TYPE_UINT64, ts->index->head < ts->index->tail ? TIMESHIFT_ENTRY (ts, ts->index->head)->time : GST_CLOCK_TIME_NONE,
+		"end", G_TYPE_UINT64, ts->index->head < ts->index->tail ? TIMESHIFT_ENTRY (ts, ts->index->tail - 1)->time : GST_CLOCK_TIME_NONE,
+		"bytes", G_TYPE_UINT64, ts->index->head < ts->index->tail ? ts->write_offset - TIMESHIFT_ENTRY (ts, ts->index->head)->offset : 0,
+		"dropped", G_TYPE_UINT64, ts->dropped,
+		"write-errors", G_TYPE_UINT64, ts->write_errors,
+		NULL);
+	g_mutex_unlock (&ts->lock);
+	return window;
+}
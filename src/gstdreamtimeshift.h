@@ -0,0 +1,88 @@
+/*
+ * GStreamer dreamsource time-shift buffer
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMTIMESHIFT_H__
+#define __GST_DREAMTIMESHIFT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Timeshift Timeshift;
+typedef struct _TimeshiftIndex TimeshiftIndex;
+typedef struct _TimeshiftEntry TimeshiftEntry;
+
+#define TIMESHIFT_INDEX_MAGIC      GST_MAKE_FOURCC ('D', 'T', 'S', 'I')
+#define TIMESHIFT_INDEX_SUFFIX     ".idx"
+#define TIMESHIFT_SEQUENCE_NONE    G_MAXUINT64
+#define TIMESHIFT_MAX_QUEUED       1024   /* frames waiting for the writer */
+
+struct _TimeshiftEntry {
+	guint64 time;              /* dts, or pts where there is none, never decreasing */
+	guint64 pts;
+	guint64 offset;            /* logical byte offset, the file position is offset % data_size */
+	guint32 size;
+	guint32 flags;             /* GstBufferFlags */
+};
+
+/* the memory mapped index file, entries form a ring of sequence numbers
+ * head..tail-1 where entry n lives at entries[n % n_entries] */
+struct _TimeshiftIndex {
+	guint32 magic;
+	guint32 n_entries;
+	guint64 data_size;
+	guint64 head;              /* oldest frame still in the data file */
+	guint64 tail;              /* next frame to be written */
+	TimeshiftEntry entries[];
+};
+
+/* circular data file of encoded frames written by a thread of its own, so
+ * the read loop only ever queues a reference */
+struct _Timeshift {
+	gint refcount;
+	gchar *location;
+	int data_fd;
+	int index_fd;
+	TimeshiftIndex *index;
+	gsize index_size;
+
+	GMutex lock;               /* index head and tail */
+	GAsyncQueue *queue;
+	GThread *writer;
+	guint max_queued;
+	gboolean copy;             /* queue copies, the encoder may reuse buffer memory */
+	gboolean gap;              /* frames were dropped since the last one queued, read loop only */
+
+	guint64 write_offset;      /* writer only */
+	guint64 last_time;         /* writer only */
+	guint64 dropped;
+	guint64 write_errors;
+};
+
+Timeshift *gst_dreamsource_timeshift_new (const gchar *location, guint64 size, guint max_queued, gboolean copy);
+Timeshift *gst_dreamsource_timeshift_ref (Timeshift *ts);
+void gst_dreamsource_timeshift_unref (Timeshift *ts);
+void gst_dreamsource_timeshift_stop (Timeshift *ts);
+void gst_dreamsource_timeshift_push (Timeshift *ts, GstBuffer *buffer);
+guint64 gst_dreamsource_timeshift_seek (Timeshift *ts, GstClockTime time);
+GstBufferList *gst_dreamsource_timeshift_read (Timeshift *ts, guint64 sequence, guint max_frames);
+GstStructure *gst_dreamsource_timeshift_get_window (Timeshift *ts);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMTIMESHIFT_H__ */
@@ -0,0 +1,202 @@
+/*
+ * GStreamer dreamsource timestamp conversion
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstdreamtimestamp.h"
+
+/* a step back by less than 1/16 of a period is taken as jitter or
+ * reordering, anything else as the counter running forward across a wrap */
+#define TIMESTAMP_BACKSTEP_SHIFT 4
+
+static guint64
+gst_dreamsource_timestamp_gcd (guint64 a, guint64 b)
+{
+	while (b)
+	{
+		guint64 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+void
+gst_dreamsource_timestamp_init (TimestampUnit *unit, guint bits, guint rate)
+{
+	guint64 num = GST_SECOND, den = rate;
+	guint64 g = gst_dreamsource_timestamp_gcd (num, den);
+
+	memset (unit, 0, sizeof(TimestampUnit));
+	unit->bits = bits;
+	unit->mask = bits < 64 ? (G_GUINT64_CONSTANT (1) << bits) - 1 : G_MAXUINT64;
+
+	num /= g;
+	den /= g;
+	unit->quot = num / den;
+	unit->rem = num % den;
+	unit->den = den;
+
+	/* smallest shift whose rounding error stays below one for arguments < 2^31 */
+	unit->shift = 31;
+	for (;;)
+	{
+		unit->magic = ((G_GUINT64_CONSTANT (1) << unit->shift) + den - 1) / den;
+		if (unit->magic * den - (G_GUINT64_CONSTANT (1) << unit->shift) <= (G_GUINT64_CONSTANT (1) << (unit->shift - 31)))
+			break;
+		unit->shift++;
+	}
+	g_assert (unit->magic < (G_GUINT64_CONSTANT (1) << 33));
+
+	unit->chunk = (G_GUINT64_CONSTANT (1) << 31) / MAX (unit->rem, 1);
+	unit->chunk_ticks = unit->chunk / den * den;
+	unit->chunk_time = unit->chunk_ticks / den * num;
+}
+
+/* forget the timeline, the next value starts a new one */
+void
+gst_dreamsource_timestamp_reset (TimestampUnit *unit)
+{
+	unit->valid = FALSE;
+	unit->epoch = 0;
+	unit->base_ticks = 0;
+	unit->base_time = 0;
+}
+
+/* moves the timeline by whole counter periods, e.g. when it has to match
+ * another unit which started on the other side of a wrap */
+void
+gst_dreamsource_timestamp_shift_epoch (TimestampUnit *unit, gint wraps)
+{
+	guint64 period = unit->mask + 1;
+
+	unit->epoch += wraps;
+	if (unit->valid)
+		unit->last_ticks += (gint64) wraps * (gint64) period;
+}
+
+/* brings time within half a wrap of reference, for a partner that started
+ * on the other side of a wrap. A unit behind moves forward by one wrap, a
+ * unit ahead can't go below its first period, so reference moves forward
+ * instead. Returns time in the epoch it ends up in. */
+GstClockTime
+gst_dreamsource_timestamp_align (TimestampUnit *unit, GstClockTime time, GstClockTime *reference)
+{
+	GstClockTime wrap_time = gst_dreamsource_timestamp_wrap_time (unit);
+
+	if (time + wrap_time / 2 < *reference)
+	{
+		gst_dreamsource_timestamp_shift_epoch (unit, 1);
+		time = gst_dreamsource_timestamp_to_time (unit, unit->last_ticks);
+	}
+	else if (time > *reference + wrap_time / 2)
+		*reference += wrap_time;
+	return time;
+}
+
+/* the extended value of raw closest to ticks, doesn't change the unit */
+guint64
+gst_dreamsource_timestamp_unwrap_near (TimestampUnit *unit, guint64 raw, guint64 ticks)
+{
+	guint64 delta = (raw - ticks) & unit->mask;
+
+	/* more than half a period ahead means behind */
+	if (delta > (unit->mask >> 1))
+		return ticks - (((ticks - raw) & unit->mask));
+	return ticks + delta;
+}
+
+/* extends raw to 64 bit. The counter only runs forward, so however long
+ * ago the last value was, it's taken as a wrap unless raw is just a little
+ * behind, see TIMESTAMP_BACKSTEP_SHIFT */
+guint64
+gst_dreamsource_timestamp_unwrap (TimestampUnit *unit, guint64 raw)
+{
+	guint64 delta;
+
+	raw &= unit->mask;
+
+	if (G_UNLIKELY (!unit->valid))
+	{
+		unit->last_ticks = raw + (guint64) unit->epoch * (unit->mask + 1);
+		unit->valid = TRUE;
+	}
+	else
+	{
+		delta = (raw - unit->last_raw) & unit->mask;
+		if (delta > unit->mask - (unit->mask >> TIMESTAMP_BACKSTEP_SHIFT))
+			unit->last_ticks -= (unit->last_raw - raw) & unit->mask;
+		else
+			unit->last_ticks += delta;
+	}
+
+	unit->last_raw = raw;
+	return unit->last_ticks;
+}
+
+static inline guint64
+gst_dreamsource_timestamp_scale (const TimestampUnit *unit, guint64 d)
+{
+	return d * unit->quot + ((d * unit->rem * unit->magic) >> unit->shift);
+}
+
+GstClockTime
+gst_dreamsource_timestamp_to_time (TimestampUnit *unit, guint64 ticks)
+{
+	while (G_UNLIKELY (ticks - unit->base_ticks >= unit->chunk && ticks > unit->base_ticks))
+	{
+		unit->base_ticks += unit->chunk_ticks;
+		unit->base_time += unit->chunk_time;
+	}
+	while (G_UNLIKELY (ticks < unit->base_ticks))
+	{
+		unit->base_ticks -= unit->chunk_ticks;
+		unit->base_time -= unit->chunk_time;
+	}
+	return unit->base_time + gst_dreamsource_timestamp_scale (unit, ticks - unit->base_ticks);
+}
+
+/* duration of one counter period */
+GstClockTime
+gst_dreamsource_timestamp_wrap_time (TimestampUnit *unit)
+{
+	return gst_util_uint64_scale (unit->mask + 1, unit->quot * unit->den + unit->rem, unit->den);
+}
+
+void
+gst_dreamsource_calibration_update (TimestampCalibration *cal, GstClock *clock)
+{
+	gst_clock_get_calibration (clock, &cal->internal, &cal->external, &cal->rate_n, &cal->rate_d);
+}
+
+/* maps an internal time of the calibrated clock to its external time */
+GstClockTime
+gst_dreamsource_calibration_apply (const TimestampCalibration *cal, GstClockTime internal)
+{
+	/* unslaved clocks only have an offset */
+	if (G_LIKELY (cal->rate_n == cal->rate_d))
+		return cal->external + internal - cal->internal;
+
+	if (cal->internal > internal)
+		return cal->external - gst_util_uint64_scale (cal->internal - internal, cal->rate_n, cal->rate_d);
+	return cal->external + gst_util_uint64_scale (internal - cal->internal, cal->rate_n, cal->rate_d);
+}
@@ -0,0 +1,85 @@
+/*
+ * GStreamer dreamsource timestamp conversion
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMTIMESTAMP_H__
+#define __GST_DREAMTIMESTAMP_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _TimestampUnit TimestampUnit;
+typedef struct _TimestampCalibration TimestampCalibration;
+
+#define MPEG_TIMESTAMP_BITS     33
+#define MPEG_TIMESTAMP_RATE     90000
+#define STC_BITS                32
+#define STC_RATE                27000000
+
+/* unwraps a free running counter of `bits' width into a 64 bit tick count
+ * and converts ticks to GstClockTime without 128 bit arithmetic:
+ *
+ *   ticks * GST_SECOND / rate = d * quot + (d * rem) / den + base_time
+ *
+ * with d = ticks - base_ticks kept below 2^31, so the division by den is
+ * an exact multiply-shift. base_ticks only moves in multiples of den, so
+ * base_time is always exact. */
+struct _TimestampUnit {
+	guint    bits;
+	guint64  mask;
+
+	/* unwrapping */
+	gboolean valid;
+	gint     epoch;            /* wraps added to the first value */
+	guint64  last_raw;
+	guint64  last_ticks;
+
+	/* conversion, see above */
+	guint32  quot, rem, den;
+	guint64  magic;
+	guint    shift;
+	guint64  chunk;            /* max. distance to the base */
+	guint64  chunk_ticks;      /* multiple of den below chunk */
+	GstClockTime chunk_time;
+	guint64  base_ticks;
+	GstClockTime base_time;
+};
+
+/* a clock's calibration, refreshed once per encoder read instead of per frame */
+struct _TimestampCalibration {
+	GstClockTime internal;
+	GstClockTime external;
+	GstClockTime rate_n;
+	GstClockTime rate_d;
+};
+
+void gst_dreamsource_timestamp_init (TimestampUnit *unit, guint bits, guint rate);
+void gst_dreamsource_timestamp_reset (TimestampUnit *unit);
+void gst_dreamsource_timestamp_shift_epoch (TimestampUnit *unit, gint wraps);
+GstClockTime gst_dreamsource_timestamp_align (TimestampUnit *unit, GstClockTime time, GstClockTime *reference);
+guint64 gst_dreamsource_timestamp_unwrap (TimestampUnit *unit, guint64 raw);
+guint64 gst_dreamsource_timestamp_unwrap_near (TimestampUnit *unit, guint64 raw, guint64 ticks);
+GstClockTime gst_dreamsource_timestamp_to_time (TimestampUnit *unit, guint64 ticks);
+GstClockTime gst_dreamsource_timestamp_wrap_time (TimestampUnit *unit);
+
+void gst_dreamsource_calibration_update (TimestampCalibration *cal, GstClock *clock);
+GstClockTime gst_dreamsource_calibration_apply (const TimestampCalibration *cal, GstClockTime internal);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMTIMESTAMP_H__ */
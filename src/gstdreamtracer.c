@@ -0,0 +1,101 @@
+/*
+ * GStreamer dreamsource timestamp tracer
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstdreamtracer.h"
+
+GST_DEBUG_CATEGORY_STATIC (dreamsourcetracer_debug);
+#define GST_CAT_DEFAULT dreamsourcetracer_debug
+
+G_DEFINE_TYPE (GstDreamSourceTracer, gst_dreamsource_tracer, GST_TYPE_TRACER);
+
+gint gst_dreamsource_tracers = 0;
+
+static GstTracerRecord *tr_timestamps;
+
+static GstStructure *
+gst_dreamsource_tracer_time_field (const gchar * description)
+{
+	return gst_structure_new ("value",
+		"type", G_TYPE_GTYPE, G_TYPE_UINT64,
+		"description", G_TYPE_STRING, description,
+		"min", G_TYPE_UINT64, G_GUINT64_CONSTANT (0),
+		"max", G_TYPE_UINT64, G_MAXUINT64,
+		NULL);
+}
+
+static void
+gst_dreamsource_tracer_finalize (GObject * object)
+{
+	g_atomic_int_add (&gst_dreamsource_tracers, -1);
+	G_OBJECT_CLASS (gst_dreamsource_tracer_parent_class)->finalize (object);
+}
+
+static void
+gst_dreamsource_tracer_class_init (GstDreamSourceTracerClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+	gobject_class->finalize = gst_dreamsource_tracer_finalize;
+
+	tr_timestamps = gst_tracer_record_new ("dreamsource-timestamps.class",
+		"element", GST_TYPE_STRUCTURE, gst_structure_new ("scope",
+			"type", G_TYPE_GTYPE, G_TYPE_STRING,
+			"related-to", GST_TYPE_TRACER_VALUE_SCOPE, GST_TRACER_VALUE_SCOPE_ELEMENT,
+			NULL),
+		"base-time", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("element base time"),
+		"clock-time", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("encoder clock internal time at read"),
+		"encoder-dts", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("DTS delivered by the encoder"),
+		"encoder-pts", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("PTS delivered by the encoder"),
+		"orig-time", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("encoder timestamp minus dts offset"),
+		"calib-time", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("orig-time after clock calibration"),
+		"internal", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("calibration internal time"),
+		"external", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("calibration external time"),
+		"rate-num", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("calibration rate numerator"),
+		"rate-denom", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("calibration rate denominator"),
+		"result-dts", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("buffer DTS"),
+		"result-pts", GST_TYPE_STRUCTURE, gst_dreamsource_tracer_time_field ("buffer PTS"),
+		NULL);
+	GST_OBJECT_FLAG_SET (tr_timestamps, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+}
+
+static void
+gst_dreamsource_tracer_init (GstDreamSourceTracer * self)
+{
+	g_atomic_int_add (&gst_dreamsource_tracers, 1);
+	GST_DEBUG_OBJECT (self, "timestamp tracing enabled");
+}
+
+void
+gst_dreamsource_tracer_log_timestamps (GstElement * element, const DreamSourceTimestamps * ts)
+{
+	gst_tracer_record_log (tr_timestamps, GST_OBJECT_NAME (element),
+		ts->base_time, ts->clock_time, ts->encoder_dts, ts->encoder_pts,
+		ts->orig_time, ts->calib_time, ts->internal, ts->external, ts->rate_n, ts->rate_d,
+		ts->result_dts, ts->result_pts);
+}
+
+gboolean
+gst_dreamsource_tracer_plugin_init (GstPlugin * plugin)
+{
+	GST_DEBUG_CATEGORY_INIT (dreamsourcetracer_debug, "dreamsourcetracer", 0, "dreamsourcetracer");
+	return gst_tracer_register (plugin, "dreamsourcetimestamps", GST_TYPE_DREAMSOURCE_TRACER);
+}
@@ -0,0 +1,74 @@
+/*
+ * GStreamer dreamsource timestamp tracer
+ * Copyright 2014-2015 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GST_DREAMTRACER_H__
+#define __GST_DREAMTRACER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DREAMSOURCE_TRACER \
+  (gst_dreamsource_tracer_get_type())
+#define GST_DREAMSOURCE_TRACER(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_DREAMSOURCE_TRACER,GstDreamSourceTracer))
+
+typedef struct _GstDreamSourceTracer       GstDreamSourceTracer;
+typedef struct _GstDreamSourceTracerClass  GstDreamSourceTracerClass;
+typedef struct _DreamSourceTimestamps      DreamSourceTimestamps;
+
+/* attach with GST_TRACERS=dreamsourcetimestamps, records are logged to the
+ * GST_TRACER debug category like those of the core tracers */
+struct _GstDreamSourceTracer
+{
+	GstTracer parent;
+};
+
+struct _GstDreamSourceTracerClass
+{
+	GstTracerClass parent_class;
+};
+
+/* how one frame's timestamps were derived in the read thread */
+struct _DreamSourceTimestamps {
+	GstClockTime base_time;
+	GstClockTime clock_time;      /* encoder clock's internal time at read () */
+	GstClockTime encoder_dts;     /* as delivered by the encoder */
+	GstClockTime encoder_pts;
+	GstClockTime orig_time;       /* encoder_dts - dts_offset */
+	GstClockTime calib_time;      /* orig_time after applying the clock calibration */
+	GstClockTime internal;        /* calibration */
+	GstClockTime external;
+	GstClockTime rate_n;
+	GstClockTime rate_d;
+	GstClockTime result_dts;      /* buffer timestamps */
+	GstClockTime result_pts;
+};
+
+/* number of attached tracers, read without synchronisation in the hot path */
+extern gint gst_dreamsource_tracers;
+
+#define GST_DREAMSOURCE_TRACING            G_UNLIKELY (gst_dreamsource_tracers > 0)
+
+GType gst_dreamsource_tracer_get_type (void);
+gboolean gst_dreamsource_tracer_plugin_init (GstPlugin * plugin);
+void gst_dreamsource_tracer_log_timestamps (GstElement * element, const DreamSourceTimestamps * ts);
+
+G_END_DECLS
+
+#endif /* __GST_DREAMTRACER_H__ */
@@ -43,9 +43,63 @@ GType gst_dreamvideosource_input_mode_get_type (void)
 	return (GType) input_mode_type;
 }
 
+GType gst_dreamvideosource_inject_headers_get_type (void)
+{
+	static volatile gsize inject_headers_type = 0;
+	static const GEnumValue inject_headers[] = {
+		{GST_DREAMVIDEOSOURCE_INJECT_HEADERS_NEVER, "GST_DREAMVIDEOSOURCE_INJECT_HEADERS_NEVER", "never"},
+		{GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ON_CHANGE, "GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ON_CHANGE", "on-change"},
+		{GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ALWAYS, "GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ALWAYS", "always"},
+		{0, NULL, NULL},
+	};
+
+	if (g_once_init_enter (&inject_headers_type)) {
+		GType tmp = g_enum_register_static ("GstDreamVideoSourceInjectHeaders", inject_headers);
+		g_once_init_leave (&inject_headers_type, tmp);
+	}
+	return (GType) inject_headers_type;
+}
+
+GType gst_dreamvideosource_tune_get_type (void)
+{
+	static volatile gsize tune_type = 0;
+	static const GEnumValue tune[] = {
+		{GST_DREAMVIDEOSOURCE_TUNE_NONE, "GST_DREAMVIDEOSOURCE_TUNE_NONE", "none"},
+		{GST_DREAMVIDEOSOURCE_TUNE_ZEROLATENCY, "GST_DREAMVIDEOSOURCE_TUNE_ZEROLATENCY", "zerolatency"},
+		{0, NULL, NULL},
+	};
+
+	if (g_once_init_enter (&tune_type)) {
+		GType tmp = g_enum_register_static ("GstDreamVideoSourceTune", tune);
+		g_once_init_leave (&tune_type, tmp);
+	}
+	return (GType) tune_type;
+}
+
+GType gst_dreamvideosource_overflow_policy_get_type (void)
+{
+	static volatile gsize overflow_policy_type = 0;
+	static const GEnumValue overflow_policy[] = {
+		{GST_DREAMVIDEOSOURCE_OVERFLOW_LEAKY, "GST_DREAMVIDEOSOURCE_OVERFLOW_LEAKY", "leaky"},
+		{GST_DREAMVIDEOSOURCE_OVERFLOW_KEYFRAME, "GST_DREAMVIDEOSOURCE_OVERFLOW_KEYFRAME", "keyframe"},
+		{GST_DREAMVIDEOSOURCE_OVERFLOW_NON_REFERENCE, "GST_DREAMVIDEOSOURCE_OVERFLOW_NON_REFERENCE", "non-reference"},
+		{GST_DREAMVIDEOSOURCE_OVERFLOW_BLOCK, "GST_DREAMVIDEOSOURCE_OVERFLOW_BLOCK", "block"},
+		{0, NULL, NULL},
+	};
+
+	if (g_once_init_enter (&overflow_policy_type)) {
+		GType tmp = g_enum_register_static ("GstDreamVideoSourceOverflowPolicy", overflow_policy);
+		g_once_init_leave (&overflow_policy_type, tmp);
+	}
+	return (GType) overflow_policy_type;
+}
+
 enum
 {
 	SIGNAL_GET_DTS_OFFSET,
+	SIGNAL_GET_GOP_CACHE,
+	SIGNAL_TIMESHIFT_SEEK,
+	SIGNAL_TIMESHIFT_READ,
 	LAST_SIGNAL
 };
 
@@ -62,6 +116,27 @@ enum
 	ARG_PFRAMES,
 	ARG_SLICES,
 	ARG_LEVEL,
+	ARG_RELEASE_MODE,
+	ARG_MAX_FRAMES_IN_FLIGHT,
+	ARG_FRAMES_IN_FLIGHT,
+	ARG_RING_OCCUPANCY,
+	ARG_BATCH,
+	ARG_STATS,
+	ARG_CLOCK_MODE,
+	ARG_DEVICE_INDEX,
+	ARG_SHARED_REACTOR,
+	ARG_ABR,
+	ARG_ABR_MIN_BITRATE,
+	ARG_ABR_MAX_BITRATE,
+	ARG_THROUGHPUT_ESTIMATE,
+	ARG_KEYFRAME_INDEX,
+	ARG_INJECT_HEADERS,
+	ARG_GOP_CACHE_SIZE,
+	ARG_TIMESHIFT_LOCATION,
+	ARG_TIMESHIFT_SIZE,
+	ARG_TIMESHIFT_WINDOW,
+	ARG_TUNE,
+	ARG_OVERFLOW_POLICY,
 };
 
 static guint gst_dreamvideosource_signals[LAST_SIGNAL] = { 0 };
@@ -78,18 +153,72 @@ static guint gst_dreamvideosource_signals[LAST_SIGNAL] = { 0 };
 #define DEFAULT_HEIGHT      720
 #define DEFAULT_INPUT_MODE  GST_DREAMVIDEOSOURCE_INPUT_MODE_LIVE
 #define DEFAULT_BUFFER_SIZE 50
+#define DEFAULT_TUNE        GST_DREAMVIDEOSOURCE_TUNE_NONE
+#define ZEROLATENCY_BUFFER_SIZE 1
+#define ZEROLATENCY_SLICES  4
+#define DEFAULT_OVERFLOW_POLICY GST_DREAMVIDEOSOURCE_OVERFLOW_LEAKY
+#define DEFAULT_RELEASE_MODE GST_DREAMSOURCE_RELEASE_MODE_IMMEDIATE
+#define DEFAULT_MAX_FRAMES_IN_FLIGHT 128
+#define DEFAULT_BATCH       FALSE
+#define DEFAULT_CLOCK_MODE  GST_DREAMSOURCE_CLOCK_MODE_DIRECT
+#define DEFAULT_DEVICE_INDEX GST_DREAMSOURCE_DEVICE_INDEX_AUTO
+#define DEFAULT_SHARED_REACTOR FALSE
+#define DEFAULT_GOP_CACHE_SIZE 0
+#define DEFAULT_TIMESHIFT_LOCATION NULL
+#define DEFAULT_TIMESHIFT_SIZE (G_GUINT64_CONSTANT (512) * 1024 * 1024)
+#define DEFAULT_TIMESHIFT_READ_FRAMES 64
+#define DEFAULT_ABR         FALSE
+#define DEFAULT_ABR_MIN_BITRATE 256
+#define DEFAULT_ABR_MAX_BITRATE 0
+#define DEFAULT_THROUGHPUT_ESTIMATE 0
+#define DEFAULT_INJECT_HEADERS GST_DREAMVIDEOSOURCE_INJECT_HEADERS_NEVER
+
+#define DREAMVIDEOSOURCE_CAPS "video/x-h264, " \
+	"width = (int) [ 128, 1920 ], " \
+	"height = (int) [ 96, 1080 ], " \
+	"framerate = (fraction) [ 1/1, 60/1 ], " \
+	"display-aspect-ratio = (fraction) [ 1/1, 2/1 ], " \
+	"profile = (string) { main, high }"
+
+/* what drivers without fmt_custom and rate_custom can do */
+#define DREAMVIDEOSOURCE_FIXED_RATES \
+	"video/x-h264, framerate = (fraction) { 24000/1001, 24/1, 25/1, 30000/1001, 30/1, 50/1, 60000/1001, 60/1 }"
+#define DREAMVIDEOSOURCE_FIXED_FORMATS \
+	"video/x-h264, width = (int) 720, height = (int) 576, display-aspect-ratio = (fraction) { 5/4, 16/9 }; " \
+	"video/x-h264, width = (int) 1280, height = (int) 720, display-aspect-ratio = (fraction) 16/9; " \
+	"video/x-h264, width = (int) 1920, height = (int) 1080, display-aspect-ratio = (fraction) 16/9"
+
+static const struct {
+	gint fps_n, fps_d;
+	enum venc_framerate rate;
+} venc_framerates[] = {
+	{ 25, 1, rate_25 },
+	{ 30, 1, rate_30 },
+	{ 50, 1, rate_50 },
+	{ 60, 1, rate_60 },
+	{ 24000, 1001, rate_23_976 },
+	{ 24, 1, rate_24 },
+	{ 30000, 1001, rate_29_97 },
+	{ 60000, 1001, rate_59_94 }
+};
+
+static const struct {
+	gint width, height;
+	enum venc_videoformat format;
+} venc_formats[] = {
+	{ 720, 576, fmt_720x576 },
+	{ 1280, 720, fmt_1280x720 },
+	{ 1920, 1080, fmt_1920x1080 }
+};
 
+/* without alignment every encoder descriptor is a buffer of its own */
 static GstStaticPadTemplate srctemplate =
     GST_STATIC_PAD_TEMPLATE ("src",
 	GST_PAD_SRC,
 	GST_PAD_ALWAYS,
-	GST_STATIC_CAPS	("video/x-h264, "
-	"width = { 720, 1280, 1920 }, "
-	"height = { 576, 720, 1080 }, "
-	"framerate = { 25/1, 30/1, 50/1, 60/1 }, "
-	"display-aspect-ratio = { 5/4, 16/9 }, "
-	"stream-format = (string) byte-stream, "
-	"profile = (string) { main, high }")
+	GST_STATIC_CAPS	(DREAMVIDEOSOURCE_CAPS ", stream-format = (string) byte-stream; "
+	DREAMVIDEOSOURCE_CAPS ", stream-format = (string) byte-stream, alignment = (string) au; "
+	DREAMVIDEOSOURCE_CAPS ", stream-format = (string) avc, alignment = (string) au")
     );
 
 #define gst_dreamvideosource_parent_class parent_class
@@ -98,7 +227,9 @@ G_DEFINE_TYPE (GstDreamVideoSource, gst_dreamvideosource, GST_TYPE_PUSH_SRC);
 static GstCaps *gst_dreamvideosource_getcaps (GstBaseSrc * bsrc, GstCaps * filter);
 static gboolean gst_dreamvideosource_setcaps (GstBaseSrc * bsrc, GstCaps * caps);
 static GstCaps *gst_dreamvideosource_fixate (GstBaseSrc * bsrc, GstCaps * caps);
+static gboolean gst_dreamvideosource_negotiate (GstBaseSrc * bsrc);
 static gboolean gst_dreamvideosource_query (GstBaseSrc * bsrc, GstQuery * query);
+static gboolean gst_dreamvideosource_event (GstBaseSrc * bsrc, GstEvent * event);
 
 static gboolean gst_dreamvideosource_unlock (GstBaseSrc * bsrc);
 static gboolean gst_dreamvideosource_unlock_stop (GstBaseSrc * bsrc);
@@ -110,9 +241,13 @@ static void gst_dreamvideosource_get_property (GObject * object, guint prop_id,
 
 static GstStateChangeReturn gst_dreamvideosource_change_state (GstElement * element, GstStateChange transition);
 static gint64 gst_dreamvideosource_get_dts_offset (GstDreamVideoSource *self);
+static GstBufferList *gst_dreamvideosource_get_gop_cache (GstDreamVideoSource *self, guint64 since);
+static guint64 gst_dreamvideosource_timeshift_seek (GstDreamVideoSource *self, guint64 time);
+static GstBufferList *gst_dreamvideosource_timeshift_read (GstDreamVideoSource *self, guint64 sequence, guint max_frames);
 
 static gboolean gst_dreamvideosource_encoder_init (GstDreamVideoSource * self);
 static void gst_dreamvideosource_encoder_release (GstDreamVideoSource * self);
+static gboolean gst_dreamvideosource_defer (GstDreamVideoSource * self, DreamSourceCommandType type, guint32 value);
 
 static void gst_dreamvideosource_read_thread_func (GstDreamVideoSource * self);
 
@@ -151,7 +286,9 @@ gst_dreamvideosource_class_init (GstDreamVideoSourceClass * klass)
 	gstbsrc_class->get_caps = gst_dreamvideosource_getcaps;
  	gstbsrc_class->set_caps = gst_dreamvideosource_setcaps;
 	gstbsrc_class->query = gst_dreamvideosource_query;
+	gstbsrc_class->event = gst_dreamvideosource_event;
  	gstbsrc_class->fixate = gst_dreamvideosource_fixate;
+	gstbsrc_class->negotiate = gst_dreamvideosource_negotiate;
 	gstbsrc_class->unlock = gst_dreamvideosource_unlock;
 	gstbsrc_class->unlock_stop = gst_dreamvideosource_unlock_stop;
 
@@ -213,6 +350,127 @@ gst_dreamvideosource_class_init (GstDreamVideoSourceClass * klass)
 	    GST_TYPE_DREAMVIDEOSOURCE_INPUT_MODE, DEFAULT_INPUT_MODE,
 	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+	g_object_class_install_property (gobject_class, ARG_RELEASE_MODE,
+	  g_param_spec_enum ("release-mode", "Descriptor release mode",
+	    "When to give encoder descriptors back to the driver (takes effect in NULL state)",
+	    GST_TYPE_DREAMSOURCE_RELEASE_MODE, DEFAULT_RELEASE_MODE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_MAX_FRAMES_IN_FLIGHT,
+	  g_param_spec_uint ("max-frames-in-flight", "Max. frames in flight",
+	    "Stop reading from the encoder while this many descriptors are still referenced (tracked release mode only)",
+	    1, 4096, DEFAULT_MAX_FRAMES_IN_FLIGHT,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_FRAMES_IN_FLIGHT,
+	  g_param_spec_uint ("frames-in-flight", "Frames in flight",
+	    "Number of descriptors still referenced downstream (tracked release mode only)",
+	    0, G_MAXUINT, 0,
+	    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_RING_OCCUPANCY,
+	  g_param_spec_uint ("ring-occupancy", "Ring occupancy",
+	    "Bytes of the encoder ring still referenced downstream (tracked release mode only)",
+	    0, VMMAPSIZE, 0,
+	    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_BATCH,
+	  g_param_spec_boolean ("batch", "Batch descriptors",
+	    "Turn all descriptors of one encoder read into buffers before waking up the streaming thread",
+	    DEFAULT_BATCH, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_STATS,
+	  g_param_spec_boxed ("stats", "Statistics",
+	    "Read path counters, read-to-push latency percentiles and the encoder's capture-to-read latency since the last READY to PAUSED transition",
+	    GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_CLOCK_MODE,
+	  g_param_spec_enum ("clock-mode", "Clock mode",
+	    "Read the encoder STC on every clock query or interpolate between periodic reads",
+	    GST_TYPE_DREAMSOURCE_CLOCK_MODE, DEFAULT_CLOCK_MODE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_DEVICE_INDEX,
+	  g_param_spec_int ("device-index", "Device index",
+	    "Encoder device to use, -1 picks the one paired with the audio source of this pipeline or the first free one (takes effect in NULL state)",
+	    GST_DREAMSOURCE_DEVICE_INDEX_AUTO, GST_DREAMSOURCE_MAX_DEVICES - 1, DEFAULT_DEVICE_INDEX,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_SHARED_REACTOR,
+	  g_param_spec_boolean ("shared-reactor", "Shared reactor",
+	    "Read from the encoder on the one epoll thread shared by all dreamsource elements instead of a thread of its own (takes effect in READY state)",
+	    DEFAULT_SHARED_REACTOR, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_ABR,
+	  g_param_spec_boolean ("abr", "Adaptive bitrate",
+	    "Lower the bitrate when downstream falls behind (queue fill, QoS, throughput-estimate) and raise it again once it keeps up",
+	    DEFAULT_ABR, G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_ABR_MIN_BITRATE,
+	  g_param_spec_int ("abr-min-bitrate", "Adaptive bitrate minimum",
+	    "Lowest bitrate in kbit/sec the adaptive bitrate control may choose (takes effect in READY state)",
+	    bitrate_min, bitrate_max, DEFAULT_ABR_MIN_BITRATE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_ABR_MAX_BITRATE,
+	  g_param_spec_int ("abr-max-bitrate", "Adaptive bitrate maximum",
+	    "Highest bitrate in kbit/sec the adaptive bitrate control may choose, 0 for the bitrate at start (takes effect in READY state)",
+	    0, bitrate_max, DEFAULT_ABR_MAX_BITRATE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_THROUGHPUT_ESTIMATE,
+	  g_param_spec_int ("throughput-estimate", "Throughput estimate",
+	    "Application's estimate of the available uplink in kbit/sec, the adaptive bitrate control stays below it, 0 for none",
+	    0, G_MAXINT / 1000, DEFAULT_THROUGHPUT_ESTIMATE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_KEYFRAME_INDEX,
+	  g_param_spec_boxed ("keyframe-index", "Keyframe index",
+	    "Timestamps and stream byte offsets of the most recent keyframes since the last READY to PAUSED transition",
+	    GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_GOP_CACHE_SIZE,
+	  g_param_spec_uint ("gop-cache-size", "GOP cache size",
+	    "Bytes of the current GOP kept for consumers attaching later, see get-gop-cache, 0 disables it (takes effect in READY state)",
+	    0, G_MAXINT, DEFAULT_GOP_CACHE_SIZE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_TIMESHIFT_LOCATION,
+	  g_param_spec_string ("timeshift-location", "Time-shift location",
+	    "File the encoded stream is also written to as a ring for seeking back with timeshift-seek and timeshift-read, NULL disables it (takes effect in READY state)",
+	    DEFAULT_TIMESHIFT_LOCATION,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_TIMESHIFT_SIZE,
+	  g_param_spec_uint64 ("timeshift-size", "Time-shift size",
+	    "Bytes preallocated for timeshift-location, the oldest frames are overwritten once it is full (takes effect in READY state)",
+	    1024 * 1024, G_MAXUINT64, DEFAULT_TIMESHIFT_SIZE,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_TIMESHIFT_WINDOW,
+	  g_param_spec_boxed ("timeshift-window", "Time-shift window",
+	    "Time and sequence range currently held in timeshift-location",
+	    GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_INJECT_HEADERS,
+	  g_param_spec_enum ("inject-headers", "Inject headers",
+	    "Put the latest SPS/PPS in front of keyframes which don't carry them, so clients joining mid-stream can start decoding at the next keyframe",
+	    GST_TYPE_DREAMVIDEOSOURCE_INJECT_HEADERS, DEFAULT_INJECT_HEADERS,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/* not a construct property, it sets other properties which would override it */
+	g_object_class_install_property (gobject_class, ARG_TUNE,
+	  g_param_spec_enum ("tune", "Tune",
+	    "zerolatency sets bframes=0, batch=false and slices (unless some were set) right away, none puts them back. From the next READY to PAUSED on it queues a single access unit, dropping older ones, and outputs access units even for byte-stream caps without alignment. Properties set later override it",
+	    GST_TYPE_DREAMVIDEOSOURCE_TUNE, DEFAULT_TUNE,
+	    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property (gobject_class, ARG_OVERFLOW_POLICY,
+	  g_param_spec_enum ("overflow-policy", "Overflow policy",
+	    "What to drop when the internal queue is full, block holds the descriptors in the encoder ring instead. non-reference needs alignment=au to tell which pictures are droppable, otherwise it acts like keyframe",
+	    GST_TYPE_DREAMVIDEOSOURCE_OVERFLOW_POLICY, DEFAULT_OVERFLOW_POLICY,
+	    G_PARAM_CONSTRUCT | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
 	gst_dreamvideosource_signals[SIGNAL_GET_DTS_OFFSET] =
 		g_signal_new ("get-dts-offset",
 		G_TYPE_FROM_CLASS (klass),
@@ -220,7 +478,31 @@ gst_dreamvideosource_class_init (GstDreamVideoSourceClass * klass)
 		G_STRUCT_OFFSET (GstDreamVideoSourceClass, get_dts_offset),
 		NULL, NULL, gst_dreamsource_marshal_INT64__VOID, G_TYPE_INT64, 0);
 
+	gst_dreamvideosource_signals[SIGNAL_GET_GOP_CACHE] =
+		g_signal_new ("get-gop-cache",
+		G_TYPE_FROM_CLASS (klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET (GstDreamVideoSourceClass, get_gop_cache),
+		NULL, NULL, gst_dreamsource_marshal_BOXED__UINT64, GST_TYPE_BUFFER_LIST, 1, G_TYPE_UINT64);
+
+	gst_dreamvideosource_signals[SIGNAL_TIMESHIFT_SEEK] =
+		g_signal_new ("timeshift-seek",
+		G_TYPE_FROM_CLASS (klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET (GstDreamVideoSourceClass, timeshift_seek),
+		NULL, NULL, gst_dreamsource_marshal_UINT64__UINT64, G_TYPE_UINT64, 1, G_TYPE_UINT64);
+
+	gst_dreamvideosource_signals[SIGNAL_TIMESHIFT_READ] =
+		g_signal_new ("timeshift-read",
+		G_TYPE_FROM_CLASS (klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET (GstDreamVideoSourceClass, timeshift_read),
+		NULL, NULL, gst_dreamsource_marshal_BOXED__UINT64_UINT, GST_TYPE_BUFFER_LIST, 2, G_TYPE_UINT64, G_TYPE_UINT);
+
 	klass->get_dts_offset = gst_dreamvideosource_get_dts_offset;
+	klass->get_gop_cache = gst_dreamvideosource_get_gop_cache;
+	klass->timeshift_seek = gst_dreamvideosource_timeshift_seek;
+	klass->timeshift_read = gst_dreamvideosource_timeshift_read;
 }
 
 static gint64
@@ -230,6 +512,91 @@ gst_dreamvideosource_get_dts_offset (GstDreamVideoSource *self)
 	return self->dts_offset;
 }
 
+static GstBufferList *
+gst_dreamvideosource_get_gop_cache (GstDreamVideoSource *self, guint64 since)
+{
+	GstBufferList *list = gst_dreamsource_gop_cache_get (&self->gop_cache, since);
+	GST_DEBUG_OBJECT (self, "gst_dreamvideosource_get_gop_cache since %" GST_TIME_FORMAT ": %u buffers", GST_TIME_ARGS (since), gst_buffer_list_length (list));
+	return list;
+}
+
+/* the time-shift file outlives the read loop only as long as a caller
+ * still holds on to it */
+static Timeshift *
+gst_dreamvideosource_get_timeshift (GstDreamVideoSource *self)
+{
+	Timeshift *ts = NULL;
+
+	GST_OBJECT_LOCK (self);
+	if (self->timeshift)
+		ts = gst_dreamsource_timeshift_ref (self->timeshift);
+	GST_OBJECT_UNLOCK (self);
+	return ts;
+}
+
+static guint64
+gst_dreamvideosource_timeshift_seek (GstDreamVideoSource *self, guint64 time)
+{
+	Timeshift *ts = gst_dreamvideosource_get_timeshift (self);
+	guint64 sequence = TIMESHIFT_SEQUENCE_NONE;
+
+	if (ts)
+	{
+		sequence = gst_dreamsource_timeshift_seek (ts, time);
+		gst_dreamsource_timeshift_unref (ts);
+	}
+	GST_DEBUG_OBJECT (self, "gst_dreamvideosource_timeshift_seek %" GST_TIME_FORMAT ": sequence %" G_GUINT64_FORMAT, GST_TIME_ARGS (time), sequence);
+	return sequence;
+}
+
+static GstBufferList *
+gst_dreamvideosource_timeshift_read (GstDreamVideoSource *self, guint64 sequence, guint max_frames)
+{
+	Timeshift *ts = gst_dreamvideosource_get_timeshift (self);
+	GstBufferList *list;
+
+	if (!ts)
+		return gst_buffer_list_new ();
+	list = gst_dreamsource_timeshift_read (ts, sequence, max_frames ? max_frames : DEFAULT_TIMESHIFT_READ_FRAMES);
+	gst_dreamsource_timeshift_unref (ts);
+	GST_DEBUG_OBJECT (self, "gst_dreamvideosource_timeshift_read from %" G_GUINT64_FORMAT ": %u buffers", sequence, gst_buffer_list_length (list));
+	return list;
+}
+
+static void
+gst_dreamvideosource_timeshift_start (GstDreamVideoSource *self, guint max_queued, gboolean copy)
+{
+	Timeshift *ts;
+
+	if (!self->timeshift_location)
+		return;
+	ts = gst_dreamsource_timeshift_new (self->timeshift_location, self->timeshift_size, max_queued, copy);
+	if (!ts)
+	{
+		GST_ELEMENT_WARNING (self, RESOURCE, OPEN_WRITE, ("Can't set up time-shift file %s", self->timeshift_location), ("%s", strerror (errno)));
+		return;
+	}
+	GST_OBJECT_LOCK (self);
+	self->timeshift = ts;
+	GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_dreamvideosource_timeshift_stop (GstDreamVideoSource *self)
+{
+	Timeshift *ts;
+
+	GST_OBJECT_LOCK (self);
+	ts = self->timeshift;
+	self->timeshift = NULL;
+	GST_OBJECT_UNLOCK (self);
+	if (ts)
+	{
+		gst_dreamsource_timeshift_stop (ts);
+		gst_dreamsource_timeshift_unref (ts);
+	}
+}
+
 static void gst_dreamvideosource_set_bitrate (GstDreamVideoSource * self, uint32_t bitrate)
 {
 	g_mutex_lock (&self->mutex);
@@ -241,7 +608,7 @@ static void gst_dreamvideosource_set_bitrate (GstDreamVideoSource * self, uint32
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_BITRATE, &vbr);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_BITRATE, &vbr);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video bitrate to %i bytes/s!", vbr);
@@ -263,7 +630,7 @@ static void gst_dreamvideosource_set_goplen (GstDreamVideoSource * self, uint32_
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_GOP_LENGTH, &goplen);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_GOP_LENGTH, &goplen);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video gop length to %i ms!", goplen);
@@ -286,7 +653,7 @@ static void gst_dreamvideosource_set_gop_on_scene_change (GstDreamVideoSource *
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_NEW_GOP_ON_NEW_SCENE, &en);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_NEW_GOP_ON_NEW_SCENE, &en);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video new gop on new scene to %i (unspported?)!", enabled);
@@ -309,7 +676,7 @@ static void gst_dreamvideosource_set_open_gop (GstDreamVideoSource * self, gbool
 	}
 
 	uint32_t en = enabled;
-	int ret = ioctl(self->encoder->fd, VENC_SET_OPEN_GOP, &en);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_OPEN_GOP, &en);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video open gop to %i (unspported?)!", enabled);
@@ -331,7 +698,7 @@ static void gst_dreamvideosource_set_bframes (GstDreamVideoSource * self, uint32
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_B_FRAMES, &bframes);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_B_FRAMES, &bframes);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video b-frames %i!", bframes);
@@ -353,7 +720,7 @@ static void gst_dreamvideosource_set_pframes (GstDreamVideoSource * self, uint32
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_P_FRAMES, &pframes);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_P_FRAMES, &pframes);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video p-frames %i!", pframes);
@@ -375,7 +742,7 @@ static void gst_dreamvideosource_set_slices (GstDreamVideoSource * self, uint32_
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_SLICES_PER_PIC, &slices);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_SLICES_PER_PIC, &slices);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set video slices to %i %i!", slices, ret);
@@ -397,7 +764,7 @@ static void gst_dreamvideosource_set_level (GstDreamVideoSource * self, uint32_t
 		return;
 	}
 
-	int ret = ioctl(self->encoder->fd, VENC_SET_LEVEL, &level);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_LEVEL, &level);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set h264 level to %i %i!", level, ret);
@@ -409,6 +776,25 @@ static void gst_dreamvideosource_set_level (GstDreamVideoSource * self, uint32_t
 	g_mutex_unlock (&self->mutex);
 }
 
+/* compares fractions, so 50/2 is rate_25 and 30000/1001 isn't rate_30 */
+static int gst_dreamvideosource_venc_framerate (gint fps_n, gint fps_d)
+{
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS (venc_framerates); i++)
+		if ((gint64) fps_n * venc_framerates[i].fps_d == (gint64) venc_framerates[i].fps_n * fps_d)
+			return venc_framerates[i].rate;
+	return rate_custom;
+}
+
+static int gst_dreamvideosource_venc_format (gint width, gint height)
+{
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS (venc_formats); i++)
+		if (width == venc_formats[i].width && height == venc_formats[i].height)
+			return venc_formats[i].format;
+	return fmt_custom;
+}
+
 static gboolean gst_dreamvideosource_set_format (GstDreamVideoSource * self, VideoFormatInfo * info)
 {
 	g_mutex_lock (&self->mutex);
@@ -428,38 +814,29 @@ static gboolean gst_dreamvideosource_set_format (GstDreamVideoSource * self, Vid
 		return TRUE;
 	}
 
-	if (info->fps_n > 0)
+	if (info->fps_n > 0 && info->fps_d > 0)
 	{
-		int venc_fps = 0;
-		switch (info->fps_n) {
-			case 25:
-				venc_fps = rate_25;
-				break;
-			case 30:
-				venc_fps = rate_30;
-				break;
-			case 50:
-				venc_fps = rate_50;
-				break;
-			case 60:
-				venc_fps = rate_60;
-				break;
-			case 23:
-				venc_fps = rate_23_976;
-				break;
-			case 24:
-				venc_fps = rate_24;
-				break;
-			case 29:
-				venc_fps = rate_29_97;
-				break;
-			case 59:
-				venc_fps = rate_59_94;
-			default:
+		int venc_fps = gst_dreamvideosource_venc_framerate (info->fps_n, info->fps_d);
+		if (venc_fps == rate_custom)
+		{
+			if (!self->custom_framerates || info->fps_n > G_MAXUINT16 || info->fps_d > G_MAXUINT16)
+			{
 				GST_ERROR_OBJECT (self, "invalid framerate %d/%d", info->fps_n, info->fps_d);
 				goto fail;
+			}
+#ifdef VENC_SET_CUSTOM_FRAMERATE
+			unsigned int custom = info->fps_n << 16 | info->fps_d;
+			if (gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_CUSTOM_FRAMERATE, &custom))
+			{
+				GST_WARNING_OBJECT (self, "can't set custom framerate to %d/%d -> ioctrl(%d, VENC_SET_CUSTOM_FRAMERATE, &0x%08x)", info->fps_n, info->fps_d, self->encoder->fd, custom);
+				/* the driver doesn't know it after all, the caps stop offering it */
+				if (errno == ENOTTY)
+					self->custom_framerates = FALSE;
+				goto fail;
+			}
+#endif
 		}
-		if (!ioctl(self->encoder->fd, VENC_SET_FRAMERATE, &venc_fps))
+		if (!gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_FRAMERATE, &venc_fps))
 			GST_INFO_OBJECT (self, "set framerate to %d/%d -> ioctrl(%d, VENC_SET_FRAMERATE, &%d)", info->fps_n, info->fps_d, self->encoder->fd, venc_fps);
 		else
 		{
@@ -470,19 +847,27 @@ static gboolean gst_dreamvideosource_set_format (GstDreamVideoSource * self, Vid
 
 	if (info->width && info->height)
 	{
-		int venc_size = 0;
-		if ( info->width == 720 && info->height == 576 )
-			venc_size = fmt_720x576;
-		else if ( info->width == 1280 && info->height == 720)
-			venc_size = fmt_1280x720;
-		else if ( info->width == 1920 && info->height == 1080)
-			venc_size = fmt_1920x1080;
-		else
+		int venc_size = gst_dreamvideosource_venc_format (info->width, info->height);
+		if (venc_size == fmt_custom)
 		{
-			GST_ERROR_OBJECT (self, "invalid resolution %dx%d", info->width, info->height);
-			goto fail;
+			if (!self->custom_resolutions || info->width % 2 || info->height % 2 ||
+				info->width < VENC_CUSTOM_MIN_WIDTH || info->height < VENC_CUSTOM_MIN_HEIGHT || info->width > 1920 || info->height > 1080)
+			{
+				GST_ERROR_OBJECT (self, "invalid resolution %dx%d", info->width, info->height);
+				goto fail;
+			}
+#ifdef VENC_SET_CUSTOM_RESOLUTION
+			unsigned int custom = info->width << 16 | info->height;
+			if (gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_CUSTOM_RESOLUTION, &custom))
+			{
+				GST_WARNING_OBJECT (self, "can't set custom resolution to %dx%d -> ioctrl(%d, VENC_SET_CUSTOM_RESOLUTION, &0x%08x)", info->width, info->height, self->encoder->fd, custom);
+				if (errno == ENOTTY)
+					self->custom_resolutions = FALSE;
+				goto fail;
+			}
+#endif
 		}
-		if (!ioctl(self->encoder->fd, VENC_SET_RESOLUTION, &venc_size))
+		if (!gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_RESOLUTION, &venc_size))
 			GST_INFO_OBJECT (self, "set resolution to %dx%d -> ioctrl(%d, VENC_SET_RESOLUTION, &%d)", info->width, info->height, self->encoder->fd, venc_size);
 		else
 		{
@@ -491,7 +876,7 @@ static gboolean gst_dreamvideosource_set_format (GstDreamVideoSource * self, Vid
 		}
 	}
 
-	if(!ioctl(self->encoder->fd, VENC_SET_PROFILE, &info->profile))
+	if(!gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_PROFILE, &info->profile))
 		GST_INFO_OBJECT (self, "set profile to %d -> ioctl(%d, VENC_SET_PROFILE)", info->profile, self->encoder->fd);
 	else
 		GST_WARNING_OBJECT (self, "can't set profile to %d -> ioctl(%d, VENC_SET_PROFILE)", info->profile, self->encoder->fd);
@@ -523,7 +908,7 @@ void gst_dreamvideosource_set_input_mode (GstDreamVideoSource *self, GstDreamVid
 		goto out;
 	}
 	int int_mode = mode;
-	int ret = ioctl(self->encoder->fd, VENC_SET_SOURCE, &int_mode);
+	int ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_SET_SOURCE, &int_mode);
 	if (ret != 0)
 	{
 		GST_WARNING_OBJECT (self, "can't set input mode to %s (%i) error: %s", value_nick, mode, strerror(errno));
@@ -564,15 +949,44 @@ gst_dreamvideosource_init (GstDreamVideoSource * self)
 	self->encoder = NULL;
 	self->descriptors_available = 0;
 	self->input_mode = DEFAULT_INPUT_MODE;
+	self->custom_resolutions = FALSE;
+	self->custom_framerates = FALSE;
 
 	self->buffer_size = DEFAULT_BUFFER_SIZE;
-	g_queue_init (&self->current_frames);
+	self->frames = gst_dreamsource_frame_queue_new (self->buffer_size);
 	self->readthread = NULL;
 
+	self->release_mode = DEFAULT_RELEASE_MODE;
+	self->max_frames_in_flight = DEFAULT_MAX_FRAMES_IN_FLIGHT;
+	self->batch = DEFAULT_BATCH;
+	self->tune = DEFAULT_TUNE;
+	self->overflow_policy = DEFAULT_OVERFLOW_POLICY;
+	self->frame_ref_idc = -1;
+	self->clock_mode = DEFAULT_CLOCK_MODE;
+	self->device_index = DEFAULT_DEVICE_INDEX;
+	self->shared_reactor = DEFAULT_SHARED_REACTOR;
+	self->gop_cache_size = DEFAULT_GOP_CACHE_SIZE;
+	self->sync = NULL;
+	self->timeshift_location = NULL;
+	self->timeshift_size = DEFAULT_TIMESHIFT_SIZE;
+	self->timeshift = NULL;
+	gst_dreamsource_gop_cache_init (&self->gop_cache, FALSE);
+	self->reactor = NULL;
+	self->reactor_source = NULL;
+	self->inject_headers = DEFAULT_INJECT_HEADERS;
+	self->bitrate = DEFAULT_BITRATE;
+	self->abr = DEFAULT_ABR;
+	self->abr_min_bitrate = DEFAULT_ABR_MIN_BITRATE;
+	self->abr_max_bitrate = DEFAULT_ABR_MAX_BITRATE;
+	gst_dreamsource_abr_init (&self->abr_controller, self->abr_min_bitrate, bitrate_max);
+	gst_dreamsource_abr_set_estimate (&self->abr_controller, DEFAULT_THROUGHPUT_ESTIMATE);
+	gst_dreamsource_stats_reset (&self->stats);
+	gst_dreamsource_latency_reset (&self->latency);
+	gst_dreamsource_keyframe_index_init (&self->keyframes);
+	gst_dreamsource_timestamp_init (&self->dts_unit, MPEG_TIMESTAMP_BITS, MPEG_TIMESTAMP_RATE);
+
 	g_mutex_init (&self->mutex);
-	g_cond_init (&self->cond);
-	READ_SOCKET (self) = -1;
-	WRITE_SOCKET (self) = -1;
+	self->commands = gst_dreamsource_command_queue_new ();
 
 	gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
 	gst_base_src_set_live (GST_BASE_SRC (self), TRUE);
@@ -586,52 +1000,42 @@ gst_dreamvideosource_init (GstDreamVideoSource * self)
 #endif
 }
 
+static void gst_dreamvideosource_wakeup (GstDreamVideoSource * self)
+{
+	gst_dreamsource_command_queue_push (self->commands, COMMAND_WAKEUP, 0);
+}
+
 static gboolean gst_dreamvideosource_encoder_init (GstDreamVideoSource * self)
 {
 	GST_LOG_OBJECT (self, "initializating encoder...");
-	self->encoder = malloc (sizeof(EncoderInfo));
-
+	self->encoder = gst_dreamsource_device_acquire (ENCODER_KIND_VIDEO, self->device_index, GST_ELEMENT (self));
 	if (!self->encoder) {
-		GST_ERROR_OBJECT (self,"out of space");
-		return FALSE;
-	}
-
-	char fn_buf[32];
-	sprintf(fn_buf, "/dev/venc%d", 0);
-	self->encoder->fd = open(fn_buf, O_RDWR | O_SYNC);
-	if (self->encoder->fd <= 0) {
-		GST_ERROR_OBJECT (self,"cannot open device %s (%s)", fn_buf, strerror(errno));
-		free(self->encoder);
-		self->encoder = NULL;
+		GST_ERROR_OBJECT (self,"cannot acquire video encoder %i (%s)", self->device_index, strerror(errno));
 		return FALSE;
 	}
 
+	self->encoder->tracker = NULL;
+	gst_dreamsource_frame_queue_set_notify (self->frames, (FrameQueueNotify) gst_dreamvideosource_wakeup, self);
 	self->encoder->buffer = malloc(VBUFSIZE);
 	if (!self->encoder->buffer) {
 		GST_ERROR_OBJECT(self,"cannot alloc buffer");
 		return FALSE;
 	}
 
-	self->encoder->cdb = (unsigned char *)mmap (0, VMMAPSIZE, PROT_READ, MAP_PRIVATE, self->encoder->fd, 0);
-
-	if (!self->encoder->cdb || self->encoder->cdb == MAP_FAILED) {
+	if (!gst_dreamsource_encoder_mmap (self->encoder, VMMAPSIZE)) {
 		GST_ERROR_OBJECT(self, "cannot alloc buffer: %s (%i)", strerror(errno), errno);
-		self->encoder->cdb = NULL;
 		return FALSE;
 	}
 
-	int control_sock[2];
-	if (socketpair (PF_UNIX, SOCK_STREAM, 0, control_sock) < 0)
+	if (self->release_mode == GST_DREAMSOURCE_RELEASE_MODE_TRACKED)
 	{
-		GST_ERROR_OBJECT(self, "cannot create control sockets: %s (%i)", strerror(errno), errno);
-		return FALSE;
+		/* one read() never returns more than VBUFSIZE/VBDSIZE descriptors */
+		self->encoder->tracker = gst_dreamsource_tracker_new (self->max_frames_in_flight + VBUFSIZE/VBDSIZE, VMMAPSIZE, self->encoder);
+		gst_dreamsource_tracker_set_notify (self->encoder->tracker, self->max_frames_in_flight, (DescriptorTrackerNotify) gst_dreamvideosource_wakeup, self);
+		GST_INFO_OBJECT (self, "tracked descriptor release with max. %u frames in flight", self->max_frames_in_flight);
 	}
-	READ_SOCKET (self) = control_sock[0];
-	WRITE_SOCKET (self) = control_sock[1];
-	fcntl (READ_SOCKET (self), F_SETFL, O_NONBLOCK);
-	fcntl (WRITE_SOCKET (self), F_SETFL, O_NONBLOCK);
 
-	gst_dreamvideosource_set_bitrate (self, self->video_info.bitrate);
+	gst_dreamvideosource_set_bitrate (self, self->bitrate);
 	gst_dreamvideosource_set_goplen(self, self->video_info.gop_length);
 	gst_dreamvideosource_set_bframes(self,  self->video_info.bframes);
 	gst_dreamvideosource_set_pframes(self,  self->video_info.pframes);
@@ -639,36 +1043,69 @@ static gboolean gst_dreamvideosource_encoder_init (GstDreamVideoSource * self)
 	gst_dreamvideosource_set_open_gop(self, self->video_info.open_gop);
 	gst_dreamvideosource_set_slices(self, self->video_info.slices);
 	gst_dreamvideosource_set_level(self, self->video_info.level);
+
+	/* whatever configure was given an ioctl number for, without trying it
+	 * out on the driver. One that turns out not to know it clears the flag. */
+#ifdef VENC_SET_CUSTOM_RESOLUTION
+	self->custom_resolutions = TRUE;
+#endif
+#ifdef VENC_SET_CUSTOM_FRAMERATE
+	self->custom_framerates = TRUE;
+#endif
+	GST_INFO_OBJECT (self, "custom resolutions %s, custom framerates %s", self->custom_resolutions ? "on" : "off", self->custom_framerates ? "on" : "off");
+
 	gst_dreamvideosource_set_format (self, &self->video_info);
 	gst_dreamvideosource_set_input_mode (self, self->input_mode);
 
-	GST_LOG_OBJECT (self, "encoder %s successfully initialized", fn_buf);
+	GST_LOG_OBJECT (self, "encoder /dev/venc%i successfully initialized", self->encoder->device_index);
 	return TRUE;
 }
 
 static void gst_dreamvideosource_encoder_release (GstDreamVideoSource * self)
 {
 	GST_LOG_OBJECT (self, "releasing encoder...");
+	if (self->sync) {
+		gst_dreamsource_sync_leave (self->sync, ENCODER_KIND_VIDEO);
+		gst_dreamsource_sync_unref (self->sync);
+		self->sync = NULL;
+	}
 	if (self->encoder) {
+		if (self->encoder->tracker)
+		{
+			gst_dreamsource_tracker_detach (self->encoder->tracker);
+			gst_dreamsource_tracker_unref (self->encoder->tracker);
+		}
 		if (self->encoder->buffer)
 			free(self->encoder->buffer);
-		if (self->encoder->cdb)
-			munmap(self->encoder->cdb, VMMAPSIZE);
-		if (self->encoder->fd)
-			close(self->encoder->fd);
-		free(self->encoder);
+		if (self->encoder_clock)
+			gst_dreamsource_clock_detach (self->encoder_clock, self->encoder);
+		gst_dreamsource_device_release (self->encoder);
 	}
 	self->encoder = NULL;
-	close (READ_SOCKET (self));
-	close (WRITE_SOCKET (self));
-	READ_SOCKET (self) = -1;
-	WRITE_SOCKET (self) = -1;
 	if (self->encoder_clock) {
 		gst_object_unref (self->encoder_clock);
 		self->encoder_clock = NULL;
 	}
 }
 
+/* zerolatency overrides bframes, slices (only if unsliced) and batch, going
+ * back to none restores what they were before */
+static void gst_dreamvideosource_set_tune (GstDreamVideoSource * self, GstDreamVideoSourceTune tune)
+{
+	if (tune == self->tune)
+		return;
+	self->tune = tune;
+	if (tune == GST_DREAMVIDEOSOURCE_TUNE_ZEROLATENCY)
+	{
+		self->tune_bframes = self->video_info.bframes;
+		self->tune_slices = self->video_info.slices;
+		self->tune_batch = self->batch;
+		g_object_set (self, "bframes", 0, "slices", self->video_info.slices ? self->video_info.slices : ZEROLATENCY_SLICES, "batch", FALSE, NULL);
+	}
+	else
+		g_object_set (self, "bframes", self->tune_bframes, "slices", self->tune_slices, "batch", self->tune_batch, NULL);
+}
+
 static void
 gst_dreamvideosource_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
 {
@@ -684,31 +1121,98 @@ gst_dreamvideosource_set_property (GObject * object, guint prop_id, const GValue
 			break;
 		}
 		case ARG_BITRATE:
-			gst_dreamvideosource_set_bitrate(self, g_value_get_int (value));
+			g_mutex_lock (&self->mutex);
+			self->bitrate = g_value_get_int (value);
+			g_mutex_unlock (&self->mutex);
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_BITRATE, g_value_get_int (value)))
+				gst_dreamvideosource_set_bitrate (self, g_value_get_int (value));
 			break;
 		case ARG_INPUT_MODE:
-			gst_dreamvideosource_set_input_mode (self, g_value_get_enum (value));
+			if (gst_dreamvideosource_defer (self, COMMAND_SET_INPUT_MODE, g_value_get_enum (value)))
+				gst_dreamvideosource_defer (self, COMMAND_FLUSH, 0);
+			else
+				gst_dreamvideosource_set_input_mode (self, g_value_get_enum (value));
 			break;
 		case ARG_GOP_LENGTH:
-			gst_dreamvideosource_set_goplen(self, g_value_get_int (value));
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_GOP_LENGTH, g_value_get_int (value)))
+				gst_dreamvideosource_set_goplen (self, g_value_get_int (value));
 			break;
 		case ARG_GOP_SCENE:
-			gst_dreamvideosource_set_gop_on_scene_change(self, g_value_get_boolean (value));
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_GOP_SCENE, g_value_get_boolean (value)))
+				gst_dreamvideosource_set_gop_on_scene_change (self, g_value_get_boolean (value));
 			break;
 		case ARG_OPEN_GOP:
-			gst_dreamvideosource_set_open_gop(self, g_value_get_boolean (value));
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_OPEN_GOP, g_value_get_boolean (value)))
+				gst_dreamvideosource_set_open_gop (self, g_value_get_boolean (value));
 			break;
 		case ARG_BFRAMES:
-			gst_dreamvideosource_set_bframes(self, g_value_get_int (value));
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_BFRAMES, g_value_get_int (value)))
+				gst_dreamvideosource_set_bframes (self, g_value_get_int (value));
 			break;
 		case ARG_PFRAMES:
-			gst_dreamvideosource_set_pframes(self, g_value_get_int (value));
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_PFRAMES, g_value_get_int (value)))
+				gst_dreamvideosource_set_pframes (self, g_value_get_int (value));
 			break;
 		case ARG_SLICES:
-			gst_dreamvideosource_set_slices(self, g_value_get_int (value));
+			if (!gst_dreamvideosource_defer (self, COMMAND_SET_SLICES, g_value_get_int (value)))
+				gst_dreamvideosource_set_slices (self, g_value_get_int (value));
 			break;
 		case ARG_LEVEL:
-			gst_dreamvideosource_set_level(self, g_value_get_int (value));
+			if (gst_dreamvideosource_defer (self, COMMAND_SET_LEVEL, g_value_get_int (value)))
+				gst_dreamvideosource_defer (self, COMMAND_RESTART, 0);
+			else
+				gst_dreamvideosource_set_level (self, g_value_get_int (value));
+			break;
+		case ARG_RELEASE_MODE:
+			self->release_mode = g_value_get_enum (value);
+			break;
+		case ARG_MAX_FRAMES_IN_FLIGHT:
+			self->max_frames_in_flight = g_value_get_uint (value);
+			break;
+		case ARG_BATCH:
+			self->batch = g_value_get_boolean (value);
+			break;
+		case ARG_TUNE:
+			gst_dreamvideosource_set_tune (self, g_value_get_enum (value));
+			break;
+		case ARG_OVERFLOW_POLICY:
+			self->overflow_policy = g_value_get_enum (value);
+			break;
+		case ARG_CLOCK_MODE:
+			self->clock_mode = g_value_get_enum (value);
+			if (self->encoder_clock && !self->dreamaudiosrc)
+				g_object_set (self->encoder_clock, "mode", self->clock_mode, NULL);
+			break;
+		case ARG_DEVICE_INDEX:
+			self->device_index = g_value_get_int (value);
+			break;
+		case ARG_SHARED_REACTOR:
+			self->shared_reactor = g_value_get_boolean (value);
+			break;
+		case ARG_GOP_CACHE_SIZE:
+			self->gop_cache_size = g_value_get_uint (value);
+			break;
+		case ARG_TIMESHIFT_LOCATION:
+			g_free (self->timeshift_location);
+			self->timeshift_location = g_value_dup_string (value);
+			break;
+		case ARG_TIMESHIFT_SIZE:
+			self->timeshift_size = g_value_get_uint64 (value);
+			break;
+		case ARG_ABR:
+			self->abr = g_value_get_boolean (value);
+			break;
+		case ARG_ABR_MIN_BITRATE:
+			self->abr_min_bitrate = g_value_get_int (value);
+			break;
+		case ARG_ABR_MAX_BITRATE:
+			self->abr_max_bitrate = g_value_get_int (value);
+			break;
+		case ARG_INJECT_HEADERS:
+			self->inject_headers = g_value_get_enum (value);
+			break;
+		case ARG_THROUGHPUT_ESTIMATE:
+			gst_dreamsource_abr_set_estimate (&self->abr_controller, g_value_get_int (value));
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -726,7 +1230,7 @@ gst_dreamvideosource_get_property (GObject * object, guint prop_id, GValue * val
 			g_value_take_boxed (value, gst_dreamvideosource_getcaps (GST_BASE_SRC(object), GST_CAPS_ANY));
 			break;
 		case ARG_BITRATE:
-			g_value_set_int (value, self->video_info.bitrate);
+			g_value_set_int (value, self->bitrate);
 			break;
 		case ARG_INPUT_MODE:
 			g_value_set_enum (value, gst_dreamvideosource_get_input_mode (self));
@@ -752,12 +1256,107 @@ gst_dreamvideosource_get_property (GObject * object, guint prop_id, GValue * val
 		case ARG_LEVEL:
 			g_value_set_int(value, self->video_info.level);
 			break;
+		case ARG_RELEASE_MODE:
+			g_value_set_enum (value, self->release_mode);
+			break;
+		case ARG_MAX_FRAMES_IN_FLIGHT:
+			g_value_set_uint (value, self->max_frames_in_flight);
+			break;
+		case ARG_BATCH:
+			g_value_set_boolean (value, self->batch);
+			break;
+		case ARG_TUNE:
+			g_value_set_enum (value, self->tune);
+			break;
+		case ARG_OVERFLOW_POLICY:
+			g_value_set_enum (value, self->overflow_policy);
+			break;
+		case ARG_STATS:
+		{
+			GstStructure *stats = gst_dreamsource_stats_to_structure (&self->stats, "GstDreamVideoSourceStats");
+			gst_dreamsource_clock_add_stats (self->encoder_clock, stats);
+			g_mutex_lock (&self->mutex);
+			gst_structure_set (stats, "encoder-latency", G_TYPE_UINT64, self->latency.measured,
+				"encoder-latency-updates", G_TYPE_UINT64, self->latency.updates, NULL);
+			g_mutex_unlock (&self->mutex);
+			g_value_take_boxed (value, stats);
+			break;
+		}
+		case ARG_INJECT_HEADERS:
+			g_value_set_enum (value, self->inject_headers);
+			break;
+		case ARG_KEYFRAME_INDEX:
+			g_value_take_boxed (value, gst_dreamsource_keyframe_index_to_structure (&self->keyframes, "GstDreamVideoSourceKeyframeIndex"));
+			break;
+		case ARG_CLOCK_MODE:
+			g_value_set_enum (value, self->clock_mode);
+			break;
+		case ARG_DEVICE_INDEX:
+			g_value_set_int (value, self->device_index);
+			break;
+		case ARG_SHARED_REACTOR:
+			g_value_set_boolean (value, self->shared_reactor);
+			break;
+		case ARG_GOP_CACHE_SIZE:
+			g_value_set_uint (value, self->gop_cache_size);
+			break;
+		case ARG_TIMESHIFT_LOCATION:
+			g_value_set_string (value, self->timeshift_location);
+			break;
+		case ARG_TIMESHIFT_SIZE:
+			g_value_set_uint64 (value, self->timeshift_size);
+			break;
+		case ARG_TIMESHIFT_WINDOW:
+		{
+			Timeshift *ts = gst_dreamvideosource_get_timeshift (self);
+			if (ts)
+			{
+				g_value_take_boxed (value, gst_dreamsource_timeshift_get_window (ts));
+				gst_dreamsource_timeshift_unref (ts);
+			}
+			else
+				g_value_set_boxed (value, NULL);
+			break;
+		}
+		case ARG_ABR:
+			g_value_set_boolean (value, self->abr);
+			break;
+		case ARG_ABR_MIN_BITRATE:
+			g_value_set_int (value, self->abr_min_bitrate);
+			break;
+		case ARG_ABR_MAX_BITRATE:
+			g_value_set_int (value, self->abr_max_bitrate);
+			break;
+		case ARG_THROUGHPUT_ESTIMATE:
+			g_value_set_int (value, g_atomic_int_get (&self->abr_controller.estimate));
+			break;
+		case ARG_FRAMES_IN_FLIGHT:
+			g_mutex_lock (&self->mutex);
+			g_value_set_uint (value, (self->encoder && self->encoder->tracker) ? gst_dreamsource_tracker_get_in_flight (self->encoder->tracker) : 0);
+			g_mutex_unlock (&self->mutex);
+			break;
+		case ARG_RING_OCCUPANCY:
+			g_mutex_lock (&self->mutex);
+			g_value_set_uint (value, (self->encoder && self->encoder->tracker) ? gst_dreamsource_tracker_get_occupancy (self->encoder->tracker) : 0);
+			g_mutex_unlock (&self->mutex);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
 	}
 }
 
+/* takes caps, returns them intersected with restriction */
+static GstCaps *
+gst_dreamvideosource_restrict_caps (GstCaps * caps, const gchar * restriction)
+{
+	GstCaps *fixed = gst_caps_from_string (restriction);
+	GstCaps *restricted = gst_caps_intersect (caps, fixed);
+	gst_caps_unref (fixed);
+	gst_caps_unref (caps);
+	return restricted;
+}
+
 static GstCaps *
 gst_dreamvideosource_getcaps (GstBaseSrc * bsrc, GstCaps * filter)
 {
@@ -779,12 +1378,11 @@ gst_dreamvideosource_getcaps (GstBaseSrc * bsrc, GstCaps * filter)
 	} else if (self->current_caps == NULL) {
 		GstPadTemplate *pad_template;
 		pad_template = gst_element_class_get_pad_template (GST_ELEMENT_GET_CLASS(self), "src");
-		if (pad_template)
-			caps = gst_caps_copy (gst_pad_template_get_caps (pad_template));
-		else
-			caps = gst_caps_new_empty ();
-
 		caps = gst_pad_template_get_caps (pad_template);
+		if (self->encoder && !self->custom_resolutions)
+			caps = gst_dreamvideosource_restrict_caps (caps, DREAMVIDEOSOURCE_FIXED_FORMATS);
+		if (self->encoder && !self->custom_framerates)
+			caps = gst_dreamvideosource_restrict_caps (caps, DREAMVIDEOSOURCE_FIXED_RATES);
 	} else
 		caps = gst_caps_copy(self->current_caps);
 
@@ -857,11 +1455,27 @@ gst_dreamvideosource_setcaps (GstBaseSrc * bsrc, GstCaps * caps)
 			else
 				GST_WARNING_OBJECT (self, "unknown profile '%s' in caps... set main profile");
 
+			self->stream_format_avc = !g_strcmp0 (gst_structure_get_string (structure, "stream-format"), "avc");
+			/* byte-stream without alignment leaves it open, zerolatency queues a
+			 * single buffer which has to be a whole picture */
+			self->alignment_au = self->stream_format_avc || !g_strcmp0 (gst_structure_get_string (structure, "alignment"), "au") ||
+				(self->tune == GST_DREAMVIDEOSOURCE_TUNE_ZEROLATENCY && !gst_structure_has_field (structure, "alignment"));
+			GST_DEBUG_OBJECT (self, "%s %s output", self->stream_format_avc ? "avc" : "byte-stream", self->alignment_au ? "access unit" : "descriptor");
+
 			gst_caps_replace (&self->current_caps, caps);
+			/* belongs to the old format */
+			gst_buffer_replace (&self->codec_data, NULL);
 
 			g_mutex_unlock (&self->mutex);
 			if (gst_caps_is_fixed(caps) && gst_dreamvideosource_set_format(self, &info))
-				ret = gst_pad_push_event (bsrc->srcpad, gst_event_new_caps (caps));
+			{
+				/* avc caps are incomplete without codec_data, create () pushes
+				 * them together with the first SPS and PPS of the new format */
+				if (self->stream_format_avc)
+					g_atomic_int_set (&self->codec_data_pending, TRUE);
+				else
+					ret = gst_pad_push_event (bsrc->srcpad, gst_event_new_caps (caps));
+			}
 			g_mutex_lock (&self->mutex);
 		}
 		else {
@@ -876,6 +1490,42 @@ gst_dreamvideosource_setcaps (GstBaseSrc * bsrc, GstCaps * caps)
 	return ret;
 }
 
+/* the default negotiation, except that avc caps only set up the encoder
+ * instead of going out through gst_base_src_set_caps () without codec_data */
+static gboolean
+gst_dreamvideosource_negotiate (GstBaseSrc * bsrc)
+{
+	GstCaps *thiscaps, *caps;
+	gboolean ret = FALSE;
+
+	thiscaps = gst_pad_query_caps (GST_BASE_SRC_PAD (bsrc), NULL);
+	if (!thiscaps || gst_caps_is_any (thiscaps))
+	{
+		if (thiscaps)
+			gst_caps_unref (thiscaps);
+		return TRUE;
+	}
+	caps = gst_pad_peer_query_caps (GST_BASE_SRC_PAD (bsrc), thiscaps);
+	if (caps)
+		gst_caps_unref (thiscaps);
+	else
+		caps = thiscaps;
+
+	if (!gst_caps_is_empty (caps))
+	{
+		caps = gst_dreamvideosource_fixate (bsrc, caps);
+		if (!gst_caps_is_fixed (caps))
+			;
+		else if (!g_strcmp0 (gst_structure_get_string (gst_caps_get_structure (caps, 0), "stream-format"), "avc"))
+			ret = gst_dreamvideosource_setcaps (bsrc, caps);
+		else
+			ret = gst_base_src_set_caps (bsrc, caps);
+	}
+	GST_DEBUG_OBJECT (bsrc, "negotiated %" GST_PTR_FORMAT ": %i", caps, ret);
+	gst_caps_unref (caps);
+	return ret;
+}
+
 static GstCaps *
 gst_dreamvideosource_fixate (GstBaseSrc * bsrc, GstCaps * caps)
 {
@@ -899,6 +1549,24 @@ gst_dreamvideosource_fixate (GstBaseSrc * bsrc, GstCaps * caps)
 	return caps;
 }
 
+static gboolean gst_dreamvideosource_event (GstBaseSrc * bsrc, GstEvent * event)
+{
+	GstDreamVideoSource *self = GST_DREAMVIDEOSOURCE (bsrc);
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_QOS)
+	{
+		GstQOSType type;
+		gdouble proportion;
+		GstClockTimeDiff diff;
+		GstClockTime timestamp;
+
+		gst_event_parse_qos (event, &type, &proportion, &diff, &timestamp);
+		GST_LOG_OBJECT (self, "QoS proportion %.3f diff %" G_GINT64_FORMAT, proportion, diff);
+		gst_dreamsource_abr_add_qos (&self->abr_controller, proportion);
+	}
+	return GST_BASE_SRC_CLASS (parent_class)->event (bsrc, event);
+}
+
 static gboolean gst_dreamvideosource_query (GstBaseSrc * bsrc, GstQuery * query)
 {
 	GstDreamVideoSource *self = GST_DREAMVIDEOSOURCE (bsrc);
@@ -909,11 +1577,15 @@ static gboolean gst_dreamvideosource_query (GstBaseSrc * bsrc, GstQuery * query)
 			if (self->video_info.fps_n) {
 				GstClockTime min, max;
 
+				GstClockTime frame;
+
 				g_mutex_lock (&self->mutex);
-				min = gst_util_uint64_scale_ceil (GST_SECOND, self->video_info.fps_d, self->video_info.fps_n);
+				frame = gst_util_uint64_scale_ceil (GST_SECOND, self->video_info.fps_d, self->video_info.fps_n);
+				/* what the encoder measurably takes, never less than a frame */
+				min = self->latency.measured != GST_CLOCK_TIME_NONE ? MAX (self->latency.measured, frame) : frame;
 				g_mutex_unlock (&self->mutex);
 
-				max = self->buffer_size * min;
+				max = min + self->buffer_size * frame;
 
 				gst_query_set_latency (query, TRUE, min, max);
 				GST_DEBUG_OBJECT (bsrc, "set LATENCY QUERY %" GST_PTR_FORMAT, query);
@@ -934,13 +1606,8 @@ static gboolean gst_dreamvideosource_unlock (GstBaseSrc * bsrc)
 {
 	GstDreamVideoSource *self = GST_DREAMVIDEOSOURCE (bsrc);
 	GST_DEBUG_OBJECT (self, "stop creating buffers");
-	g_mutex_lock (&self->mutex);
-	self->flushing = TRUE;
+	gst_dreamsource_frame_queue_set_flushing (self->frames, TRUE);
 	GST_DEBUG_OBJECT (self, "set flushing TRUE");
-	g_cond_signal (&self->cond);
-	GST_DEBUG_OBJECT (self, "post cond");
-	g_mutex_unlock (&self->mutex);
-	GST_DEBUG_OBJECT (self, "post unlock");
 	return TRUE;
 }
 
@@ -948,344 +1615,809 @@ static gboolean gst_dreamvideosource_unlock_stop (GstBaseSrc * bsrc)
 {
 	GstDreamVideoSource *self = GST_DREAMVIDEOSOURCE (bsrc);
 	GST_DEBUG_OBJECT (self, "stop flushing...");
-	g_mutex_lock (&self->mutex);
-	self->flushing = FALSE;
-	g_queue_foreach (&self->current_frames, (GFunc) gst_buffer_unref, NULL);
-	g_queue_clear (&self->current_frames);
-	g_mutex_unlock (&self->mutex);
+	/* still flushing while it's emptied, the read loop doesn't queue anything then */
+	gst_dreamsource_frame_queue_clear (self->frames);
+	gst_dreamsource_frame_queue_set_flushing (self->frames, FALSE);
 	return TRUE;
 }
 
-static void gst_dreamvideosource_read_thread_func (GstDreamVideoSource * self)
+/* runs on the read loop once per encoder read, so the new bitrate is set
+ * without a detour through the command queue */
+static void gst_dreamvideosource_abr_update (GstDreamVideoSource * self)
 {
-	EncoderInfo *enc = self->encoder;
-	GstDreamSourceReadthreadState state = READTHREADSTATE_NONE;
-	GstBuffer *readbuf;
+	guint bitrate = gst_dreamsource_abr_update (&self->abr_controller, self->video_info.bitrate,
+		gst_dreamsource_frame_queue_get_length (self->frames), self->buffer_size, g_get_monotonic_time ());
 
-	if (!enc) {
-		GST_WARNING_OBJECT (self, "encoder device not opened!");
-		return;
+	if (bitrate)
+	{
+		GST_INFO_OBJECT (self, "adaptive bitrate %i -> %u kbit/s (queue fill %.2f)", self->video_info.bitrate, bitrate, self->abr_controller.fill);
+		gst_dreamvideosource_set_bitrate (self, bitrate);
 	}
+}
 
-	GST_DEBUG_OBJECT (self, "enter read thread");
-
-	GstMessage *message;
-	GValue val = { 0 };
-
-	message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_ENTER, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
-	g_value_init (&val, GST_TYPE_G_THREAD);
-	g_value_set_boxed (&val, self->readthread);
-	gst_message_set_stream_status_object (message, &val);
-	g_value_unset (&val);
-	GST_DEBUG_OBJECT (self, "posting ENTER stream status");
-	gst_element_post_message (GST_ELEMENT_CAST (self), message);
-	GstClockTime clock_time, base_time;
-	gboolean discont = TRUE;
-
-	while (TRUE) {
-		readbuf = NULL;
-		{
-			if (state == READTHREADSTATE_STOP)
-				goto stop_running;
-
-			struct pollfd rfd[2];
-			int timeout, nfds;
-
-			rfd[0].fd = READ_SOCKET (self);
-			rfd[0].events = POLLIN | POLLERR | POLLHUP | POLLPRI;
-			rfd[1].revents = 0;
-			rfd[1].events = POLLIN;
-			nfds = 1;
-			timeout = 0;
-
-			if (state <= READTRREADSTATE_PAUSED)
-				timeout = 200;
-			else if (state == READTRREADSTATE_RUNNING && self->descriptors_available == 0)
+/* makes room for readbuf as overflow-policy says, returns FALSE if readbuf
+ * has to be dropped instead. Frames are only dropped in a way that leaves
+ * nothing queued which refers to a dropped one, except for leaky. */
+static gboolean gst_dreamvideosource_make_room (GstDreamVideoSource * self, GstBuffer * readbuf)
+{
+	gboolean delta = GST_BUFFER_FLAG_IS_SET (readbuf, GST_BUFFER_FLAG_DELTA_UNIT);
+	gboolean frame_start = self->alignment_au || self->frame_start;
+	GstBuffer * oldbuf;
+
+	switch (self->overflow_policy) {
+		case GST_DREAMVIDEOSOURCE_OVERFLOW_KEYFRAME:
+		case GST_DREAMVIDEOSOURCE_OVERFLOW_NON_REFERENCE:
+			if (self->overflow_skip && (delta || !frame_start))
+				return FALSE;
+			self->overflow_skip = FALSE;
+			if (!gst_dreamsource_frame_queue_is_full (self->frames))
+				return TRUE;
+			if (self->overflow_policy == GST_DREAMVIDEOSOURCE_OVERFLOW_NON_REFERENCE && GST_BUFFER_FLAG_IS_SET (readbuf, GST_BUFFER_FLAG_DROPPABLE))
 			{
-				rfd[1].fd = enc->fd;
-				self->descriptors_count = 0;
-				timeout = 200;
-				nfds = 2;
+				GST_DEBUG_OBJECT (self, "queue overflow, dropping non-reference %" GST_PTR_FORMAT, readbuf);
+				return FALSE;
 			}
-
-			int ret = poll(rfd, nfds, timeout);
-
-			if (G_UNLIKELY (ret == -1))
+			if (delta || !frame_start)
 			{
-				GST_ERROR_OBJECT (self, "SELECT ERROR!");
-				goto stop_running;
+				GST_WARNING_OBJECT (self, "queue overflow, dropping frames up to the next keyframe");
+				self->overflow_skip = TRUE;
+				return FALSE;
 			}
-			else if ( ret == 0 && self->descriptors_available == 0 )
+			/* a keyframe doesn't need anything queued in front of it */
+			GST_WARNING_OBJECT (self, "queue overflow, dropping %u buffers in front of a keyframe", gst_dreamsource_frame_queue_get_length (self->frames));
+			while ((oldbuf = gst_dreamsource_frame_queue_drop_oldest (self->frames)))
 			{
-				g_mutex_lock (&self->mutex);
-				gst_clock_get_internal_time(self->encoder_clock);
-				g_mutex_unlock (&self->mutex);
-				GST_DEBUG_OBJECT (self, "SELECT TIMEOUT");
-				discont = TRUE;
-// 				readbuf = gst_buffer_new();
+				self->stats.dropped++;
+				gst_buffer_unref (oldbuf);
 			}
-			else if ( rfd[0].revents )
+			return TRUE;
+		default:
+			/* block doesn't get here unless an access unit completed on a full queue */
+			while (gst_dreamsource_frame_queue_is_full (self->frames) && (oldbuf = gst_dreamsource_frame_queue_drop_oldest (self->frames)))
 			{
-				char command;
-				READ_COMMAND (self, command, ret);
-				switch (command) {
-					case CONTROL_STOP:
-						GST_DEBUG_OBJECT (self, "CONTROL_STOP!");
-						state = READTHREADSTATE_STOP;
-						break;
-					case CONTROL_PAUSE:
-						GST_DEBUG_OBJECT (self, "CONTROL_PAUSE!");
-						state = READTRREADSTATE_PAUSED;
-						break;
-					case CONTROL_RUN:
-						GST_DEBUG_OBJECT (self, "CONTROL_RUN");
-						state = READTRREADSTATE_RUNNING;
-						break;
-					default:
-						GST_ERROR_OBJECT (self, "illegal control socket command %c received!", command);
-				}
-				continue;
+				GST_WARNING_OBJECT (self, "dropping %" GST_PTR_FORMAT " because of queue overflow! buffers count=%i", oldbuf, gst_dreamsource_frame_queue_get_length (self->frames));
+				self->stats.dropped++;
+				gst_buffer_unref(oldbuf);
 			}
-			else if ( G_LIKELY(rfd[1].revents & POLLIN) )
+			return TRUE;
+	}
+}
+
+/* queues readbuf, the streaming thread only sees it after the next
+ * gst_dreamsource_frame_queue_publish () */
+static void gst_dreamvideosource_enqueue (GstDreamVideoSource * self, GstBuffer * readbuf, gboolean * discont)
+{
+	if (!gst_dreamsource_frame_queue_is_flushing (self->frames))
+	{
+		if (!gst_dreamvideosource_make_room (self, readbuf))
+		{
+			GST_LOG_OBJECT (self, "dropping %" GST_PTR_FORMAT " because of queue overflow", readbuf);
+			self->stats.dropped++;
+			*discont = TRUE;
+			gst_buffer_unref (readbuf);
+			return;
+		}
+		if (*discont)
+		{
+			GST_BUFFER_FLAG_SET (readbuf, GST_BUFFER_FLAG_DISCONT);
+			*discont = FALSE;
+		}
+		self->stats.frames++;
+		self->stats.bytes += gst_buffer_get_size (readbuf);
+		if (self->gop_cache.limit)
+			gst_dreamsource_gop_cache_push (&self->gop_cache, readbuf);
+		if (self->timeshift)
+			gst_dreamsource_timeshift_push (self->timeshift, readbuf);
+		gst_dreamsource_frame_queue_stage (self->frames, readbuf);
+		GST_INFO_OBJECT (self, "read %" GST_PTR_FORMAT " to queue... buffers count=%i", readbuf, gst_dreamsource_frame_queue_get_length (self->frames));
+	}
+	else
+		gst_buffer_unref(readbuf);
+}
+
+static void gst_dreamvideosource_clear_param_sets (GstDreamVideoSource * self)
+{
+	gst_dreamsource_h264_headers_clear (&self->param_sets);
+	if (self->param_sets_mem)
+		gst_memory_unref (self->param_sets_mem);
+	self->param_sets_mem = NULL;
+	self->param_sets_pending = FALSE;
+	self->frame_headers = 0;
+}
+
+/* caches the SPS/PPS found at the start of keyframes or in descriptors
+ * the encoder marks as parameter sets */
+static void gst_dreamvideosource_scan_param_sets (GstDreamVideoSource * self, VideoBufferDescriptor * desc, gboolean keyframe_start)
+{
+	gboolean changed = FALSE;
+	gboolean param_set_unit = (desc->uiVideoFlags & VBD_FLAG_DATA_UNIT_START) &&
+		(desc->uiDataUnitType == H264_NAL_SPS || desc->uiDataUnitType == H264_NAL_PPS);
+
+	if (keyframe_start)
+		self->frame_headers = 0;
+	if (!param_set_unit && !(self->keyframe && !(self->frame_headers & H264_HEADERS_SLICE)))
+		return;
+
+	self->frame_headers |= gst_dreamsource_h264_headers_scan (&self->param_sets, self->encoder->cdb + desc->stCommon.uiOffset, desc->stCommon.uiLength, &changed);
+	if (changed)
+	{
+		GST_DEBUG_OBJECT (self, "parameter sets changed");
+		if (self->param_sets_mem)
+			gst_memory_unref (self->param_sets_mem);
+		self->param_sets_mem = gst_dreamsource_h264_headers_to_memory (&self->param_sets);
+		self->param_sets_pending = TRUE;
+	}
+}
+
+/* the first buffer of a keyframe gets the cached parameter sets in front,
+ * shared rather than copied, unless it starts with an SPS already (the PPS
+ * may follow in a descriptor of its own). An access unit delimiter has to
+ * stay first, the descriptor memory is split behind it then. */
+static void gst_dreamvideosource_inject_param_sets (GstDreamVideoSource * self, GstBuffer * readbuf)
+{
+	if (self->frame_headers & H264_HEADERS_SPS)
+		self->param_sets_pending = FALSE;
+	else if (self->param_sets_mem && (self->inject_headers == GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ALWAYS ||
+		(self->inject_headers == GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ON_CHANGE && self->param_sets_pending)))
+	{
+		GstMemory *first = gst_buffer_peek_memory (readbuf, 0);
+		GstMapInfo map;
+		gsize aud = 0, size = 0;
+
+		if (gst_memory_map (first, &map, GST_MAP_READ))
+		{
+			aud = gst_dreamsource_h264_aud_size (map.data, map.size);
+			size = map.size;
+			gst_memory_unmap (first, &map);
+		}
+		GST_LOG_OBJECT (self, "injecting parameter sets %s %" GST_PTR_FORMAT, aud ? "after the AUD of" : "in front of", readbuf);
+		if (!aud)
+			gst_buffer_prepend_memory (readbuf, gst_memory_ref (self->param_sets_mem));
+		else
+		{
+			if (aud < size)
 			{
-				int rlen = read(enc->fd, enc->buffer, VBUFSIZE);
-				if (G_UNLIKELY (!self->encoder_clock))
-				{
-					GST_DEBUG_OBJECT(self, "no encoder clock yet... continue");
-					continue;
-				}
-				clock_time = gst_clock_get_internal_time (self->encoder_clock);
-				base_time = gst_element_get_base_time(GST_ELEMENT(self));
-				if (rlen <= 0 || rlen % VBDSIZE ) {
-					if ( errno == 512 )
-						goto stop_running;
-					GST_WARNING_OBJECT (self, "read error %s (%i)", strerror(errno), errno);
-					goto stop_running;
-				}
-				self->descriptors_available = rlen / VBDSIZE;
-				GST_LOG_OBJECT (self, "encoder buffer was empty, %d descriptors available", self->descriptors_available);
+				gst_buffer_insert_memory (readbuf, 1, gst_memory_share (first, aud, -1));
+				gst_buffer_replace_memory (readbuf, 0, gst_memory_share (first, 0, aud));
 			}
-			if (self->flushing)
+			gst_buffer_insert_memory (readbuf, 1, gst_memory_ref (self->param_sets_mem));
+		}
+		self->param_sets_pending = FALSE;
+	}
+}
+
+static void gst_dreamvideosource_drop_access_unit (GstDreamVideoSource * self)
+{
+	if (self->access_unit)
+	{
+		GST_DEBUG_OBJECT (self, "dropping incomplete access unit %" GST_PTR_FORMAT, self->access_unit);
+		gst_buffer_unref (self->access_unit);
+		self->access_unit = NULL;
+	}
+}
+
+/* stream-format=avc needs codec_data, access units from before the
+ * first SPS and PPS can't be decoded anyway */
+static void gst_dreamvideosource_queue_access_unit (GstDreamVideoSource * self, GstBuffer * au)
+{
+	if (self->stream_format_avc)
+	{
+		/* forget the old parameter sets, so the next ones come with codec_data */
+		if (g_atomic_int_compare_and_exchange (&self->codec_data_pending, TRUE, FALSE))
+			gst_dreamsource_h264_headers_clear (&self->h264_headers);
+		au = gst_dreamsource_h264_to_avc (au, &self->h264_headers);
+		if (au && (!self->h264_headers.sps || !self->h264_headers.pps))
+		{
+			GST_DEBUG_OBJECT (self, "no SPS/PPS yet, dropping %" GST_PTR_FORMAT, au);
+			gst_buffer_unref (au);
+			au = NULL;
+		}
+		if (!au)
+		{
+			self->discont = TRUE;
+			return;
+		}
+		/* the buffer carrying it might be dropped before create () gets to it */
+		GstBuffer *codec_data = gst_dreamsource_h264_get_codec_data (au);
+		if (codec_data)
+		{
+			g_mutex_lock (&self->mutex);
+			gst_buffer_replace (&self->codec_data, codec_data);
+			g_mutex_unlock (&self->mutex);
+		}
+	}
+	gst_dreamvideosource_enqueue (self, au, &self->discont);
+}
+
+/* alignment=au: collects the descriptors from FRAME_START to FRAME_END into
+ * one buffer, each one a memory of its own pointing into the encoder ring,
+ * so a picture wrapping around the ring end needs no copy either. readbuf
+ * is NULL for skipped descriptors, which still delimit the picture. */
+static void gst_dreamvideosource_assemble (GstDreamVideoSource * self, GstBuffer * readbuf, uint32_t flags)
+{
+	if ((flags & CDB_FLAG_FRAME_START) && self->access_unit)
+	{
+		GST_DEBUG_OBJECT (self, "access unit without FRAME_END, queueing what was read");
+		gst_dreamvideosource_queue_access_unit (self, self->access_unit);
+		self->access_unit = NULL;
+	}
+
+	if (readbuf)
+	{
+		if (self->access_unit)
+		{
+			GstBuffer *au = self->access_unit;
+			guint64 offset_end = GST_BUFFER_OFFSET_END (readbuf);
+			if (!GST_BUFFER_DTS_IS_VALID (au))
 			{
-				g_mutex_lock (&self->mutex);
-				GST_DEBUG_OBJECT (self, "FLUSHING!");
-				g_cond_signal (&self->cond);
-				g_mutex_unlock (&self->mutex);
-				continue;
+				GST_BUFFER_DTS (au) = GST_BUFFER_DTS (readbuf);
+				GST_BUFFER_PTS (au) = GST_BUFFER_PTS (readbuf);
 			}
+			/* beyond GST_BUFFER_MEM_MAX memories gstreamer merges them by copying */
+			au = gst_buffer_append (au, readbuf);
+			GST_BUFFER_OFFSET_END (au) = offset_end;
+			self->access_unit = au;
+		}
+		else if (flags & CDB_FLAG_FRAME_START)
+			self->access_unit = readbuf;
+		else
+		{
+			GST_LOG_OBJECT (self, "dropping %" GST_PTR_FORMAT " outside of an access unit", readbuf);
+			gst_buffer_unref (readbuf);
+			self->discont = TRUE;
 		}
+	}
+
+	if ((flags & CDB_FLAG_FRAME_END) && self->access_unit)
+	{
+		gst_dreamvideosource_queue_access_unit (self, self->access_unit);
+		self->access_unit = NULL;
+	}
+}
+
+/* tells the pipeline to query the latency again once the measured one
+ * moved away from what was reported */
+static void gst_dreamvideosource_add_latency (GstDreamVideoSource * self, CompressedBufferDescriptor * desc)
+{
+	GstClockTime latency = gst_dreamsource_latency_add (&self->latency, gst_dreamsource_latency_measure (desc, self->read_stc));
+
+	if (G_LIKELY (latency == GST_CLOCK_TIME_NONE))
+		return;
+	gst_dreamsource_stats_lock (&self->stats, &self->mutex);
+	self->latency.measured = latency;
+	g_mutex_unlock (&self->mutex);
+	GST_INFO_OBJECT (self, "measured encoder latency %" GST_TIME_FORMAT, GST_TIME_ARGS (latency));
+	gst_element_post_message (GST_ELEMENT (self), gst_message_new_latency (GST_OBJECT (self)));
+}
 
-		while (self->descriptors_count < self->descriptors_available)
+/* while the read loop runs, encoder settings are handed to it instead of
+ * calling into the driver from the application thread */
+static gboolean gst_dreamvideosource_defer (GstDreamVideoSource * self, DreamSourceCommandType type, guint32 value)
+{
+	/* the queue refuses it once the loop stopped, the caller then applies it */
+	if (!g_atomic_int_get (&self->loop_running))
+		return FALSE;
+	return gst_dreamsource_command_queue_push (self->commands, type, value);
+}
+
+/* runs a deferred command on the read loop, or on the thread stopping it
+ * for the ones it didn't get to anymore */
+static void gst_dreamvideosource_execute (GstDreamVideoSource * self, DreamSourceCommand * command)
+{
+	switch (command->type) {
+		case COMMAND_SET_BITRATE:
+			gst_dreamvideosource_set_bitrate (self, command->value);
+			break;
+		case COMMAND_SET_GOP_LENGTH:
+			gst_dreamvideosource_set_goplen (self, command->value);
+			break;
+		case COMMAND_SET_GOP_SCENE:
+			gst_dreamvideosource_set_gop_on_scene_change (self, command->value);
+			break;
+		case COMMAND_SET_OPEN_GOP:
+			gst_dreamvideosource_set_open_gop (self, command->value);
+			break;
+		case COMMAND_SET_BFRAMES:
+			gst_dreamvideosource_set_bframes (self, command->value);
+			break;
+		case COMMAND_SET_PFRAMES:
+			gst_dreamvideosource_set_pframes (self, command->value);
+			break;
+		case COMMAND_SET_SLICES:
+			gst_dreamvideosource_set_slices (self, command->value);
+			break;
+		case COMMAND_SET_LEVEL:
+			gst_dreamvideosource_set_level (self, command->value);
+			break;
+		case COMMAND_SET_INPUT_MODE:
+			gst_dreamvideosource_set_input_mode (self, command->value);
+			break;
+		case COMMAND_RESTART:
+			/* the new settings take effect with the next start anyway */
+			if (self->read_state == READTRREADSTATE_RUNNING)
+				self->restart_pending = TRUE;
+			break;
+		case COMMAND_FLUSH:
+			gst_dreamsource_gop_cache_flush (&self->gop_cache);
+			gst_dreamvideosource_drop_access_unit (self);
+			gst_dreamsource_frame_queue_clear (self->frames);
+			self->discont = TRUE;
+			break;
+		default:
+			break;
+	}
+}
+
+/* settings marked "need restart" in the driver only apply to a fresh start.
+ * The encoder starts over in its ring, so in tracked mode it stays stopped
+ * until downstream has given back all of the old one. */
+static void gst_dreamvideosource_restart (GstDreamVideoSource * self)
+{
+	DescriptorTracker *tracker = self->encoder->tracker;
+
+	g_mutex_lock (&self->mutex);
+	if (!self->restart_stopped)
+	{
+		if (gst_dreamsource_encoder_ioctl (self->encoder, VENC_STOP, NULL) != 0)
 		{
-			GstClockTime encoder_dts = GST_CLOCK_TIME_NONE;
-			GstClockTime encoder_pts = GST_CLOCK_TIME_NONE;
-			GstClockTime result_dts = GST_CLOCK_TIME_NONE;
-			GstClockTime result_pts = GST_CLOCK_TIME_NONE;
-			gint64 dts_pts_offset;
-			gboolean skip_frame = FALSE;
+			GST_WARNING_OBJECT (self, "can't stop encoder for restart: %s (%i)", strerror(errno), errno);
+			self->restart_pending = FALSE;
+			g_mutex_unlock (&self->mutex);
+			return;
+		}
+		self->restart_stopped = TRUE;
+		/* it would only let go at the next keyframe */
+		if (tracker && self->gop_cache.limit && !self->gop_cache.copy)
+			gst_dreamsource_gop_cache_flush (&self->gop_cache);
+	}
+	if (tracker && !gst_dreamsource_tracker_reset (tracker))
+	{
+		GST_LOG_OBJECT (self, "restart waits for %u descriptors referenced downstream", gst_dreamsource_tracker_get_in_flight (tracker));
+		g_mutex_unlock (&self->mutex);
+		return;
+	}
+	self->restart_stopped = FALSE;
+	self->restart_pending = FALSE;
+	if (gst_dreamsource_encoder_ioctl (self->encoder, VENC_START, NULL) != 0)
+		GST_WARNING_OBJECT (self, "can't restart encoder: %s (%i)", strerror(errno), errno);
+	else
+		GST_INFO_OBJECT (self, "restarted encoder");
+	g_mutex_unlock (&self->mutex);
+	self->discont = TRUE;
+}
 
-			off_t offset = self->descriptors_count * VBDSIZE;
-			VideoBufferDescriptor *desc = (VideoBufferDescriptor*)(&enc->buffer[offset]);
+static void gst_dreamvideosource_drain_commands (GstDreamVideoSource * self)
+{
+	DreamSourceCommand command;
+	while (gst_dreamsource_command_queue_pop (self->commands, &command))
+		gst_dreamvideosource_execute (self, &command);
+}
 
-			uint32_t f = desc->stCommon.uiFlags;
+/* sets up the next wait of the read loop, returns the encoder fd to wait
+ * for or -1 and the timeout in ms */
+static int gst_dreamvideosource_read_wait (GstDreamVideoSource * self, int *timeout)
+{
+	EncoderInfo *enc = self->encoder;
 
-			GST_LOG_OBJECT (self, "descriptors_count=%d, descriptors_available=%d\tuiOffset=%d, uiLength=%d", self->descriptors_count, self->descriptors_available, desc->stCommon.uiOffset, desc->stCommon.uiLength);
+	*timeout = 0;
+	if (self->read_state <= READTRREADSTATE_PAUSED)
+		*timeout = -1;
+	else if (self->restart_stopped)
+		/* nothing to read, look again whether downstream is done */
+		*timeout = READTHREAD_TIMEOUT;
+	else if (self->read_state == READTRREADSTATE_RUNNING && self->descriptors_available == 0)
+	{
+		*timeout = READTHREAD_TIMEOUT;
+		if (enc->tracker && gst_dreamsource_tracker_get_in_flight (enc->tracker) >= self->max_frames_in_flight)
+		{
+			GST_LOG_OBJECT (self, "%u frames in flight, waiting for downstream to release some", self->max_frames_in_flight);
+			/* the cache only lets go at the next keyframe, which can't be read
+			 * while it pins the ring, so it goes first */
+			if (self->gop_cache.limit && !self->gop_cache.copy)
+				gst_dreamsource_gop_cache_flush (&self->gop_cache);
+		}
+		else
+		{
+			self->descriptors_count = 0;
+			return enc->fd;
+		}
+	}
+	else if (self->read_state == READTRREADSTATE_RUNNING && self->tracker_full)
+	{
+		/* woken by the tracker's notify once downstream freed some */
+		self->tracker_full = FALSE;
+		*timeout = READTHREAD_TIMEOUT;
+	}
+	else if (self->read_state == READTRREADSTATE_RUNNING && self->queue_full)
+	{
+		/* woken by the queue's notify once create () popped a buffer */
+		self->queue_full = FALSE;
+		*timeout = READTHREAD_TIMEOUT;
+	}
+	return -1;
+}
 
-			if (G_UNLIKELY (f & CDB_FLAG_METADATA))
-			{
-				GST_LOG_OBJECT (self, "CDB_FLAG_METADATA... skip outdated packet");
-				self->descriptors_count = self->descriptors_available;
-				continue;
+/* one iteration of the read loop, called from the read thread or from the
+ * shared reactor with the GST_DREAMSOURCE_REACTOR_* events that fired */
+static gboolean gst_dreamvideosource_read_handle (GstDreamVideoSource * self, guint events, int *fd, int *timeout)
+{
+	EncoderInfo *enc = self->encoder;
+	GstClockTime clock_time = self->read_clock_time;
+	GstClockTime base_time = self->read_base_time;
+	GstBuffer *readbuf = NULL;
+
+	if ( events == 0 && self->descriptors_available == 0 )
+	{
+		gst_dreamsource_stats_lock (&self->stats, &self->mutex);
+		gst_clock_get_internal_time(self->encoder_clock);
+		g_mutex_unlock (&self->mutex);
+		GST_DEBUG_OBJECT (self, "SELECT TIMEOUT");
+		self->discont = TRUE;
+	}
+	else if ( events & GST_DREAMSOURCE_REACTOR_CONTROL )
+	{
+		DreamSourceCommand command;
+		while (self->read_state != READTHREADSTATE_STOP && gst_dreamsource_command_queue_pop (self->commands, &command))
+		{
+			switch (command.type) {
+				case COMMAND_STOP:
+					GST_DEBUG_OBJECT (self, "COMMAND_STOP!");
+					self->read_state = READTHREADSTATE_STOP;
+					break;
+				case COMMAND_PAUSE:
+					GST_DEBUG_OBJECT (self, "COMMAND_PAUSE!");
+					self->read_state = READTRREADSTATE_PAUSED;
+					/* its memory goes back to the driver before the encoder restarts */
+					gst_dreamvideosource_drop_access_unit (self);
+					break;
+				case COMMAND_RUN:
+					GST_DEBUG_OBJECT (self, "COMMAND_RUN");
+					self->read_state = READTRREADSTATE_RUNNING;
+					break;
+				case COMMAND_WAKEUP:
+					GST_LOG_OBJECT (self, "COMMAND_WAKEUP");
+					break;
+				default:
+					gst_dreamvideosource_execute (self, &command);
 			}
+		}
+		goto done;
+	}
+	else if ( G_LIKELY(events & GST_DREAMSOURCE_REACTOR_ENCODER) )
+	{
+		int rlen = gst_dreamsource_encoder_read (enc, enc->buffer, VBUFSIZE);
+		if (G_UNLIKELY (!self->encoder_clock))
+		{
+			GST_DEBUG_OBJECT(self, "no encoder clock yet... continue");
+			goto done;
+		}
+		clock_time = self->read_clock_time = gst_clock_get_internal_time (self->encoder_clock);
+		base_time = self->read_base_time = gst_element_get_base_time(GST_ELEMENT(self));
+		gst_dreamsource_calibration_update (&self->calibration, self->encoder_clock);
+		if (rlen <= 0 || rlen % VBDSIZE ) {
+			if ( errno == 512 )
+				return FALSE;
+			GST_WARNING_OBJECT (self, "read error %s (%i)", strerror(errno), errno);
+			return FALSE;
+		}
+		self->descriptors_available = rlen / VBDSIZE;
+		/* from the clock sample just taken, no extra STC read per read */
+		self->read_stc_valid = gst_dreamsource_clock_time_to_stc (self->encoder_clock, clock_time, &self->read_stc);
+		self->stats.descriptors += self->descriptors_available;
+		gst_dreamsource_frame_queue_set_read_time (self->frames, g_get_monotonic_time ());
+		GST_LOG_OBJECT (self, "encoder buffer was empty, %d descriptors available", self->descriptors_available);
+	}
+	if (gst_dreamsource_frame_queue_is_flushing (self->frames))
+	{
+		GST_DEBUG_OBJECT (self, "FLUSHING!");
+		gst_dreamvideosource_drop_access_unit (self);
+		goto done;
+	}
+
+	while (self->descriptors_count < self->descriptors_available)
+	{
+		GstClockTime encoder_dts = GST_CLOCK_TIME_NONE;
+		GstClockTime encoder_pts = GST_CLOCK_TIME_NONE;
+		GstClockTime result_dts = GST_CLOCK_TIME_NONE;
+		GstClockTime result_pts = GST_CLOCK_TIME_NONE;
+		gint64 dts_pts_offset;
+		guint64 dts_ticks = 0;
+		gboolean skip_frame = FALSE;
+		DescriptorTrackerSlot *slot = NULL;
+
+		off_t offset = self->descriptors_count * VBDSIZE;
+		VideoBufferDescriptor *desc = (VideoBufferDescriptor*)(&enc->buffer[offset]);
+
+		uint32_t f = desc->stCommon.uiFlags;
+		gboolean keyframe_start = FALSE;
+
+		if (self->overflow_policy == GST_DREAMVIDEOSOURCE_OVERFLOW_BLOCK && gst_dreamsource_frame_queue_wait_room (self->frames))
+		{
+			GST_LOG_OBJECT (self, "queue full, leaving %d descriptors in the encoder ring", self->descriptors_available - self->descriptors_count);
+			self->queue_full = TRUE;
+			break;
+		}
 
-			// uiDTS since kernel driver booted
-			if (f & VBD_FLAG_DTS_VALID && desc->uiDTS)
+		/* a descriptor that can't be tracked couldn't be given back either, it
+		 * stays in the ring until downstream frees some (skipping takes them all) */
+		if (enc->tracker && gst_dreamsource_tracker_get_free (enc->tracker) < ((f & CDB_FLAG_METADATA) ? self->descriptors_available - self->descriptors_count : 1))
+		{
+			GST_LOG_OBJECT (self, "descriptor tracker is full, leaving %d descriptors in the encoder ring", self->descriptors_available - self->descriptors_count);
+			self->tracker_full = TRUE;
+			break;
+		}
+
+		GST_LOG_OBJECT (self, "descriptors_count=%d, descriptors_available=%d\tuiOffset=%d, uiLength=%d", self->descriptors_count, self->descriptors_available, desc->stCommon.uiOffset, desc->stCommon.uiLength);
+
+		if (G_UNLIKELY (f & CDB_FLAG_METADATA))
+		{
+			GST_LOG_OBJECT (self, "CDB_FLAG_METADATA... skip outdated packet");
+			/* skipped descriptors have to be given back in order, too */
+			while (enc->tracker && self->descriptors_count < self->descriptors_available)
 			{
-				encoder_dts = MPEGTIME_TO_GSTTIME(desc->uiDTS);
-				GST_LOG_OBJECT (self, "f & VBD_FLAG_DTS_VALID && encoder's uiDTS=%" GST_TIME_FORMAT"", GST_TIME_ARGS(encoder_dts));
+				slot = gst_dreamsource_tracker_acquire (enc->tracker, 0, 0);
+				if (slot)
+					gst_dreamsource_tracker_release (slot);
+				self->descriptors_count++;
+			}
+			self->descriptors_count = self->descriptors_available;
+			continue;
+		}
 
-				g_mutex_lock (&self->mutex);
-				if (G_UNLIKELY (self->dts_offset == GST_CLOCK_TIME_NONE && self->flushing == FALSE))
+		if ((f & CDB_FLAG_FRAME_START) && self->read_stc_valid)
+			gst_dreamvideosource_add_latency (self, &desc->stCommon);
+
+		/* a frame may span several descriptors, the one with CDB_FLAG_FRAME_START
+		 * tells whether it is a random access point. A RAP descriptor after a
+		 * non-RAP one starts a keyframe of its own, for drivers that leave
+		 * CDB_FLAG_FRAME_START off; a later one without RAP never ends a keyframe */
+		if ((f & CDB_FLAG_FRAME_START) || (!self->keyframe && (desc->uiVideoFlags & VBD_FLAG_RAP)))
+		{
+			self->keyframe = (desc->uiVideoFlags & VBD_FLAG_RAP) != 0;
+			keyframe_start = self->keyframe;
+		}
+		self->frame_start = (f & CDB_FLAG_FRAME_START) || keyframe_start;
+		if (self->frame_start)
+			self->frame_ref_idc = -1;
+
+		if (self->inject_headers != GST_DREAMVIDEOSOURCE_INJECT_HEADERS_NEVER)
+			gst_dreamvideosource_scan_param_sets (self, desc, keyframe_start);
+
+		if (enc->tracker)
+			slot = gst_dreamsource_tracker_acquire (enc->tracker, desc->stCommon.uiOffset, desc->stCommon.uiLength);
+
+		// uiDTS since kernel driver booted
+		if (f & VBD_FLAG_DTS_VALID && desc->uiDTS)
+		{
+			dts_ticks = gst_dreamsource_timestamp_unwrap (&self->dts_unit, desc->uiDTS);
+			encoder_dts = gst_dreamsource_timestamp_to_time (&self->dts_unit, dts_ticks);
+			GST_LOG_OBJECT (self, "f & VBD_FLAG_DTS_VALID && encoder's uiDTS=%" GST_TIME_FORMAT"", GST_TIME_ARGS(encoder_dts));
+
+			/* only the first frames after start need the lock */
+			if (G_UNLIKELY (!g_atomic_int_get (&self->dts_valid)))
+			{
+				gst_dreamsource_stats_lock (&self->stats, &self->mutex);
+				if (G_UNLIKELY (self->dts_offset == GST_CLOCK_TIME_NONE && !gst_dreamsource_frame_queue_is_flushing (self->frames)))
 				{
-					if (self->dreamaudiosrc)
+					/* with an audio encoder of the same slot its offset is the one to
+					 * use, otherwise the first one published wins */
+					GstClockTime sync_dts_offset;
+					if (gst_dreamsource_sync_has_member (self->sync, ENCODER_KIND_AUDIO))
+						sync_dts_offset = gst_dreamsource_sync_get_dts_offset (self->sync);
+					else
 					{
-						guint64 audiosource_dts_offset;
-						g_signal_emit_by_name(self->dreamaudiosrc, "get-dts-offset", &audiosource_dts_offset);
-						if (audiosource_dts_offset != GST_CLOCK_TIME_NONE)
-						{
-							GST_DEBUG_OBJECT (self, "use DREAMAUDIOSOURCE's dts_offset=%" GST_TIME_FORMAT "", GST_TIME_ARGS (audiosource_dts_offset) );
-							self->dts_offset = audiosource_dts_offset;
-						}
+						sync_dts_offset = gst_dreamsource_sync_publish (self->sync, encoder_dts - clock_time);
+						GST_DEBUG_OBJECT (self, "use encoder_dts-clock_time as dts_offset (%" GST_TIME_FORMAT" = %" GST_TIME_FORMAT" - %" GST_TIME_FORMAT")", GST_TIME_ARGS (encoder_dts - clock_time), GST_TIME_ARGS (encoder_dts), GST_TIME_ARGS (clock_time));
 					}
-					else if (self->dts_offset == GST_CLOCK_TIME_NONE)
+					if (sync_dts_offset != GST_CLOCK_TIME_NONE)
 					{
-						self->dts_offset = encoder_dts - clock_time;
-						GST_DEBUG_OBJECT (self, "use encoder_dts-clock_time as dts_offset (%" GST_TIME_FORMAT" = %" GST_TIME_FORMAT" - %" GST_TIME_FORMAT")", GST_TIME_ARGS (self->dts_offset), GST_TIME_ARGS (encoder_dts), GST_TIME_ARGS (clock_time));
+						GST_DEBUG_OBJECT (self, "use synchronized dts_offset=%" GST_TIME_FORMAT "", GST_TIME_ARGS (sync_dts_offset));
+						self->dts_offset = sync_dts_offset;
+						/* audio may have started on the other side of a 33 bit wrap */
+						GstClockTime aligned_dts = gst_dreamsource_timestamp_align (&self->dts_unit, encoder_dts, &self->dts_offset);
+						if (aligned_dts != encoder_dts || self->dts_offset != sync_dts_offset)
+						{
+							dts_ticks = self->dts_unit.last_ticks;
+							encoder_dts = aligned_dts;
+							GST_INFO_OBJECT (self, "aligned DTS to audio across a timestamp wrap, encoder_dts=%" GST_TIME_FORMAT " dts_offset=%" GST_TIME_FORMAT, GST_TIME_ARGS (encoder_dts), GST_TIME_ARGS (self->dts_offset));
+						}
 					}
 				}
-				if (G_UNLIKELY (self->dts_valid == FALSE && self->dts_offset != GST_CLOCK_TIME_NONE))
-					self->dts_valid = TRUE;
+				if (self->dts_offset != GST_CLOCK_TIME_NONE)
+					g_atomic_int_set (&self->dts_valid, TRUE);
 				g_mutex_unlock (&self->mutex);
 			}
+		}
 
-			g_mutex_lock (&self->mutex);
-			if (G_UNLIKELY (self->dts_valid == FALSE))
-			{
-				GST_DEBUG_OBJECT (self, "dts_valid not set, skipping frame...");
-				self->descriptors_count++;
-				g_mutex_unlock (&self->mutex);
-				break;
-			}
-			else
-				g_mutex_unlock (&self->mutex);
+		if (G_UNLIKELY (!g_atomic_int_get (&self->dts_valid)))
+		{
+			GST_DEBUG_OBJECT (self, "dts_valid not set, skipping frame...");
+			self->descriptors_count++;
+			if (slot)
+				gst_dreamsource_tracker_release (slot);
+			break;
+		}
 
-			if (G_UNLIKELY (encoder_dts < self->dts_offset))
-			{
-				GST_DEBUG_OBJECT (self, "encoder_dts < dts_offset, skipping frame...");
-				skip_frame = TRUE;
-			}
+		if (G_UNLIKELY (encoder_dts < self->dts_offset))
+		{
+			GST_DEBUG_OBJECT (self, "encoder_dts < dts_offset, skipping frame...");
+			skip_frame = TRUE;
+		}
 // 			if (self->video_info.fps_d)
 // 				GST_BUFFER_DURATION(readbuf) = gst_util_uint64_scale (GST_SECOND, self->video_info.fps_d, self->video_info.fps_n);
 
-			if (!skip_frame && encoder_dts != GST_CLOCK_TIME_NONE)
-			{
-				if (f & CDB_FLAG_PTS_VALID)
-					encoder_pts = MPEGTIME_TO_GSTTIME(desc->stCommon.uiPTS);
-				else
-					encoder_pts = encoder_dts;
-				dts_pts_offset = encoder_pts - encoder_dts;
-
-				GstClockTime orig_dts_clock_time = encoder_dts - self->dts_offset;
-				GstClockTime orig_pts_clock_time = orig_dts_clock_time + dts_pts_offset;
-				GstClockTime calib_dts_clock_time = orig_dts_clock_time;
-
-				GstClockTime internal, external;
-				GstClockTime rate_n, rate_d;
-				GstClockTimeDiff diff;
-
-				gst_clock_get_calibration (self->encoder_clock, &internal, &external, &rate_n, &rate_d);
-
-				if (internal > orig_dts_clock_time) {
-					diff = internal - orig_dts_clock_time;
-					diff = gst_util_uint64_scale (diff, rate_n, rate_d);
-					calib_dts_clock_time = external - diff;
-				} else {
-					diff = orig_dts_clock_time - internal;
-					diff = gst_util_uint64_scale (diff, rate_n, rate_d);
-					calib_dts_clock_time = external + diff;
-				}
+		if (!skip_frame && encoder_dts != GST_CLOCK_TIME_NONE)
+		{
+			if (f & CDB_FLAG_PTS_VALID)
+				encoder_pts = gst_dreamsource_timestamp_to_time (&self->dts_unit, gst_dreamsource_timestamp_unwrap_near (&self->dts_unit, desc->stCommon.uiPTS, dts_ticks));
+			else
+				encoder_pts = encoder_dts;
+			dts_pts_offset = encoder_pts - encoder_dts;
 
-				if ( calib_dts_clock_time < base_time )
-				{
-					GST_DEBUG_OBJECT (self, "calib_dts_clock_time < base_time, skipping frame...");
-					skip_frame = TRUE;
-				}
-				result_dts = calib_dts_clock_time - base_time;
-				result_pts = result_dts + dts_pts_offset;
-
-#define extra_timestamp_debug
-#ifdef extra_timestamp_debug
-				GstClockTime my_int_time = gst_clock_get_internal_time(self->encoder_clock);
-				GstClockTime pipeline_int_time = GST_CLOCK_TIME_NONE;
-				GstClock *elemclk = gst_element_get_clock (GST_ELEMENT (self));
-				if (elemclk)
-				{
-					pipeline_int_time = gst_clock_get_internal_time(elemclk);
-					gst_object_unref (elemclk);
-				}
+			GstClockTime orig_dts_clock_time = encoder_dts - self->dts_offset;
+			GstClockTime calib_dts_clock_time = gst_dreamsource_calibration_apply (&self->calibration, orig_dts_clock_time);
 
-				GST_LOG_OBJECT (self, "post-calibration\n"
-				"  %" GST_TIME_FORMAT " =base_time       %" GST_TIME_FORMAT " =clock_time            %" PRId64 " =dts_pts_offset\n"
-				"  %" GST_TIME_FORMAT " =encoder_dts     %" GST_TIME_FORMAT " =orig_dts_clock_time   %" GST_TIME_FORMAT " =calib_dts_clock_time   %" GST_TIME_FORMAT " =result_dts\n"
-				"  %" GST_TIME_FORMAT " =encoder_pts     %" GST_TIME_FORMAT " =orig_pts_clock_time                                            %" GST_TIME_FORMAT " =result_pts\n"
-				"  %" GST_TIME_FORMAT " =internal        %" GST_TIME_FORMAT " =external              %" GST_TIME_FORMAT " =diff                   %" PRId64 "/%" PRId64 " =rate\n"
-				"  %" GST_TIME_FORMAT " =my_int_time     %" GST_TIME_FORMAT " =pipeline_int_time"
-				,
-				GST_TIME_ARGS (base_time), GST_TIME_ARGS (clock_time), dts_pts_offset,
-				GST_TIME_ARGS (encoder_dts), GST_TIME_ARGS (orig_dts_clock_time), GST_TIME_ARGS (calib_dts_clock_time), GST_TIME_ARGS (result_dts),
-				GST_TIME_ARGS (encoder_pts), GST_TIME_ARGS (orig_pts_clock_time), GST_TIME_ARGS (result_pts),
-				GST_TIME_ARGS (internal), GST_TIME_ARGS (external), GST_TIME_ARGS (diff), rate_n, rate_d,
-				GST_TIME_ARGS (my_int_time), GST_TIME_ARGS (pipeline_int_time)
-				);
-#endif
+			if ( calib_dts_clock_time < base_time )
+			{
+				GST_DEBUG_OBJECT (self, "calib_dts_clock_time < base_time, skipping frame...");
+				skip_frame = TRUE;
 			}
+			result_dts = calib_dts_clock_time - base_time;
+			result_pts = result_dts + dts_pts_offset;
 
-			if (!skip_frame)
+			if (GST_DREAMSOURCE_TRACING)
 			{
-				readbuf = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, enc->cdb, VMMAPSIZE, desc->stCommon.uiOffset, desc->stCommon.uiLength, self, NULL);
-				if (result_dts != GST_CLOCK_TIME_NONE)
-				{
-					GST_BUFFER_DTS(readbuf) = result_dts;
-					GST_BUFFER_PTS(readbuf) = result_pts;
-				}
+				DreamSourceTimestamps ts = { base_time, clock_time, encoder_dts, encoder_pts, orig_dts_clock_time, calib_dts_clock_time,
+					self->calibration.internal, self->calibration.external, self->calibration.rate_n, self->calibration.rate_d, result_dts, result_pts };
+				gst_dreamsource_tracer_log_timestamps (GST_ELEMENT_CAST (self), &ts);
 			}
-
-#ifdef dump
-			int wret = write(self->dumpfd, (unsigned char*)(enc->cdb + desc->stCommon.uiOffset), desc->stCommon.uiLength);
-			GST_LOG_OBJECT (self, "read %i dumped %i total %" G_GSIZE_FORMAT " ", desc->stCommon.uiLength, wret, gst_buffer_get_size (*outbuf) );
-#endif
-			self->descriptors_count++;
-			break;
 		}
 
-		if (self->descriptors_count == self->descriptors_available)
+		if (!skip_frame)
 		{
-			GST_LOG_OBJECT (self, "self->descriptors_count == self->descriptors_available -> release %i consumed descriptors", self->descriptors_count);
-			if (state == READTHREADSTATE_STOP)
-				GST_DEBUG_OBJECT (self, "readthread stopping, don't write to fd anymore!");
-			/* release consumed descs */
-			else if (write(enc->fd, &self->descriptors_count, sizeof(self->descriptors_count)) != sizeof(self->descriptors_count)) {
-				GST_WARNING_OBJECT (self, "release consumed descs write error!");
-				goto stop_running;
+			if (slot)
+				readbuf = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, enc->cdb, VMMAPSIZE, desc->stCommon.uiOffset, desc->stCommon.uiLength, slot, (GDestroyNotify) gst_dreamsource_tracker_release);
+			else
+				readbuf = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, enc->cdb, VMMAPSIZE, desc->stCommon.uiOffset, desc->stCommon.uiLength, self, NULL);
+			if (result_dts != GST_CLOCK_TIME_NONE)
+			{
+				GST_BUFFER_DTS(readbuf) = result_dts;
+				GST_BUFFER_PTS(readbuf) = result_pts;
+			}
+			GST_BUFFER_OFFSET(readbuf) = self->offset;
+			GST_BUFFER_OFFSET_END(readbuf) = self->offset += desc->stCommon.uiLength;
+			/* a single descriptor can't be dropped on its own, the AUD and SEI in
+			 * front of the slice would already be queued */
+			if (self->overflow_policy == GST_DREAMVIDEOSOURCE_OVERFLOW_NON_REFERENCE && self->alignment_au && self->frame_ref_idc < 0)
+				self->frame_ref_idc = gst_dreamsource_h264_slice_ref_idc (enc->cdb + desc->stCommon.uiOffset, desc->stCommon.uiLength);
+			if (self->frame_ref_idc == 0)
+				GST_BUFFER_FLAG_SET (readbuf, GST_BUFFER_FLAG_DROPPABLE);
+			if (!self->keyframe)
+				GST_BUFFER_FLAG_SET (readbuf, GST_BUFFER_FLAG_DELTA_UNIT);
+			else if (keyframe_start)
+			{
+				if (self->inject_headers != GST_DREAMVIDEOSOURCE_INJECT_HEADERS_NEVER)
+					gst_dreamvideosource_inject_param_sets (self, readbuf);
+				GST_DEBUG_OBJECT (self, "keyframe at offset %" G_GUINT64_FORMAT " pts %" GST_TIME_FORMAT, GST_BUFFER_OFFSET(readbuf), GST_TIME_ARGS(result_pts));
+				gst_dreamsource_keyframe_index_add (&self->keyframes, result_pts, result_dts, GST_BUFFER_OFFSET(readbuf));
 			}
-			self->descriptors_available = 0;
 		}
+		else if (slot)
+			gst_dreamsource_tracker_release (slot);
 
-		if (readbuf)
+#ifdef dump
+		int wret = write(self->dumpfd, (unsigned char*)(enc->cdb + desc->stCommon.uiOffset), desc->stCommon.uiLength);
+		GST_LOG_OBJECT (self, "read %i dumped %i total %" G_GSIZE_FORMAT " ", desc->stCommon.uiLength, wret, gst_buffer_get_size (*outbuf) );
+#endif
+		if (self->alignment_au)
 		{
-			g_mutex_lock (&self->mutex);
-			if (!self->flushing)
-			{
-				while (g_queue_get_length (&self->current_frames) >= self->buffer_size)
-				{
-					GstBuffer * oldbuf = g_queue_pop_head (&self->current_frames);
-					GST_WARNING_OBJECT (self, "dropping %" GST_PTR_FORMAT " because of queue overflow! buffers count=%i", oldbuf, g_queue_get_length (&self->current_frames));
-					gst_buffer_unref(oldbuf);
-					GST_BUFFER_FLAG_SET ((GstBuffer *) g_queue_peek_head (&self->current_frames), GST_BUFFER_FLAG_DISCONT);
-				}
-				if (discont)
-				{
-					GST_BUFFER_FLAG_SET (readbuf, GST_BUFFER_FLAG_DISCONT);
-					discont = FALSE;
-				}
-				g_queue_push_tail (&self->current_frames, readbuf);
-				GST_INFO_OBJECT (self, "read %" GST_PTR_FORMAT " to queue... buffers count=%i", readbuf, g_queue_get_length (&self->current_frames));
-				g_cond_signal (&self->cond);
-			}
-			else
-				gst_buffer_unref(readbuf);
-// 			g_cond_signal (&self->cond);
-			g_mutex_unlock (&self->mutex);
+			gst_dreamvideosource_assemble (self, readbuf, f);
+			readbuf = NULL;
+			/* the slice may come after the descriptor the access unit started with */
+			if (self->frame_ref_idc == 0 && self->access_unit)
+				GST_BUFFER_FLAG_SET (self->access_unit, GST_BUFFER_FLAG_DROPPABLE);
 		}
+		self->descriptors_count++;
+		if (self->batch)
+		{
+			if (readbuf)
+				gst_dreamvideosource_enqueue (self, readbuf, &self->discont);
+			readbuf = NULL;
+			continue;
+		}
+		break;
 	}
 
-	g_assert_not_reached ();
-	return;
+	if (self->descriptors_count == self->descriptors_available)
+	{
+		GST_LOG_OBJECT (self, "self->descriptors_count == self->descriptors_available -> release %i consumed descriptors", self->descriptors_count);
+		if (self->read_state == READTHREADSTATE_STOP)
+			GST_DEBUG_OBJECT (self, "readthread stopping, don't write to fd anymore!");
+		else if (enc->tracker)
+			GST_LOG_OBJECT (self, "tracked release mode, descriptors are given back when their memory is freed");
+		/* release consumed descs */
+		else if (gst_dreamsource_encoder_release (enc, self->descriptors_count) != 0) {
+			GST_WARNING_OBJECT (self, "release consumed descs write error!");
+			return FALSE;
+		}
+		self->descriptors_available = 0;
+	}
 
-	stop_running:
+	if (readbuf)
 	{
-//		g_mutex_unlock (&self->mutex);
-		g_cond_signal (&self->cond);
-		GST_DEBUG ("stop running, exit thread");
-		message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_LEAVE, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
-		g_value_init (&val, GST_TYPE_G_THREAD);
-		g_value_set_boxed (&val, self->readthread);
-		gst_message_set_stream_status_object (message, &val);
-		g_value_unset (&val);
-		GST_DEBUG_OBJECT (self, "posting LEAVE stream status");
-		gst_element_post_message (GST_ELEMENT_CAST (self), message);
+		gst_dreamvideosource_enqueue (self, readbuf, &self->discont);
+		readbuf = NULL;
+	}
+	gst_dreamsource_frame_queue_publish (self->frames);
+	if (self->abr && self->descriptors_available == 0)
+		gst_dreamvideosource_abr_update (self);
+
+done:
+	if (self->restart_pending && self->descriptors_available == 0 && self->read_state == READTRREADSTATE_RUNNING)
+		gst_dreamvideosource_restart (self);
+	if (self->read_state == READTHREADSTATE_STOP)
+		return FALSE;
+	*fd = gst_dreamvideosource_read_wait (self, timeout);
+	return TRUE;
+}
+
+static void gst_dreamvideosource_read_thread_func (GstDreamVideoSource * self)
+{
+	EncoderInfo *enc = self->encoder;
+	int fd, timeout;
+
+	if (!enc) {
+		GST_WARNING_OBJECT (self, "encoder device not opened!");
 		return;
 	}
+
+	GST_DEBUG_OBJECT (self, "enter read thread");
+
+	GstMessage *message;
+	GValue val = { 0 };
+
+	message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_ENTER, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
+	g_value_init (&val, GST_TYPE_G_THREAD);
+	g_value_set_boxed (&val, self->readthread);
+	gst_message_set_stream_status_object (message, &val);
+	g_value_unset (&val);
+	GST_DEBUG_OBJECT (self, "posting ENTER stream status");
+	gst_element_post_message (GST_ELEMENT_CAST (self), message);
+
+	fd = gst_dreamvideosource_read_wait (self, &timeout);
+	while (TRUE) {
+		struct pollfd rfd[2];
+		guint events = 0;
+
+		rfd[0].fd = self->commands->fd;
+		rfd[0].events = POLLIN | POLLERR | POLLHUP | POLLPRI;
+		rfd[1].fd = fd;
+		rfd[1].events = POLLIN;
+		rfd[1].revents = 0;
+
+		int ret = poll(rfd, fd >= 0 ? 2 : 1, timeout);
+
+		if (G_UNLIKELY (ret == -1))
+		{
+			GST_ERROR_OBJECT (self, "SELECT ERROR!");
+			break;
+		}
+		if (rfd[0].revents)
+			events |= GST_DREAMSOURCE_REACTOR_CONTROL;
+		if (rfd[1].revents & POLLIN)
+			events |= GST_DREAMSOURCE_REACTOR_ENCODER;
+		if (!gst_dreamvideosource_read_handle (self, events, &fd, &timeout))
+			break;
+	}
+
+	GST_DEBUG ("stop running, exit thread");
+	message = gst_message_new_stream_status (GST_OBJECT_CAST (self), GST_STREAM_STATUS_TYPE_LEAVE, GST_ELEMENT_CAST (GST_OBJECT_PARENT(self)));
+	g_value_init (&val, GST_TYPE_G_THREAD);
+	g_value_set_boxed (&val, self->readthread);
+	gst_message_set_stream_status_object (message, &val);
+	g_value_unset (&val);
+	GST_DEBUG_OBJECT (self, "posting LEAVE stream status");
+	gst_element_post_message (GST_ELEMENT_CAST (self), message);
 }
 
 static GstFlowReturn
@@ -1293,21 +2425,36 @@ gst_dreamvideosource_create (GstPushSrc * psrc, GstBuffer ** outbuf)
 {
 	GstDreamVideoSource *self = GST_DREAMVIDEOSOURCE (psrc);
 
-	GST_LOG_OBJECT (self, "new buffer requested. queue has %i buffers", g_queue_get_length (&self->current_frames));
+	GST_LOG_OBJECT (self, "new buffer requested. queue has %i buffers", gst_dreamsource_frame_queue_get_length (self->frames));
 
-	g_mutex_lock (&self->mutex);
-	while (g_queue_is_empty (&self->current_frames) && !self->flushing)
-	{
-		GST_INFO_OBJECT (self, "waiting for buffer from encoder");
-		g_cond_wait (&self->cond, &self->mutex);
-	}
-
-	*outbuf = g_queue_pop_head (&self->current_frames);
-	g_mutex_unlock (&self->mutex);
+	gint64 read_time = 0;
+	*outbuf = gst_dreamsource_frame_queue_pop_stamped (self->frames, &read_time);
 
 	if (*outbuf)
 	{
-		GST_INFO_OBJECT (self, "pushing %" GST_PTR_FORMAT ". queue has %i buffers", *outbuf, g_queue_get_length (&self->current_frames));
+		/* the negotiated caps, the pad has none before the first codec_data */
+		GstBuffer *codec_data = NULL;
+		GstCaps *caps = NULL;
+		g_mutex_lock (&self->mutex);
+		if (self->codec_data)
+		{
+			codec_data = self->codec_data;
+			self->codec_data = NULL;
+			gst_caps_replace (&caps, self->current_caps);
+		}
+		g_mutex_unlock (&self->mutex);
+		if (caps)
+		{
+			caps = gst_caps_make_writable (caps);
+			gst_caps_set_simple (caps, "codec_data", GST_TYPE_BUFFER, codec_data, NULL);
+			GST_DEBUG_OBJECT (self, "new codec_data, caps %" GST_PTR_FORMAT, caps);
+			gst_pad_push_event (GST_BASE_SRC_PAD (self), gst_event_new_caps (caps));
+			gst_caps_unref (caps);
+		}
+		if (codec_data)
+			gst_buffer_unref (codec_data);
+		GST_INFO_OBJECT (self, "pushing %" GST_PTR_FORMAT ". queue has %i buffers", *outbuf, gst_dreamsource_frame_queue_get_length (self->frames));
+		gst_dreamsource_stats_add_latency (&self->stats, read_time);
 		return GST_FLOW_OK;
 	}
 	GST_INFO_OBJECT (self, "FLUSHING");
@@ -1326,25 +2473,30 @@ static GstStateChangeReturn gst_dreamvideosource_change_state (GstElement * elem
 		{
 			if (!gst_dreamvideosource_encoder_init (self))
 			{
+				gst_dreamvideosource_encoder_release (self);
 				GError *err = g_error_new (GST_RESOURCE_ERROR, GST_RESOURCE_ERROR_READ, "Can't initialize encoder device");
 				GstMessage *msg = gst_message_new_error (GST_OBJECT (self), err, NULL);
 				gst_element_post_message (element, msg);
 				g_error_free (err);
 				return GST_STATE_CHANGE_FAILURE;
 			}
+			self->sync = gst_dreamsource_sync_obtain (element, self->encoder->device_index);
+			gst_dreamsource_sync_join (self->sync, ENCODER_KIND_VIDEO);
 			GST_DEBUG_OBJECT (self, "GST_STATE_CHANGE_NULL_TO_READY");
 			break;
 		}
 		case GST_STATE_CHANGE_READY_TO_PAUSED:
 			GST_LOG_OBJECT (self, "GST_STATE_CHANGE_READY_TO_PAUSED");
-			self->dreamaudiosrc = gst_bin_get_by_name_recurse_up(GST_BIN(GST_ELEMENT_PARENT(self)), "dreamaudiosource0");
+			gst_dreamsource_sync_start (self->sync);
+			self->dreamaudiosrc = gst_dreamsource_device_get_peer (self->encoder);
 		#ifdef PROVIDE_CLOCK
 			if (self->dreamaudiosrc)
 			{
 				self->encoder_clock = gst_element_provide_clock (self->dreamaudiosrc);
 				GST_DEBUG_OBJECT (self, "using dreamaudiosrc's encoder_clock = %" GST_PTR_FORMAT, self->encoder_clock);
 			} else {
-				self->encoder_clock = gst_dreamsource_clock_new ("GstDreamVideoSourceClock", self->encoder->fd);
+				self->encoder_clock = gst_dreamsource_clock_new ("GstDreamVideoSourceClock", self->encoder);
+				g_object_set (self->encoder_clock, "mode", self->clock_mode, NULL);
 				GST_OBJECT_FLAG_SET (self, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
 				GstMessage* msg;
 				msg = gst_message_new_clock_provide (GST_OBJECT_CAST (element), self->encoder_clock, TRUE);
@@ -1353,14 +2505,74 @@ static GstStateChangeReturn gst_dreamvideosource_change_state (GstElement * elem
 			}
 		#endif
 			self->dts_offset = GST_CLOCK_TIME_NONE;
-			self->flushing = TRUE;
+			gst_dreamsource_timestamp_reset (&self->dts_unit);
+			gst_dreamsource_stats_reset (&self->stats);
+			gst_dreamsource_latency_reset (&self->latency);
+			gst_dreamsource_keyframe_index_reset (&self->keyframes);
+			self->keyframe = FALSE;
+			self->offset = 0;
+			self->overflow_skip = FALSE;
+			self->frame_ref_idc = -1;
+			self->tracker_full = FALSE;
+			self->queue_full = FALSE;
+			gst_dreamsource_h264_headers_clear (&self->h264_headers);
+			gst_buffer_replace (&self->codec_data, NULL);
+			gst_dreamvideosource_clear_param_sets (self);
+			gst_dreamsource_frame_queue_set_flushing (self->frames, TRUE);
+			/* neither side of the queue runs yet */
+			self->buffer_size = self->tune == GST_DREAMVIDEOSOURCE_TUNE_ZEROLATENCY ? ZEROLATENCY_BUFFER_SIZE : DEFAULT_BUFFER_SIZE;
+			gst_dreamsource_frame_queue_set_limit (self->frames, self->buffer_size);
+			self->read_state = READTHREADSTATE_NONE;
+			self->discont = TRUE;
+			self->restart_pending = FALSE;
+			self->restart_stopped = FALSE;
+			/* in tracked mode the cache holds on to encoder memory, so it must neither
+			 * take up the ring nor the frames in flight the read loop waits for. It
+			 * is bounded by descriptors, with alignment=au a buffer holds several */
+			if (self->release_mode == GST_DREAMSOURCE_RELEASE_MODE_TRACKED)
+				gst_dreamsource_gop_cache_configure (&self->gop_cache, MIN (self->gop_cache_size, VMMAPSIZE / 2), self->max_frames_in_flight / 2, FALSE);
+			else
+				gst_dreamsource_gop_cache_configure (&self->gop_cache, self->gop_cache_size, 0, TRUE);
+			/* the same goes for frames waiting for the time-shift writer */
+			if (self->release_mode == GST_DREAMSOURCE_RELEASE_MODE_TRACKED)
+				gst_dreamvideosource_timeshift_start (self, MAX (self->max_frames_in_flight / 4, 1), FALSE);
+			else
+				gst_dreamvideosource_timeshift_start (self, TIMESHIFT_MAX_QUEUED, TRUE);
+			/* every start begins at the configured bitrate, whatever ABR chose before */
+			if (self->video_info.bitrate != self->bitrate)
+				gst_dreamvideosource_set_bitrate (self, self->bitrate);
+			gst_dreamsource_abr_init (&self->abr_controller, self->abr_min_bitrate, self->abr_max_bitrate ? self->abr_max_bitrate : self->bitrate);
+			gst_dreamsource_command_queue_open (self->commands);
+			g_atomic_int_set (&self->loop_running, TRUE);
+			if (self->shared_reactor)
+			{
+				self->reactor = gst_dreamsource_reactor_get ();
+				self->reactor_source = gst_dreamsource_reactor_add (self->reactor, self->commands->fd, (DreamSourceReactorFunc) gst_dreamvideosource_read_handle, self);
+				GST_DEBUG_OBJECT (self, "reading on the shared reactor");
+				break;
+			}
 			self->readthread = g_thread_try_new ("dreamvideosrc-read", (GThreadFunc) gst_dreamvideosource_read_thread_func, self, NULL);
 			GST_DEBUG_OBJECT (self, "started readthread @%p", self->readthread );
 			break;
 		case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
-			g_mutex_lock (&self->mutex);
 			GST_LOG_OBJECT (self, "GST_STATE_CHANGE_PAUSED_TO_PLAYING");
-			self->dts_valid = FALSE;
+			if (self->encoder->tracker)
+			{
+				/* the encoder starts over in its ring, nothing may reference
+				 * the old one anymore. What this element holds goes first,
+				 * downstream gets a while to let go of the rest. */
+				if (self->gop_cache.limit && !self->gop_cache.copy)
+					gst_dreamsource_gop_cache_flush (&self->gop_cache);
+				gst_dreamsource_frame_queue_clear (self->frames);
+				if (!gst_dreamsource_tracker_wait_idle (self->encoder->tracker, TRACKER_IDLE_TIMEOUT) || !gst_dreamsource_tracker_reset (self->encoder->tracker))
+				{
+					GST_ELEMENT_ERROR (self, RESOURCE, BUSY, ("Encoder memory is still in use, can't restart the encoder."),
+						("%u descriptors still referenced downstream", gst_dreamsource_tracker_get_in_flight (self->encoder->tracker)));
+					return GST_STATE_CHANGE_FAILURE;
+				}
+			}
+			g_mutex_lock (&self->mutex);
+			g_atomic_int_set (&self->dts_valid, FALSE);
 			GstClock *pipeline_clock = gst_element_get_clock (GST_ELEMENT (self));
 			if (pipeline_clock)
 			{
@@ -1376,11 +2588,17 @@ static GstStateChangeReturn gst_dreamvideosource_change_state (GstElement * elem
 			}
 				else
 					GST_WARNING_OBJECT (self, "no pipeline clock!");
-			ret = ioctl(self->encoder->fd, VENC_START);
+			/* the ones the tracker had no slot for when pausing */
+			if (self->descriptors_untracked)
+				gst_dreamsource_encoder_release (self->encoder, self->descriptors_untracked);
+			self->descriptors_untracked = 0;
+			/* starting over applies whatever a pending restart was for */
+			self->restart_pending = FALSE;
+			self->restart_stopped = FALSE;
+			ret = gst_dreamsource_encoder_ioctl (self->encoder, VENC_START, NULL);
 			if ( ret != 0 )
 				goto fail;
 			self->descriptors_available = 0;
-			CLEAR_COMMAND (self);
 			g_mutex_unlock (&self->mutex);
 			break;
 		default:
@@ -1393,19 +2611,36 @@ static GstStateChangeReturn gst_dreamvideosource_change_state (GstElement * elem
 	switch (transition) {
 		case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
 			g_mutex_lock (&self->mutex);
-			SEND_COMMAND (self, CONTROL_RUN);
+			gst_dreamsource_command_queue_push (self->commands, COMMAND_RUN, 0);
 			GST_INFO_OBJECT (self, "started encoder!");
 			g_mutex_unlock (&self->mutex);
 			break;
 		case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
 			g_mutex_lock (&self->mutex);
 			GST_DEBUG_OBJECT (self, "GST_STATE_CHANGE_PLAYING_TO_PAUSED self->descriptors_count=%i self->descriptors_available=%i", self->descriptors_count, self->descriptors_available);
-			SEND_COMMAND (self, CONTROL_PAUSE);
-			if (self->descriptors_count < self->descriptors_available)
+			gst_dreamsource_command_queue_push (self->commands, COMMAND_PAUSE, 0);
+			if (self->encoder->tracker)
+			{
+				/* unread descriptors go back in ring order behind the ones still
+				 * referenced, the encoder only restarts once all are back */
+				DescriptorTrackerSlot *slot;
+				while (self->descriptors_count < self->descriptors_available && (slot = gst_dreamsource_tracker_acquire (self->encoder->tracker, 0, 0)))
+				{
+					gst_dreamsource_tracker_release (slot);
+					self->descriptors_count++;
+				}
+				self->descriptors_untracked = self->descriptors_available - self->descriptors_count;
 				self->descriptors_count = self->descriptors_available;
-			if (self->descriptors_count)
-				write(self->encoder->fd, &self->descriptors_count, sizeof(self->descriptors_count));
-			ret = ioctl(self->encoder->fd, VENC_STOP);
+			}
+			else
+			{
+				if (self->descriptors_count < self->descriptors_available)
+					self->descriptors_count = self->descriptors_available;
+				if (self->descriptors_count)
+					gst_dreamsource_encoder_release (self->encoder, self->descriptors_count);
+			}
+			/* unless a restart already stopped it */
+			ret = self->restart_stopped ? 0 : gst_dreamsource_encoder_ioctl (self->encoder, VENC_STOP, NULL);
 			if ( ret != 0 )
 				goto fail;
 #ifdef PROVIDE_CLOCK
@@ -1421,9 +2656,29 @@ static GstStateChangeReturn gst_dreamvideosource_change_state (GstElement * elem
 			if (!self->dreamaudiosrc)
 				gst_clock_set_calibration (self->encoder_clock, 0, 0, 1, 1);
 #endif
-			GST_DEBUG_OBJECT (self, "stopping readthread @%p...", self->readthread);
-			SEND_COMMAND (self, CONTROL_STOP);
-			g_thread_join (self->readthread);
+			if (self->reactor)
+			{
+				gst_dreamsource_reactor_remove (self->reactor, self->reactor_source);
+				gst_dreamsource_reactor_unref (self->reactor);
+				self->reactor = NULL;
+				self->reactor_source = NULL;
+				self->read_state = READTHREADSTATE_STOP;
+			}
+			else
+			{
+				GST_DEBUG_OBJECT (self, "stopping readthread @%p...", self->readthread);
+				gst_dreamsource_command_queue_push (self->commands, COMMAND_STOP, 0);
+				g_thread_join (self->readthread);
+			}
+			g_atomic_int_set (&self->loop_running, FALSE);
+			/* a setter that still saw the loop running must not leave its
+			 * command for the next start, it gets it applied directly instead */
+			gst_dreamsource_command_queue_close (self->commands);
+			gst_dreamvideosource_drain_commands (self);
+			gst_dreamsource_gop_cache_flush (&self->gop_cache);
+			gst_dreamvideosource_timeshift_stop (self);
+			gst_dreamsource_sync_stop (self->sync);
+			gst_dreamvideosource_drop_access_unit (self);
 			if (self->dreamaudiosrc)
 				gst_object_unref(self->dreamaudiosrc);
 			self->dreamaudiosrc = NULL;
@@ -1460,8 +2715,21 @@ gst_dreamvideosource_dispose (GObject * gobject)
 		gst_caps_unref(self->current_caps);
 	if (self->new_caps)
 		gst_caps_unref(self->new_caps);
+	if (self->frames) {
+		gst_dreamsource_frame_queue_free (self->frames);
+		self->frames = NULL;
+	}
+	if (self->commands) {
+		gst_dreamsource_command_queue_free (self->commands);
+		self->commands = NULL;
+	}
+	gst_dreamsource_keyframe_index_clear (&self->keyframes);
+	gst_dreamsource_h264_headers_clear (&self->h264_headers);
+	gst_buffer_replace (&self->codec_data, NULL);
+	gst_dreamvideosource_clear_param_sets (self);
+	gst_dreamsource_gop_cache_clear (&self->gop_cache);
+	g_free (self->timeshift_location);
 	g_mutex_clear (&self->mutex);
-	g_cond_clear (&self->cond);
 	GST_DEBUG_OBJECT (self, "disposed");
 	G_OBJECT_CLASS (parent_class)->dispose (gobject);
 }
@@ -48,6 +48,16 @@ G_BEGIN_DECLS
 #define VENC_GET_STC        _IOR('v', 141, uint32_t)
 #define VENC_SET_SLICES_PER_PIC _IOW('v', 142, unsigned int) /* 0 = encode default, max 16 */
 #define VENC_SET_NEW_GOP_ON_NEW_SCENE _IOW('v', 143, unsigned int) /* currently not on mipsel */
+/* not on every driver, the numbers are given to configure */
+#ifdef VENC_CUSTOM_RESOLUTION_IOCTL
+#define VENC_SET_CUSTOM_RESOLUTION _IOW('v', VENC_CUSTOM_RESOLUTION_IOCTL, unsigned int) /* width << 16 | height for fmt_custom, need restart */
+#endif
+#ifdef VENC_CUSTOM_FRAMERATE_IOCTL
+#define VENC_SET_CUSTOM_FRAMERATE  _IOW('v', VENC_CUSTOM_FRAMERATE_IOCTL, unsigned int) /* fps_n << 16 | fps_d for rate_custom */
+#endif
+
+#define VENC_CUSTOM_MIN_WIDTH   128
+#define VENC_CUSTOM_MIN_HEIGHT  96
 
 enum venc_framerate {
         rate_custom = 0,
@@ -124,6 +134,31 @@ typedef enum venc_source {
 
 #define GST_TYPE_DREAMVIDEOSOURCE_INPUT_MODE (gst_dreamvideosource_input_mode_get_type ())
 
+typedef enum {
+	GST_DREAMVIDEOSOURCE_INJECT_HEADERS_NEVER = 0,
+	GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ON_CHANGE,   /* at the first keyframe after they changed */
+	GST_DREAMVIDEOSOURCE_INJECT_HEADERS_ALWAYS       /* at every keyframe */
+} GstDreamVideoSourceInjectHeaders;
+
+#define GST_TYPE_DREAMVIDEOSOURCE_INJECT_HEADERS (gst_dreamvideosource_inject_headers_get_type ())
+
+typedef enum {
+	GST_DREAMVIDEOSOURCE_TUNE_NONE = 0,
+	GST_DREAMVIDEOSOURCE_TUNE_ZEROLATENCY    /* no B-frames, sliced pictures, one access unit queued */
+} GstDreamVideoSourceTune;
+
+#define GST_TYPE_DREAMVIDEOSOURCE_TUNE (gst_dreamvideosource_tune_get_type ())
+
+/* what the read loop does when the frame queue is full */
+typedef enum {
+	GST_DREAMVIDEOSOURCE_OVERFLOW_LEAKY = 0,       /* drop the oldest queued buffer */
+	GST_DREAMVIDEOSOURCE_OVERFLOW_KEYFRAME,        /* drop new frames up to the next keyframe */
+	GST_DREAMVIDEOSOURCE_OVERFLOW_NON_REFERENCE,   /* drop new non-reference access units, else as keyframe */
+	GST_DREAMVIDEOSOURCE_OVERFLOW_BLOCK            /* leave the descriptors in the encoder ring */
+} GstDreamVideoSourceOverflowPolicy;
+
+#define GST_TYPE_DREAMVIDEOSOURCE_OVERFLOW_POLICY (gst_dreamvideosource_overflow_policy_get_type ())
+
 struct _VideoBufferDescriptor
 {
 	CompressedBufferDescriptor stCommon;
@@ -186,6 +221,8 @@ struct _GstDreamVideoSource
 	GstDreamVideoSourceInputMode input_mode;
 
 	VideoFormatInfo video_info;
+	gboolean custom_resolutions; /* the driver takes fmt_custom */
+	gboolean custom_framerates;  /* the driver takes rate_custom */
 	GstCaps *current_caps, *new_caps;
 
 	unsigned int descriptors_available;
@@ -194,30 +231,90 @@ struct _GstDreamVideoSource
 	int dumpfd;
 
 	GstElement *dreamaudiosrc;
+	DreamSourceSync *sync;     /* shared with the audio source of the same encoder slot */
 	gint64 dts_offset;
+	TimestampUnit dts_unit;
+	TimestampCalibration calibration;
 
 	GMutex mutex;
-	GCond cond;
-	int control_sock[2];
-
-	gboolean flushing;
+	CommandQueue *commands;
+	gint loop_running;
+	gboolean restart_pending;
+	gboolean restart_stopped;      /* stopped for the restart, waiting for downstream to give back its memory */
 	gboolean dts_valid;
 
 	GThread *readthread;
-	GQueue current_frames;
-	guint buffer_size;
+	DreamSourceReactor *reactor;
+	DreamSourceReactorSource *reactor_source;
+	gboolean shared_reactor;
+	guint gop_cache_size;
+	GopCache gop_cache;
+	gchar *timeshift_location;
+	guint64 timeshift_size;
+	Timeshift *timeshift;      /* GST_OBJECT_LOCK, set while the read loop runs */
+	GstDreamSourceReadthreadState read_state;
+	GstClockTime read_clock_time, read_base_time;
+	gboolean discont;
+	gboolean keyframe;         /* the descriptors being read belong to a keyframe */
+	gboolean alignment_au;     /* negotiated alignment=au */
+	GstBuffer *access_unit;    /* picture being assembled for alignment=au */
+	gboolean stream_format_avc;
+	H264Headers h264_headers;
+	gint codec_data_pending;   /* atomic, new avc caps wait for the next SPS and PPS */
+	GstBuffer *codec_data;     /* not sent yet, goes out with the next buffer create () returns */
+
+	GstDreamVideoSourceInjectHeaders inject_headers;
+	H264Headers param_sets;    /* latest SPS/PPS seen in the bitstream */
+	GstMemory *param_sets_mem; /* the same with start codes, NULL until both were seen */
+	gboolean param_sets_pending; /* changed and not on a keyframe since */
+	guint frame_headers;       /* H264_HEADERS_* seen in the current keyframe */
+	guint64 offset;            /* bytes read since the READY to PAUSED transition */
+	KeyframeIndex keyframes;
+	FrameQueue *frames;
+	guint buffer_size;         /* frame queue limit, set on READY to PAUSED */
+	gboolean batch;
+	GstDreamVideoSourceTune tune;
+	gint tune_bframes, tune_slices; /* what zerolatency overrode */
+	gboolean tune_batch;
+	GstDreamVideoSourceOverflowPolicy overflow_policy;
+	gboolean overflow_skip;    /* dropping new frames until the next keyframe */
+	gboolean frame_start;      /* the descriptor being read starts a frame */
+	gint frame_ref_idc;        /* of the frame being read, -1 until its first slice */
+	DreamSourceStats stats;
+	EncoderLatency latency;
+	uint32_t read_stc;         /* STC at the last encoder read, from read_clock_time */
+	gboolean read_stc_valid;
+	gboolean tracker_full;     /* the read loop waits for downstream to free descriptors */
+	gboolean queue_full;       /* overflow-policy=block, the read loop waits for create () to pop */
+	guint descriptors_untracked; /* unread on PLAYING to PAUSED with the tracker full, given back on restart */
+
+	GstDreamSourceReleaseMode release_mode;
+	guint max_frames_in_flight;
 
 	GstClock *encoder_clock;
+	GstDreamSourceClockMode clock_mode;
+	gint device_index;
+
+	gboolean abr;
+	gint bitrate;              /* as configured, video_info.bitrate is what the encoder runs at */
+	gint abr_min_bitrate, abr_max_bitrate;
+	AbrController abr_controller;
 };
 
 struct _GstDreamVideoSourceClass
 {
 	GstPushSrcClass parent_class;
 	gint64 (*get_dts_offset) (GstDreamVideoSource *self);
+	GstBufferList * (*get_gop_cache) (GstDreamVideoSource *self, guint64 since);
+	guint64 (*timeshift_seek) (GstDreamVideoSource *self, guint64 time);
+	GstBufferList * (*timeshift_read) (GstDreamVideoSource *self, guint64 sequence, guint max_frames);
 };
 
 GType gst_dreamvideosource_get_type (void);
 GType gst_dreamvideosource_input_mode_get_type (void);
+GType gst_dreamvideosource_inject_headers_get_type (void);
+GType gst_dreamvideosource_tune_get_type (void);
+GType gst_dreamvideosource_overflow_policy_get_type (void);
 gboolean gst_dreamvideosource_plugin_init (GstPlugin * plugin);
 
 void gst_dreamvideosource_set_input_mode (GstDreamVideoSource *self, GstDreamVideoSourceInputMode mode);